@@ -16,7 +16,9 @@
 #include "abt-io-config.h"
 #include <abt.h>
 #include <abt-io.h>
+#ifdef HAVE_ABT_SNOOZER
 #include <abt-snoozer.h>
+#endif
 
 #ifndef HAVE_ODIRECT
 #define O_DIRECT 0
@@ -76,6 +78,13 @@ int main(int argc, char **argv)
     assert(ret == 1);
     ret = sscanf(argv[4], "%d", &common.opt_abt_snoozer);
     assert(ret == 1);
+#ifndef HAVE_ABT_SNOOZER
+    if(common.opt_abt_snoozer)
+    {
+        fprintf(stderr, "Error: built without abt-snoozer support.\n");
+        return(-1);
+    }
+#endif
     ret = sscanf(argv[5], "%d", &common.opt_unit_size);
     assert(ret == 1);
     assert(common.opt_unit_size % 4096 == 0);
@@ -98,6 +107,7 @@ int main(int argc, char **argv)
     ret = ABT_init(argc, argv);
     assert(ret == 0);
 
+#ifdef HAVE_ABT_SNOOZER
     if(common.opt_abt_snoozer)
     {
         /* set primary ES to idle without polling */
@@ -109,6 +119,7 @@ int main(int argc, char **argv)
         assert(ret == 0);
     }
     else
+#endif
     {
         ret = ABT_nosnoozer_xstream_create(compute_es_count, &compute_pool, compute_xstreams);
         assert(ret == 0);
@@ -116,6 +127,7 @@ int main(int argc, char **argv)
 
     if(common.opt_abt_io)
     {
+#ifdef HAVE_ABT_SNOOZER
         if(common.opt_abt_snoozer)
         {
             /* create dedicated pool drive IO */
@@ -123,6 +135,7 @@ int main(int argc, char **argv)
             assert(ret == 0);
         }
         else
+#endif
         {
             ret = ABT_nosnoozer_xstream_create(io_es_count, &io_pool, io_xstreams);
             assert(ret == 0);
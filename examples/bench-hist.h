@@ -0,0 +1,100 @@
+/*
+ * (C) 2015 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#ifndef __BENCH_HIST
+#define __BENCH_HIST
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/* Latency histogram shared by the benchmarks.  Buckets are log-linear: 16
+ * linear sub-buckets per power of two, so any value is recorded to within
+ * about 6% at a fixed 8 KiB per histogram.  Each thread records into its
+ * own histogram and the results are merged at the end.
+ */
+#define BENCH_HIST_SUB_BITS 4
+#define BENCH_HIST_SUB (1 << BENCH_HIST_SUB_BITS)
+#define BENCH_HIST_BUCKETS ((64 - BENCH_HIST_SUB_BITS + 1) * BENCH_HIST_SUB)
+
+struct bench_hist
+{
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[BENCH_HIST_BUCKETS];
+};
+
+static inline uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void bench_hist_init(struct bench_hist *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+static inline void bench_hist_record(struct bench_hist *h, uint64_t ns)
+{
+    int k, idx;
+
+    if (ns < BENCH_HIST_SUB)
+        idx = ns;
+    else
+    {
+        k = 63 - __builtin_clzll(ns);
+        idx = (k - BENCH_HIST_SUB_BITS + 1) * BENCH_HIST_SUB +
+            ((ns >> (k - BENCH_HIST_SUB_BITS)) & (BENCH_HIST_SUB - 1));
+    }
+    h->buckets[idx]++;
+    h->count++;
+    if (ns > h->max)
+        h->max = ns;
+}
+
+static inline void bench_hist_merge(struct bench_hist *dst,
+    const struct bench_hist *src)
+{
+    int i;
+
+    for (i = 0; i < BENCH_HIST_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+/* value at percentile p (0-100), in ns, as the midpoint of its bucket */
+static inline uint64_t bench_hist_percentile(const struct bench_hist *h,
+    double p)
+{
+    uint64_t target, seen = 0, lo, width;
+    int i, g, s;
+
+    if (h->count == 0)
+        return 0;
+    target = (uint64_t)(p / 100.0 * h->count);
+    if (target >= h->count)
+        target = h->count - 1;
+    for (i = 0; i < BENCH_HIST_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen > target)
+            break;
+    }
+    g = i / BENCH_HIST_SUB;
+    s = i % BENCH_HIST_SUB;
+    if (g == 0)
+        return s;
+    lo = (uint64_t)(BENCH_HIST_SUB + s) << (g - 1);
+    width = (uint64_t)1 << (g - 1);
+    lo += width / 2;
+    return lo < h->max ? lo : h->max;
+}
+
+#endif /* __BENCH_HIST */
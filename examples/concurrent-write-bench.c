@@ -16,7 +16,11 @@
 #include "abt-io-config.h"
 #include <abt.h>
 #include <abt-io.h>
+#ifdef HAVE_ABT_SNOOZER
 #include <abt-snoozer.h>
+#endif
+
+#include "bench-hist.h"
 
 #ifndef HAVE_ODIRECT
 #define O_DIRECT 0
@@ -28,6 +32,14 @@
  * a pthread version.
  *
  * Both tests use O_DIRECT and O_SYNC if available.
+ *
+ * Per-write latencies are collected in a histogram for percentiles.  In
+ * sweep mode every combination of the given write sizes and concurrency
+ * levels is measured and the results are written to a CSV file.
+ *
+ * The nonblocking version waits for its operations in the order they were
+ * issued, so an abt_nb latency includes any time an operation spent
+ * complete behind an older one; its percentiles are upper bounds.
  */
 
 /* abt data types and fn prototypes */
@@ -41,13 +53,16 @@ struct write_abt_arg
     double duration;
     abt_io_instance_id aid;
     void* buffer;
+    struct bench_hist hist;
 };
 
 static void write_abt_bench(void *_arg);
 static void abt_bench(int buffer_per_thread, unsigned int concurrency, size_t size, 
-    double duration, const char* filename, unsigned int* ops_done, double *seconds);
+    double duration, const char* filename, unsigned int* ops_done, double *seconds,
+    struct bench_hist *hist);
 static void abt_bench_nb(int buffer_per_thread, unsigned int concurrency, size_t size, 
-    double duration, const char* filename, unsigned int* ops_done, double *seconds);
+    double duration, const char* filename, unsigned int* ops_done, double *seconds,
+    struct bench_hist *hist);
 
 /* pthread data types and fn prototypes */
 struct write_pthread_arg
@@ -59,20 +74,29 @@ struct write_pthread_arg
     int fd;
     double duration;
     void* buffer;
+    struct bench_hist hist;
 };
 
 static void* write_pthread_bench(void *_arg);
 static void pthread_bench( int buffer_per_thread, unsigned int concurrency, size_t size, 
-    double duration, const char* filename, unsigned int* ops_done, double *seconds);
+    double duration, const char* filename, unsigned int* ops_done, double *seconds,
+    struct bench_hist *hist);
 
 
 static double wtime(void);
+static int parse_list(const char *str, unsigned long *list);
+static void report(FILE *out, int csv, const char *type, unsigned int concurrency,
+    size_t size, unsigned int ops_done, double seconds, const struct bench_hist *hist);
+static int sweep(int argc, char **argv);
+
+#define MAX_LIST 32
 
 int main(int argc, char **argv) 
 {
     int ret;
     unsigned abt_ops_done, abt_nb_ops_done, pthread_ops_done;
     double abt_seconds, abt_nb_seconds, pthread_seconds;
+    struct bench_hist abt_hist, abt_nb_hist, pthread_hist;
     size_t size;
     unsigned int concurrency;
     double duration;
@@ -80,14 +104,19 @@ int main(int argc, char **argv)
 
     ABT_init(argc, argv);
 
+#ifdef HAVE_ABT_SNOOZER
     /* set primary ES to idle without polling */
     ret = ABT_snoozer_xstream_self_set();
     assert(ret == 0);
+#endif
 
+    if(argc > 1 && strcmp(argv[1], "sweep") == 0)
+        return(sweep(argc, argv));
 
     if(argc != 6)
     {
         fprintf(stderr, "Usage: concurrent-write-bench <write_size> <concurrency> <duration> <file> <buffer_per_thread (0|1)>\n");
+        fprintf(stderr, "       concurrent-write-bench sweep <write_sizes> <concurrencies> <duration> <file> <buffer_per_thread (0|1)> <csv_file>\n");
         return(-1);
     }
 
@@ -122,11 +151,11 @@ int main(int argc, char **argv)
 
     /* run benchmarks */
     printf("# Running ABT benchmark...\n");
-    abt_bench(buffer_per_thread, concurrency, size, duration, argv[4], &abt_ops_done, &abt_seconds);
+    abt_bench(buffer_per_thread, concurrency, size, duration, argv[4], &abt_ops_done, &abt_seconds, &abt_hist);
     printf("# ...ABT benchmark done.\n");
 
     printf("# Running ABT (nonblocking) benchmark...\n");
-    abt_bench_nb(buffer_per_thread, concurrency, size, duration, argv[4], &abt_nb_ops_done, &abt_nb_seconds);
+    abt_bench_nb(buffer_per_thread, concurrency, size, duration, argv[4], &abt_nb_ops_done, &abt_nb_seconds, &abt_nb_hist);
     printf("# ...ABT (nonblocking) benchmark done.\n");
 
     ABT_finalize();
@@ -134,27 +163,114 @@ int main(int argc, char **argv)
     sleep(1);
 
     printf("# Running pthread benchmark...\n");
-    pthread_bench(buffer_per_thread, concurrency, size, duration, argv[4], &pthread_ops_done, &pthread_seconds);
+    pthread_bench(buffer_per_thread, concurrency, size, duration, argv[4], &pthread_ops_done, &pthread_seconds, &pthread_hist);
     printf("# ...pthread benchmark done.\n");
 
 
     /* output */
-    printf("#<type>\t<concurrency>\t<write_size>\t<ops>\t<seconds>\t<MiB/s>\n");
-    printf("abt\t%u\t%zu\t%u\t%f\t%f\n",
-        concurrency, size, abt_ops_done, abt_seconds, 
-        ((((double)size*(double)abt_ops_done))/abt_seconds)/(1024.0*1024.0));
-    printf("abt_nb\t%u\t%zu\t%u\t%f\t%f\n",
-        concurrency, size, abt_nb_ops_done, abt_nb_seconds, 
-        ((((double)size*(double)abt_nb_ops_done))/abt_nb_seconds)/(1024.0*1024.0));
-    printf("pthread\t%u\t%zu\t%u\t%f\t%f\n",
-        concurrency, size, pthread_ops_done, pthread_seconds, 
-        ((((double)size*(double)pthread_ops_done))/pthread_seconds)/(1024.0*1024.0));
+    printf("#<type>\t<concurrency>\t<write_size>\t<ops>\t<seconds>\t<MiB/s>\t<p50_us>\t<p99_us>\t<p99.9_us>\t<max_us>\n");
+    report(stdout, 0, "abt", concurrency, size, abt_ops_done, abt_seconds, &abt_hist);
+    report(stdout, 0, "abt_nb", concurrency, size, abt_nb_ops_done, abt_nb_seconds, &abt_nb_hist);
+    report(stdout, 0, "pthread", concurrency, size, pthread_ops_done, pthread_seconds, &pthread_hist);
 
     return(0);
 }
 
+/* runs every combination of write size and concurrency, writing CSV */
+static int sweep(int argc, char **argv)
+{
+    unsigned long sizes[MAX_LIST], concurrencies[MAX_LIST];
+    int nsizes, nconcurrencies, buffer_per_thread, s, c;
+    unsigned int ops_done;
+    double duration, seconds;
+    struct bench_hist hist;
+    FILE *out;
+
+    if(argc != 8 ||
+        (nsizes = parse_list(argv[2], sizes)) <= 0 ||
+        (nconcurrencies = parse_list(argv[3], concurrencies)) <= 0 ||
+        sscanf(argv[4], "%lf", &duration) != 1 ||
+        sscanf(argv[6], "%d", &buffer_per_thread) != 1)
+    {
+        fprintf(stderr, "Usage: concurrent-write-bench sweep <write_sizes> <concurrencies> <duration> <file> <buffer_per_thread (0|1)> <csv_file>\n");
+        fprintf(stderr, "       lists are comma-separated, e.g. 4096,65536 1,4,16\n");
+        return(-1);
+    }
+    buffer_per_thread = !!buffer_per_thread;
+
+    out = fopen(argv[7], "w");
+    if(!out)
+    {
+        perror("fopen");
+        return(-1);
+    }
+    fprintf(out, "type,concurrency,write_size,ops,seconds,mib_per_s,p50_us,p99_us,p99.9_us,max_us\n");
+
+    for(s = 0; s < nsizes; s++)
+        for(c = 0; c < nconcurrencies; c++)
+        {
+            printf("# abt, abt_nb: %lu x %lu bytes...\n", concurrencies[c], sizes[s]);
+            abt_bench(buffer_per_thread, concurrencies[c], sizes[s], duration, argv[5], &ops_done, &seconds, &hist);
+            report(out, 1, "abt", concurrencies[c], sizes[s], ops_done, seconds, &hist);
+            abt_bench_nb(buffer_per_thread, concurrencies[c], sizes[s], duration, argv[5], &ops_done, &seconds, &hist);
+            report(out, 1, "abt_nb", concurrencies[c], sizes[s], ops_done, seconds, &hist);
+            fflush(out);
+        }
+
+    ABT_finalize();
+
+    sleep(1);
+
+    for(s = 0; s < nsizes; s++)
+        for(c = 0; c < nconcurrencies; c++)
+        {
+            printf("# pthread: %lu x %lu bytes...\n", concurrencies[c], sizes[s]);
+            pthread_bench(buffer_per_thread, concurrencies[c], sizes[s], duration, argv[5], &ops_done, &seconds, &hist);
+            report(out, 1, "pthread", concurrencies[c], sizes[s], ops_done, seconds, &hist);
+            fflush(out);
+        }
+
+    fclose(out);
+    return(0);
+}
+
+static int parse_list(const char *str, unsigned long *list)
+{
+    char *end;
+    int n = 0;
+
+    while(n < MAX_LIST)
+    {
+        list[n] = strtoul(str, &end, 10);
+        if(end == str || list[n] == 0)
+            return(-1);
+        n++;
+        if(*end == '\0')
+            return(n);
+        if(*end != ',')
+            return(-1);
+        str = end + 1;
+    }
+    return(-1);
+}
+
+static void report(FILE *out, int csv, const char *type, unsigned int concurrency,
+    size_t size, unsigned int ops_done, double seconds, const struct bench_hist *hist)
+{
+    const char *fmt = csv ? "%s,%u,%zu,%u,%f,%f,%.1f,%.1f,%.1f,%.1f\n" :
+        "%s\t%u\t%zu\t%u\t%f\t%f\t%.1f\t%.1f\t%.1f\t%.1f\n";
+
+    fprintf(out, fmt, type, concurrency, size, ops_done, seconds,
+        ((((double)size*(double)ops_done))/seconds)/(1024.0*1024.0),
+        bench_hist_percentile(hist, 50.0) / 1e3,
+        bench_hist_percentile(hist, 99.0) / 1e3,
+        bench_hist_percentile(hist, 99.9) / 1e3,
+        hist->max / 1e3);
+    return;
+}
+
 static void abt_bench(int buffer_per_thread, unsigned int concurrency, size_t size, double duration,
-    const char *filename, unsigned int* ops_done, double *seconds)
+    const char *filename, unsigned int* ops_done, double *seconds, struct bench_hist *hist)
 {
     ABT_thread *tid_array = NULL;
     ABT_mutex mutex;
@@ -216,6 +332,7 @@ static void abt_bench(int buffer_per_thread, unsigned int concurrency, size_t si
         args[i].duration = duration;
         args[i].aid = aid;
         args[i].fd = fd;
+        bench_hist_init(&args[i].hist);
         if (buffer == NULL)
         {
             ret = posix_memalign(&args[i].buffer, 4096, size);
@@ -250,6 +367,10 @@ static void abt_bench(int buffer_per_thread, unsigned int concurrency, size_t si
     *seconds = end-start;
     *ops_done = next_offset/size;
 
+    bench_hist_init(hist);
+    for (i = 0; i < concurrency; i++)
+        bench_hist_merge(hist, &args[i].hist);
+
     abt_io_finalize(aid);
 
     ABT_mutex_free(&mutex);
@@ -272,7 +393,7 @@ static void abt_bench(int buffer_per_thread, unsigned int concurrency, size_t si
 }
 
 static void abt_bench_nb(int buffer_per_thread, unsigned int concurrency, size_t size, double duration,
-    const char *filename, unsigned int* ops_done, double *seconds)
+    const char *filename, unsigned int* ops_done, double *seconds, struct bench_hist *hist)
 {
     int fd;
     off_t next_offset = 0;
@@ -285,6 +406,7 @@ static void abt_bench_nb(int buffer_per_thread, unsigned int concurrency, size_t
     double start_time;
     abt_io_op_t **ops;
     ssize_t *wrets;
+    uint64_t *issued;
 
     fd = open(filename, O_WRONLY|O_CREAT|O_SYNC, S_IWUSR|S_IRUSR);
     if(!fd)
@@ -316,6 +438,9 @@ static void abt_bench_nb(int buffer_per_thread, unsigned int concurrency, size_t
     assert(ops);
     wrets = malloc(concurrency * sizeof(*wrets));
     assert(wrets);
+    issued = malloc(concurrency * sizeof(*issued));
+    assert(issued);
+    bench_hist_init(hist);
 
     /* start the benchmark */
     start_time = wtime();
@@ -328,10 +453,13 @@ static void abt_bench_nb(int buffer_per_thread, unsigned int concurrency, size_t
             ret = abt_io_op_wait(ops[i]);
             assert(ret == 0 && wrets[i] > 0 && (size_t)wrets[i] == size);
             abt_io_op_free(ops[i]);
+            /* taken when the op is harvested, not when it completed */
+            bench_hist_record(hist, bench_now_ns() - issued[i]);
         }
 
         if (wtime() - start_time < duration)
         {
+            issued[i] = bench_now_ns();
             ops[i] = abt_io_pwrite_nb(aid, fd, buffers[i*buffer_per_thread],
                     size, next_offset, wrets+i);
             assert(ops[i]);
@@ -355,6 +483,8 @@ static void abt_bench_nb(int buffer_per_thread, unsigned int concurrency, size_t
     free(buffers);
 
     free(wrets);
+    free(issued);
+    free(ops);
 
     close(fd);
     unlink(filename);
@@ -363,7 +493,7 @@ static void abt_bench_nb(int buffer_per_thread, unsigned int concurrency, size_t
 }
 
 static void pthread_bench(int buffer_per_thread, unsigned int concurrency, size_t size, double duration,
-    const char *filename, unsigned int* ops_done, double *seconds)
+    const char *filename, unsigned int* ops_done, double *seconds, struct bench_hist *hist)
 {
     pthread_t *id_array = NULL;
     pthread_mutex_t mutex;
@@ -406,6 +536,7 @@ static void pthread_bench(int buffer_per_thread, unsigned int concurrency, size_
         args[i].next_offset = &next_offset;
         args[i].duration = duration;
         args[i].fd = fd;
+        bench_hist_init(&args[i].hist);
         if(buffer == NULL)
         {
             ret = posix_memalign(&args[i].buffer, 4096, size);
@@ -437,6 +568,10 @@ static void pthread_bench(int buffer_per_thread, unsigned int concurrency, size_
     *seconds = end-start;
     *ops_done = next_offset/size;
 
+    bench_hist_init(hist);
+    for (i = 0; i < concurrency; i++)
+        bench_hist_merge(hist, &args[i].hist);
+
     pthread_mutex_destroy(&mutex);
     free(id_array);
 
@@ -461,6 +596,7 @@ static void write_abt_bench(void *_arg)
     struct write_abt_arg* arg = _arg;
     off_t my_offset;
     size_t ret;
+    uint64_t before;
 
     arg->start_time = wtime();
     while((wtime()-arg->start_time) < arg->duration) 
@@ -470,8 +606,10 @@ static void write_abt_bench(void *_arg)
         (*arg->next_offset) += arg->size;
         ABT_mutex_unlock(*arg->mutex);
 
+        before = bench_now_ns();
         ret = abt_io_pwrite(arg->aid, arg->fd, arg->buffer, arg->size, my_offset);
         assert(ret == arg->size);
+        bench_hist_record(&arg->hist, bench_now_ns() - before);
     }
 
     return;
@@ -482,6 +620,7 @@ static void *write_pthread_bench(void *_arg)
     struct write_pthread_arg* arg = _arg;
     off_t my_offset;
     size_t ret;
+    uint64_t before;
 
     arg->start_time = wtime();
     while((wtime()-arg->start_time) < arg->duration) 
@@ -491,8 +630,10 @@ static void *write_pthread_bench(void *_arg)
         (*arg->next_offset) += arg->size;
         pthread_mutex_unlock(arg->mutex);
 
+        before = bench_now_ns();
         ret = pwrite(arg->fd, arg->buffer, arg->size, my_offset);
         assert(ret == arg->size);
+        bench_hist_record(&arg->hist, bench_now_ns() - before);
     }
 
     return(NULL);
@@ -0,0 +1,382 @@
+#define  _GNU_SOURCE
+
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "abt-io-config.h"
+#include <abt.h>
+#include <abt-io.h>
+
+#include "bench-hist.h"
+
+/* Measures the per-operation cost of the library itself.  One caller
+ * issues each wrapper back to back against targets that do almost no work
+ * (/dev/null, a file on tmpfs, a pipe), so that the time per op is
+ * dominated by allocation, task creation, the handoff to a backing xstream
+ * and the wakeup.  Every op is run as a direct syscall ("sys", the device
+ * cost), through the blocking wrapper and through the _nb wrapper followed
+ * by an immediate wait, for 1 up to <max_backing_threads> backing threads
+ * in powers of two.  CPU time comes from getrusage() and covers all
+ * xstreams, so ops per CPU-second reflects any spinning as well.
+ */
+
+#define FORM_SYS 0
+#define FORM_BLOCKING 1
+#define FORM_NB 2
+
+static const char *form_names[] = { "sys", "blocking", "nb" };
+
+struct ctx
+{
+    abt_io_instance_id aid;
+    int null_fd;
+    int file_fd;
+    int pipe_fd[2];
+    abt_io_log_t *log;
+    char path[PATH_MAX];
+    char template[PATH_MAX];
+    char *buf;
+    size_t size;
+};
+
+struct bench_case
+{
+    const char *target;
+    const char *op;
+    int (*fn)(struct ctx *c, int form);
+    int ops_per_call;
+    int has_nb;
+};
+
+static int wait_op(abt_io_op_t *op)
+{
+    int ret;
+
+    if(op == NULL)
+        return(-1);
+    ret = abt_io_op_wait(op);
+    abt_io_op_free(op);
+    return(ret);
+}
+
+static int do_pwrite(struct ctx *c, int fd, int form)
+{
+    ssize_t ret;
+
+    if(form == FORM_SYS)
+        ret = pwrite(fd, c->buf, c->size, 0);
+    else if(form == FORM_BLOCKING)
+        ret = abt_io_pwrite(c->aid, fd, c->buf, c->size, 0);
+    else if(wait_op(abt_io_pwrite_nb(c->aid, fd, c->buf, c->size, 0, &ret)) != 0)
+        return(-1);
+    return(ret == (ssize_t)c->size ? 0 : -1);
+}
+
+static int do_pread(struct ctx *c, int fd, int form)
+{
+    ssize_t ret;
+
+    if(form == FORM_SYS)
+        ret = pread(fd, c->buf, c->size, 0);
+    else if(form == FORM_BLOCKING)
+        ret = abt_io_pread(c->aid, fd, c->buf, c->size, 0);
+    else if(wait_op(abt_io_pread_nb(c->aid, fd, c->buf, c->size, 0, &ret)) != 0)
+        return(-1);
+    /* /dev/null reads return 0 */
+    return(ret >= 0 ? 0 : -1);
+}
+
+static int null_pwrite(struct ctx *c, int form) { return(do_pwrite(c, c->null_fd, form)); }
+static int null_pread(struct ctx *c, int form) { return(do_pread(c, c->null_fd, form)); }
+static int file_pwrite(struct ctx *c, int form) { return(do_pwrite(c, c->file_fd, form)); }
+static int file_pread(struct ctx *c, int form) { return(do_pread(c, c->file_fd, form)); }
+
+static int null_write(struct ctx *c, int form)
+{
+    ssize_t ret;
+
+    if(form == FORM_SYS)
+        ret = write(c->null_fd, c->buf, c->size);
+    else
+        ret = abt_io_write(c->aid, c->null_fd, c->buf, c->size);
+    return(ret == (ssize_t)c->size ? 0 : -1);
+}
+
+static int file_ftruncate(struct ctx *c, int form)
+{
+    int ret;
+
+    if(form == FORM_SYS)
+        ret = ftruncate(c->file_fd, c->size) < 0 ? -errno : 0;
+    else if(form == FORM_BLOCKING)
+        ret = abt_io_ftruncate(c->aid, c->file_fd, c->size);
+    else if(wait_op(abt_io_ftruncate_nb(c->aid, c->file_fd, c->size, &ret)) != 0)
+        return(-1);
+    return(ret);
+}
+
+static int file_fallocate(struct ctx *c, int form)
+{
+    int ret;
+
+    if(form == FORM_SYS)
+#ifdef HAVE_FALLOCATE
+        ret = fallocate(c->file_fd, 0, 0, c->size) < 0 ? -errno : 0;
+#else
+        ret = -ENOSYS;
+#endif
+    else if(form == FORM_BLOCKING)
+        ret = abt_io_fallocate(c->aid, c->file_fd, 0, 0, c->size);
+    else if(wait_op(abt_io_fallocate_nb(c->aid, c->file_fd, 0, 0, c->size, &ret)) != 0)
+        return(-1);
+    return(ret);
+}
+
+static int file_append(struct ctx *c, int form)
+{
+    ssize_t ret;
+    off_t off;
+
+    if(form == FORM_SYS)
+        ret = write(c->file_fd, c->buf, c->size);
+    else if(form == FORM_BLOCKING)
+        ret = abt_io_append(c->aid, c->log, c->buf, c->size, &off);
+    else if(wait_op(abt_io_append_nb(c->aid, c->log, c->buf, c->size, &off, &ret)) != 0)
+        return(-1);
+    return(ret == (ssize_t)c->size ? 0 : -1);
+}
+
+/* open and close count as two ops */
+static int file_open_close(struct ctx *c, int form)
+{
+    int fd, ret;
+
+    if(form == FORM_SYS)
+    {
+        fd = open(c->path, O_RDONLY);
+        ret = fd < 0 ? -1 : close(fd);
+    }
+    else if(form == FORM_BLOCKING)
+    {
+        fd = abt_io_open(c->aid, c->path, O_RDONLY, 0);
+        ret = fd < 0 ? -1 : abt_io_close(c->aid, fd);
+    }
+    else
+    {
+        if(wait_op(abt_io_open_nb(c->aid, c->path, O_RDONLY, 0, &fd)) != 0 || fd < 0)
+            return(-1);
+        if(wait_op(abt_io_close_nb(c->aid, fd, &ret)) != 0)
+            return(-1);
+    }
+    return(ret);
+}
+
+/* mkostemp and unlink count as two ops */
+static int file_mkostemp_unlink(struct ctx *c, int form)
+{
+    char name[PATH_MAX];
+    int fd, ret;
+
+    strcpy(name, c->template);
+    if(form == FORM_SYS)
+    {
+        fd = mkostemp(name, 0);
+        if(fd < 0)
+            return(-1);
+        ret = unlink(name);
+    }
+    else if(form == FORM_BLOCKING)
+    {
+        fd = abt_io_mkostemp(c->aid, name, 0);
+        if(fd < 0)
+            return(-1);
+        ret = abt_io_unlink(c->aid, name);
+    }
+    else
+    {
+        if(wait_op(abt_io_mkostemp_nb(c->aid, name, 0, &fd)) != 0 || fd < 0)
+            return(-1);
+        if(wait_op(abt_io_unlink_nb(c->aid, name, &ret)) != 0)
+            return(-1);
+    }
+    close(fd);
+    return(ret);
+}
+
+/* a write into the pipe and the read that drains it count as two ops */
+static int pipe_write_read(struct ctx *c, int form)
+{
+    ssize_t ret;
+
+    if(form == FORM_SYS)
+    {
+        ret = write(c->pipe_fd[1], c->buf, c->size);
+        if(ret == (ssize_t)c->size)
+            ret = read(c->pipe_fd[0], c->buf, c->size);
+    }
+    else
+    {
+        ret = abt_io_write(c->aid, c->pipe_fd[1], c->buf, c->size);
+        if(ret == (ssize_t)c->size)
+            ret = abt_io_read(c->aid, c->pipe_fd[0], c->buf, c->size);
+    }
+    return(ret == (ssize_t)c->size ? 0 : -1);
+}
+
+static struct bench_case cases[] = {
+    { "devnull", "pwrite", null_pwrite, 1, 1 },
+    { "devnull", "pread", null_pread, 1, 1 },
+    { "devnull", "write", null_write, 1, 0 },
+    { "tmpfs", "pwrite", file_pwrite, 1, 1 },
+    { "tmpfs", "pread", file_pread, 1, 1 },
+    { "tmpfs", "append", file_append, 1, 1 },
+    { "tmpfs", "ftruncate", file_ftruncate, 1, 1 },
+    { "tmpfs", "fallocate", file_fallocate, 1, 1 },
+    { "tmpfs", "open+close", file_open_close, 2, 1 },
+    { "tmpfs", "mkostemp+unlink", file_mkostemp_unlink, 2, 1 },
+    { "pipe", "write+read", pipe_write_read, 2, 0 },
+};
+
+static double cpu_seconds(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return(ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+        ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6);
+}
+
+/* empties the file and starts a new log on it, so that appends in one
+ * case do not grow the file for the next */
+static int reset_file(struct ctx *c)
+{
+    if(ftruncate(c->file_fd, 0) < 0 || lseek(c->file_fd, 0, SEEK_SET) < 0)
+        return(-1);
+    abt_io_log_free(c->log);
+    c->log = abt_io_log_create(c->file_fd, 0, 0);
+    return(c->log != NULL ? 0 : -1);
+}
+
+static void run_case(struct ctx *c, const struct bench_case *bc, int form,
+    int threads, unsigned long iterations)
+{
+    unsigned long i;
+    uint64_t start, end;
+    double cpu, ops;
+
+    if(reset_file(c) != 0)
+    {
+        perror("reset_file");
+        printf("# %s %s %s: failed\n", bc->target, bc->op, form_names[form]);
+        return;
+    }
+
+    /* warm up caches, the op allocator and the xstreams */
+    for(i = 0; i < iterations / 100 + 1; i++)
+        if(bc->fn(c, form) != 0)
+        {
+            printf("# %s %s %s: failed\n", bc->target, bc->op, form_names[form]);
+            return;
+        }
+
+    cpu = cpu_seconds();
+    start = bench_now_ns();
+    for(i = 0; i < iterations; i++)
+    {
+        if(bc->fn(c, form) != 0)
+        {
+            printf("# %s %s %s: failed\n", bc->target, bc->op, form_names[form]);
+            return;
+        }
+    }
+    end = bench_now_ns();
+    cpu = cpu_seconds() - cpu;
+
+    ops = (double)iterations * bc->ops_per_call;
+    printf("%s\t%s\t%s\t%d\t%.0f\t%.1f\t%.0f\t%.0f\n",
+        bc->target, bc->op, form_names[form], threads, ops,
+        (end - start) / ops, ops / ((end - start) / 1e9),
+        cpu > 0 ? ops / cpu : 0.0);
+    fflush(stdout);
+    return;
+}
+
+int main(int argc, char **argv)
+{
+    struct ctx c;
+    unsigned long iterations;
+    int max_threads, threads, last;
+    unsigned int i;
+
+    if(argc != 4 || sscanf(argv[1], "%lu", &iterations) != 1 ||
+        sscanf(argv[2], "%d", &max_threads) != 1 || max_threads < 1)
+    {
+        fprintf(stderr, "Usage: op-overhead-bench <iterations> <max_backing_threads> <tmpfs_dir>\n");
+        return(-1);
+    }
+
+    memset(&c, 0, sizeof(c));
+    c.size = 64;
+    c.buf = calloc(1, c.size);
+    assert(c.buf);
+    snprintf(c.path, sizeof(c.path), "%s/op-overhead-bench-%d", argv[3], (int)getpid());
+    snprintf(c.template, sizeof(c.template), "%s/op-overhead-bench-XXXXXX", argv[3]);
+
+    c.null_fd = open("/dev/null", O_RDWR);
+    c.file_fd = open(c.path, O_RDWR|O_CREAT|O_TRUNC, S_IWUSR|S_IRUSR);
+    if(c.null_fd < 0 || c.file_fd < 0 || pipe(c.pipe_fd) < 0)
+    {
+        perror("open");
+        return(-1);
+    }
+    c.log = abt_io_log_create(c.file_fd, 0, 0);
+    assert(c.log);
+
+    ABT_init(argc, argv);
+
+    printf("#<target>\t<op>\t<form>\t<backing_threads>\t<ops>\t<ns/op>\t<ops/s>\t<ops/cpu_s>\n");
+
+    /* device cost alone */
+    for(i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        run_case(&c, &cases[i], FORM_SYS, 0, iterations);
+
+    for(threads = 1, last = 0; !last; threads *= 2)
+    {
+        if(threads >= max_threads)
+        {
+            threads = max_threads;
+            last = 1;
+        }
+        c.aid = abt_io_init(threads);
+        assert(c.aid != NULL);
+        for(i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        {
+            run_case(&c, &cases[i], FORM_BLOCKING, threads, iterations);
+            if(cases[i].has_nb)
+                run_case(&c, &cases[i], FORM_NB, threads, iterations);
+        }
+        abt_io_finalize(c.aid);
+    }
+
+    ABT_finalize();
+
+    if(c.log != NULL)
+        abt_io_log_free(c.log);
+    close(c.pipe_fd[0]);
+    close(c.pipe_fd[1]);
+    close(c.file_fd);
+    close(c.null_fd);
+    unlink(c.path);
+    free(c.buf);
+    return(0);
+}
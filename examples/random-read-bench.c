@@ -0,0 +1,388 @@
+#define  _GNU_SOURCE
+
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "abt-io-config.h"
+#include <abt.h>
+#include <abt-io.h>
+
+#include "bench-hist.h"
+
+#ifndef HAVE_ODIRECT
+#define O_DIRECT 0
+#endif
+
+/* Random read benchmark.  Each of <ults> ULTs keeps <queue_depth>
+ * abt_io_pread_nb() operations of <block_size> bytes in flight at random
+ * block-aligned offsets of a <file_size_mib> MiB file (created and filled
+ * first if it is too short).  The same load runs on each abt-io engine
+ * configuration and on a pthread baseline with <ults> * <queue_depth>
+ * threads issuing pread() directly.
+ *
+ * Operations are waited for in the order they were issued, so a latency
+ * includes any time an operation spent complete behind an older one.
+ */
+
+struct read_arg
+{
+    abt_io_instance_id aid;
+    int fd;
+    size_t block_size;
+    off_t num_blocks;
+    unsigned int depth;
+    double duration;
+    uint64_t seed;
+    uint64_t ops;
+    struct bench_hist hist;
+};
+
+struct engine
+{
+    const char *name;
+    void (*set)(struct abt_io_init_opts *opts);
+};
+
+static void set_threads(struct abt_io_init_opts *opts) { (void)opts; }
+static void set_rings(struct abt_io_init_opts *opts) { opts->submit_rings = 1; }
+static void set_pools(struct abt_io_init_opts *opts) { opts->pool_dispatch = ABT_IO_POOL_LEAST_LOADED; }
+#ifdef HAVE_PREADV2
+static void set_nowait(struct abt_io_init_opts *opts) { opts->inline_nowait = 1; }
+#endif
+
+static struct engine engines[] = {
+    { "threads", set_threads },
+    { "rings", set_rings },
+    { "pools", set_pools },
+#ifdef HAVE_PREADV2
+    { "nowait", set_nowait },
+#endif
+};
+
+static void prepare_file(const char *filename, off_t file_size);
+static void abt_bench(const struct engine *e, struct read_arg *proto,
+    unsigned int ults, int backing_threads, double *seconds);
+static void pthread_bench(struct read_arg *proto, unsigned int threads,
+    double *seconds);
+static void read_abt_bench(void *_arg);
+static void *read_pthread_bench(void *_arg);
+static void report(const char *name, struct read_arg *args, unsigned int n,
+    unsigned int ults, unsigned int depth, size_t block_size, double seconds);
+static off_t next_block(uint64_t *seed, off_t num_blocks);
+
+int main(int argc, char **argv)
+{
+    struct read_arg proto;
+    unsigned int ults, depth, i;
+    size_t block_size, file_mib;
+    int backing_threads, direct, flags;
+    double duration, seconds;
+
+    if(argc != 9)
+    {
+        fprintf(stderr, "Usage: random-read-bench <file> <file_size_mib> <block_size> <ults> <queue_depth> <backing_threads> <duration> <o_direct (0|1)>\n");
+        return(-1);
+    }
+    if(sscanf(argv[2], "%zu", &file_mib) != 1 ||
+        sscanf(argv[3], "%zu", &block_size) != 1 ||
+        sscanf(argv[4], "%u", &ults) != 1 ||
+        sscanf(argv[5], "%u", &depth) != 1 ||
+        sscanf(argv[6], "%d", &backing_threads) != 1 ||
+        sscanf(argv[7], "%lf", &duration) != 1 ||
+        sscanf(argv[8], "%d", &direct) != 1 ||
+        block_size == 0 || ults == 0 || depth == 0 ||
+        (off_t)(file_mib * 1024 * 1024) < (off_t)block_size)
+    {
+        fprintf(stderr, "Usage: random-read-bench <file> <file_size_mib> <block_size> <ults> <queue_depth> <backing_threads> <duration> <o_direct (0|1)>\n");
+        return(-1);
+    }
+
+    prepare_file(argv[1], (off_t)file_mib * 1024 * 1024);
+
+    flags = O_RDONLY;
+    if(direct)
+        flags |= O_DIRECT;
+    memset(&proto, 0, sizeof(proto));
+    proto.fd = open(argv[1], flags);
+    if(proto.fd < 0)
+    {
+        perror("open");
+        return(-1);
+    }
+    proto.block_size = block_size;
+    proto.num_blocks = (off_t)file_mib * 1024 * 1024 / block_size;
+    proto.depth = depth;
+    proto.duration = duration;
+
+    ABT_init(argc, argv);
+
+    printf("#<engine>\t<ults>\t<queue_depth>\t<block_size>\t<ops>\t<seconds>\t<IOPS>\t<MiB/s>\t<p50_us>\t<p99_us>\t<p99.9_us>\t<max_us>\n");
+    for(i = 0; i < sizeof(engines) / sizeof(engines[0]); i++)
+        abt_bench(&engines[i], &proto, ults, backing_threads, &seconds);
+
+    ABT_finalize();
+
+    pthread_bench(&proto, ults * depth, &seconds);
+
+    close(proto.fd);
+    return(0);
+}
+
+/* makes sure the file exists and is at least file_size bytes long */
+static void prepare_file(const char *filename, off_t file_size)
+{
+    struct stat st;
+    size_t chunk = 1024 * 1024;
+    char *buf;
+    off_t off;
+    ssize_t ret;
+    int fd;
+
+    fd = open(filename, O_WRONLY|O_CREAT, S_IWUSR|S_IRUSR);
+    if(fd < 0)
+    {
+        perror("open");
+        assert(0);
+    }
+    ret = fstat(fd, &st);
+    assert(ret == 0);
+    if(st.st_size >= file_size)
+    {
+        close(fd);
+        return;
+    }
+
+    printf("# Filling %s with %lld MiB...\n", filename, (long long)(file_size >> 20));
+    buf = malloc(chunk);
+    assert(buf);
+    memset(buf, 0xa5, chunk);
+    for(off = st.st_size; off < file_size; off += ret)
+    {
+        ret = pwrite(fd, buf, file_size - off < (off_t)chunk ? (size_t)(file_size - off) : chunk, off);
+        assert(ret > 0);
+    }
+    fsync(fd);
+    free(buf);
+    close(fd);
+    return;
+}
+
+static void abt_bench(const struct engine *e, struct read_arg *proto,
+    unsigned int ults, int backing_threads, double *seconds)
+{
+    struct abt_io_init_opts opts;
+    struct read_arg *args;
+    ABT_thread *tid_array;
+    ABT_xstream xstream;
+    ABT_pool pool;
+    uint64_t start;
+    unsigned int i;
+    int ret;
+
+    abt_io_init_opts_default(&opts);
+    opts.backing_thread_count = backing_threads;
+    e->set(&opts);
+    proto->aid = abt_io_init_ext(&opts);
+    if(proto->aid == ABT_IO_INSTANCE_NULL)
+    {
+        printf("# %s: not available\n", e->name);
+        return;
+    }
+
+    ret = ABT_xstream_self(&xstream);
+    assert(ret == 0);
+    ret = ABT_xstream_get_main_pools(xstream, 1, &pool);
+    assert(ret == 0);
+
+    args = malloc(ults * sizeof(*args));
+    tid_array = malloc(ults * sizeof(*tid_array));
+    assert(args && tid_array);
+
+    start = bench_now_ns();
+    for(i = 0; i < ults; i++)
+    {
+        args[i] = *proto;
+        args[i].seed = i + 1;
+        bench_hist_init(&args[i].hist);
+        ret = ABT_thread_create(pool, read_abt_bench, &args[i], ABT_THREAD_ATTR_NULL, &tid_array[i]);
+        assert(ret == 0);
+    }
+    for(i = 0; i < ults; i++)
+    {
+        ABT_thread_join(tid_array[i]);
+        ABT_thread_free(&tid_array[i]);
+    }
+    *seconds = (bench_now_ns() - start) / 1e9;
+
+    abt_io_finalize(proto->aid);
+    report(e->name, args, ults, ults, proto->depth, proto->block_size, *seconds);
+
+    free(tid_array);
+    free(args);
+    return;
+}
+
+static void pthread_bench(struct read_arg *proto, unsigned int threads,
+    double *seconds)
+{
+    struct read_arg *args;
+    pthread_t *id_array;
+    uint64_t start;
+    unsigned int i;
+    int ret;
+
+    args = malloc(threads * sizeof(*args));
+    id_array = malloc(threads * sizeof(*id_array));
+    assert(args && id_array);
+
+    start = bench_now_ns();
+    for(i = 0; i < threads; i++)
+    {
+        args[i] = *proto;
+        args[i].depth = 1;
+        args[i].seed = i + 1;
+        bench_hist_init(&args[i].hist);
+        ret = pthread_create(&id_array[i], NULL, read_pthread_bench, &args[i]);
+        assert(ret == 0);
+    }
+    for(i = 0; i < threads; i++)
+    {
+        ret = pthread_join(id_array[i], NULL);
+        assert(ret == 0);
+    }
+    *seconds = (bench_now_ns() - start) / 1e9;
+
+    report("pthread", args, threads, threads, 1, proto->block_size, *seconds);
+
+    free(id_array);
+    free(args);
+    return;
+}
+
+static void read_abt_bench(void *_arg)
+{
+    struct read_arg *arg = _arg;
+    abt_io_op_t **ops;
+    ssize_t *rets;
+    uint64_t *issued, start, now;
+    char *buffers;
+    unsigned int i;
+    int ret, running = 1;
+
+    ops = calloc(arg->depth, sizeof(*ops));
+    rets = malloc(arg->depth * sizeof(*rets));
+    issued = malloc(arg->depth * sizeof(*issued));
+    ret = posix_memalign((void**)&buffers, 4096, arg->depth * arg->block_size);
+    assert(ops && rets && issued && ret == 0);
+
+    start = bench_now_ns();
+    for(i = 0; ; i = (i+1) % arg->depth)
+    {
+        if(ops[i] != NULL)
+        {
+            ret = abt_io_op_wait(ops[i]);
+            assert(ret == 0 && rets[i] == (ssize_t)arg->block_size);
+            abt_io_op_free(ops[i]);
+            ops[i] = NULL;
+            now = bench_now_ns();
+            bench_hist_record(&arg->hist, now - issued[i]);
+            arg->ops++;
+            if(running && now - start >= arg->duration * 1e9)
+                running = 0;
+        }
+
+        if(running)
+        {
+            issued[i] = bench_now_ns();
+            ops[i] = abt_io_pread_nb(arg->aid, arg->fd, buffers + i * arg->block_size,
+                arg->block_size, next_block(&arg->seed, arg->num_blocks) * arg->block_size,
+                &rets[i]);
+            assert(ops[i]);
+        }
+        else
+        {
+            /* drain what is still in flight */
+            unsigned int j;
+            for(j = 0; j < arg->depth && ops[j] == NULL; j++);
+            if(j == arg->depth)
+                break;
+        }
+    }
+
+    free(buffers);
+    free(issued);
+    free(rets);
+    free(ops);
+    return;
+}
+
+static void *read_pthread_bench(void *_arg)
+{
+    struct read_arg *arg = _arg;
+    uint64_t start, before, now;
+    void *buffer;
+    ssize_t ret;
+
+    ret = posix_memalign(&buffer, 4096, arg->block_size);
+    assert(ret == 0);
+
+    start = bench_now_ns();
+    do
+    {
+        before = bench_now_ns();
+        ret = pread(arg->fd, buffer, arg->block_size,
+            next_block(&arg->seed, arg->num_blocks) * arg->block_size);
+        assert(ret == (ssize_t)arg->block_size);
+        now = bench_now_ns();
+        bench_hist_record(&arg->hist, now - before);
+        arg->ops++;
+    } while(now - start < arg->duration * 1e9);
+
+    free(buffer);
+    return(NULL);
+}
+
+static void report(const char *name, struct read_arg *args, unsigned int n,
+    unsigned int ults, unsigned int depth, size_t block_size, double seconds)
+{
+    struct bench_hist hist;
+    uint64_t ops = 0;
+    unsigned int i;
+
+    bench_hist_init(&hist);
+    for(i = 0; i < n; i++)
+    {
+        bench_hist_merge(&hist, &args[i].hist);
+        ops += args[i].ops;
+    }
+
+    printf("%s\t%u\t%u\t%zu\t%lu\t%f\t%f\t%f\t%.1f\t%.1f\t%.1f\t%.1f\n",
+        name, ults, depth, block_size, (unsigned long)ops, seconds, ops / seconds,
+        ((double)ops * block_size / seconds) / (1024.0*1024.0),
+        bench_hist_percentile(&hist, 50.0) / 1e3,
+        bench_hist_percentile(&hist, 99.0) / 1e3,
+        bench_hist_percentile(&hist, 99.9) / 1e3,
+        hist.max / 1e3);
+    fflush(stdout);
+    return;
+}
+
+/* xorshift; good enough to scatter offsets */
+static off_t next_block(uint64_t *seed, off_t num_blocks)
+{
+    uint64_t x = *seed;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *seed = x;
+    return (off_t)(x % (uint64_t)num_blocks);
+}
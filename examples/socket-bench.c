@@ -0,0 +1,481 @@
+#define  _GNU_SOURCE
+
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "abt-io-config.h"
+#include <abt.h>
+#include <abt-io.h>
+
+#include "bench-hist.h"
+
+/* Loopback echo benchmark for socket front-ends.  Client threads keep
+ * <depth> length-prefixed requests in flight on each of <connections> TCP
+ * connections; the server echoes every frame back.  The server runs either
+ * on the abt-io socket reactor, with one ULT per connection on
+ * <server_xstreams> execution streams, or as one pthread per connection.
+ * Connection counts, message sizes and depths are comma-separated lists
+ * and every combination is measured.
+ *
+ * Each request carries its send time, so the clients measure round-trip
+ * latency per message.
+ */
+
+#define MAX_LIST 32
+
+struct client_conn
+{
+    int fd;
+    size_t size;
+    unsigned int depth;
+    double duration;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    unsigned int inflight;
+    int sending;
+    uint64_t msgs;
+    struct bench_hist hist;
+};
+
+struct server_conn
+{
+    int fd;
+    abt_io_conn_t conn;
+};
+
+static int parse_list(const char *str, unsigned long *list);
+static void run(int model, unsigned int conns,
+    size_t size, unsigned int depth, double duration);
+static void *client_send(void *_arg);
+static void *client_recv(void *_arg);
+static void echo_abt(void *_arg);
+static void *echo_pthread(void *_arg);
+static int read_all(int fd, void *buf, size_t len);
+static int write_all(int fd, struct iovec *iov, int iovcnt);
+
+static ABT_pool server_pool;
+
+#define MODEL_ABT 0
+#define MODEL_PTHREAD 1
+
+int main(int argc, char **argv)
+{
+    unsigned long conns[MAX_LIST], sizes[MAX_LIST], depths[MAX_LIST];
+    int nconns, nsizes, ndepths, server_xstreams;
+    ABT_xstream *xstreams;
+    double duration;
+    int ret, i, c, s, d;
+
+    if(argc != 6)
+    {
+        fprintf(stderr, "Usage: socket-bench <connections> <msg_sizes> <depths> <duration> <server_xstreams>\n");
+        fprintf(stderr, "       lists are comma-separated, e.g. 1,16,256 64,4096 1,8\n");
+        return(-1);
+    }
+
+    nconns = parse_list(argv[1], conns);
+    nsizes = parse_list(argv[2], sizes);
+    ndepths = parse_list(argv[3], depths);
+    if(nconns <= 0 || nsizes <= 0 || ndepths <= 0 ||
+        sscanf(argv[4], "%lf", &duration) != 1 ||
+        sscanf(argv[5], "%d", &server_xstreams) != 1 || server_xstreams < 1)
+    {
+        fprintf(stderr, "Usage: socket-bench <connections> <msg_sizes> <depths> <duration> <server_xstreams>\n");
+        return(-1);
+    }
+
+    ABT_init(argc, argv);
+
+    /* server ULTs run on their own execution streams, away from the
+     * primary one that drives the benchmark */
+    ret = ABT_pool_create_basic(ABT_POOL_FIFO, ABT_POOL_ACCESS_MPMC, ABT_TRUE,
+        &server_pool);
+    assert(ret == 0);
+    xstreams = malloc(server_xstreams * sizeof(*xstreams));
+    assert(xstreams);
+    for(i = 0; i < server_xstreams; i++)
+    {
+        ret = ABT_xstream_create_basic(ABT_SCHED_DEFAULT, 1, &server_pool,
+            ABT_SCHED_CONFIG_NULL, &xstreams[i]);
+        assert(ret == 0);
+    }
+    ret = abt_io_socket_initialize(0);
+    assert(ret >= 0);
+
+    printf("#<model>\t<connections>\t<msg_size>\t<depth>\t<msgs>\t<seconds>\t<msgs/s>\t<MiB/s>\t<p50_us>\t<p99_us>\t<p99.9_us>\t<max_us>\n");
+    for(c = 0; c < nconns; c++)
+        for(s = 0; s < nsizes; s++)
+            for(d = 0; d < ndepths; d++)
+            {
+                run(MODEL_ABT, conns[c], sizes[s], depths[d], duration);
+                run(MODEL_PTHREAD, conns[c], sizes[s], depths[d], duration);
+            }
+
+    abt_io_socket_finalize();
+    for(i = 0; i < server_xstreams; i++)
+    {
+        ABT_xstream_join(xstreams[i]);
+        ABT_xstream_free(&xstreams[i]);
+    }
+    free(xstreams);
+    ABT_finalize();
+
+    return(0);
+}
+
+static int parse_list(const char *str, unsigned long *list)
+{
+    char *end;
+    int n = 0;
+
+    while(n < MAX_LIST)
+    {
+        list[n] = strtoul(str, &end, 10);
+        if(end == str || list[n] == 0)
+            return(-1);
+        n++;
+        if(*end == '\0')
+            return(n);
+        if(*end != ',')
+            return(-1);
+        str = end + 1;
+    }
+    return(-1);
+}
+
+static void run(int model, unsigned int conns,
+    size_t size, unsigned int depth, double duration)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    struct client_conn *clients;
+    struct server_conn *servers;
+    pthread_t *client_tids, *server_tids = NULL;
+    ABT_thread *server_ults = NULL;
+    struct bench_hist hist;
+    uint64_t msgs = 0, start, end;
+    double seconds;
+    int lfd, one = 1;
+    unsigned int i;
+    int ret;
+
+    /* requests carry an 8-byte timestamp */
+    if(size < sizeof(uint64_t))
+        size = sizeof(uint64_t);
+
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(lfd >= 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ret = bind(lfd, (struct sockaddr*)&addr, sizeof(addr));
+    assert(ret == 0);
+    ret = listen(lfd, conns);
+    assert(ret == 0);
+    ret = getsockname(lfd, (struct sockaddr*)&addr, &addrlen);
+    assert(ret == 0);
+
+    clients = calloc(conns, sizeof(*clients));
+    servers = calloc(conns, sizeof(*servers));
+    client_tids = malloc(2 * conns * sizeof(*client_tids));
+    assert(clients && servers && client_tids);
+
+    for(i = 0; i < conns; i++)
+    {
+        clients[i].fd = socket(AF_INET, SOCK_STREAM, 0);
+        assert(clients[i].fd >= 0);
+        ret = connect(clients[i].fd, (struct sockaddr*)&addr, sizeof(addr));
+        if(ret < 0)
+        {
+            perror("connect");
+            assert(0);
+        }
+        setsockopt(clients[i].fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        servers[i].fd = accept(lfd, NULL, NULL);
+        assert(servers[i].fd >= 0);
+        setsockopt(servers[i].fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        clients[i].size = size;
+        clients[i].depth = depth;
+        clients[i].duration = duration;
+        clients[i].sending = 1;
+        pthread_mutex_init(&clients[i].mutex, NULL);
+        pthread_cond_init(&clients[i].cond, NULL);
+        bench_hist_init(&clients[i].hist);
+    }
+    close(lfd);
+
+    /* start the server side */
+    if(model == MODEL_ABT)
+    {
+        server_ults = malloc(conns * sizeof(*server_ults));
+        assert(server_ults);
+        for(i = 0; i < conns; i++)
+        {
+            servers[i].conn = abt_io_sock_register(servers[i].fd, ABT_IO_SOCK_READ);
+            assert(servers[i].conn != ABT_IO_CONN_NULL);
+            ret = ABT_thread_create(server_pool, echo_abt, &servers[i],
+                ABT_THREAD_ATTR_NULL, &server_ults[i]);
+            assert(ret == 0);
+        }
+    }
+    else
+    {
+        server_tids = malloc(conns * sizeof(*server_tids));
+        assert(server_tids);
+        for(i = 0; i < conns; i++)
+        {
+            ret = pthread_create(&server_tids[i], NULL, echo_pthread, &servers[i]);
+            assert(ret == 0);
+        }
+    }
+
+    start = bench_now_ns();
+    for(i = 0; i < conns; i++)
+    {
+        ret = pthread_create(&client_tids[2*i], NULL, client_recv, &clients[i]);
+        assert(ret == 0);
+        ret = pthread_create(&client_tids[2*i+1], NULL, client_send, &clients[i]);
+        assert(ret == 0);
+    }
+    for(i = 0; i < 2 * conns; i++)
+        pthread_join(client_tids[i], NULL);
+    end = bench_now_ns();
+
+    /* clients have shut down their side; the servers see EOF */
+    for(i = 0; i < conns; i++)
+    {
+        if(model == MODEL_ABT)
+        {
+            ABT_thread_join(server_ults[i]);
+            ABT_thread_free(&server_ults[i]);
+        }
+        else
+            pthread_join(server_tids[i], NULL);
+    }
+
+    bench_hist_init(&hist);
+    for(i = 0; i < conns; i++)
+    {
+        bench_hist_merge(&hist, &clients[i].hist);
+        msgs += clients[i].msgs;
+        close(clients[i].fd);
+        pthread_mutex_destroy(&clients[i].mutex);
+        pthread_cond_destroy(&clients[i].cond);
+    }
+    seconds = (end - start) / 1e9;
+
+    printf("%s\t%u\t%zu\t%u\t%lu\t%f\t%f\t%f\t%.1f\t%.1f\t%.1f\t%.1f\n",
+        model == MODEL_ABT ? "abt" : "pthread", conns, size, depth,
+        (unsigned long)msgs, seconds, msgs / seconds,
+        ((double)msgs * size / seconds) / (1024.0*1024.0),
+        bench_hist_percentile(&hist, 50.0) / 1e3,
+        bench_hist_percentile(&hist, 99.0) / 1e3,
+        bench_hist_percentile(&hist, 99.9) / 1e3,
+        hist.max / 1e3);
+    fflush(stdout);
+
+    free(server_ults);
+    free(server_tids);
+    free(client_tids);
+    free(servers);
+    free(clients);
+    return;
+}
+
+/* sends a request whenever one of the connection's depth slots is free */
+static void *client_send(void *_arg)
+{
+    struct client_conn *cc = _arg;
+    struct iovec iov[2];
+    uint32_t hdr = htonl(cc->size);
+    uint64_t start, now;
+    char *buf;
+    int ret;
+
+    buf = calloc(1, cc->size);
+    assert(buf);
+
+    start = bench_now_ns();
+    while(1)
+    {
+        pthread_mutex_lock(&cc->mutex);
+        while(cc->inflight == cc->depth)
+            pthread_cond_wait(&cc->cond, &cc->mutex);
+        now = bench_now_ns();
+        if(now - start >= cc->duration * 1e9)
+        {
+            /* wait for the responses still in flight, then hang up */
+            cc->sending = 0;
+            while(cc->inflight > 0)
+                pthread_cond_wait(&cc->cond, &cc->mutex);
+            pthread_mutex_unlock(&cc->mutex);
+            break;
+        }
+        cc->inflight++;
+        pthread_mutex_unlock(&cc->mutex);
+
+        memcpy(buf, &now, sizeof(now));
+        iov[0].iov_base = &hdr;
+        iov[0].iov_len = sizeof(hdr);
+        iov[1].iov_base = buf;
+        iov[1].iov_len = cc->size;
+        ret = write_all(cc->fd, iov, 2);
+        assert(ret == 0);
+    }
+
+    shutdown(cc->fd, SHUT_WR);
+    free(buf);
+    return(NULL);
+}
+
+static void *client_recv(void *_arg)
+{
+    struct client_conn *cc = _arg;
+    uint64_t sent;
+    uint32_t hdr;
+    char *buf;
+    int ret;
+
+    buf = malloc(cc->size);
+    assert(buf);
+
+    while(1)
+    {
+        pthread_mutex_lock(&cc->mutex);
+        if(!cc->sending && cc->inflight == 0)
+        {
+            pthread_mutex_unlock(&cc->mutex);
+            break;
+        }
+        pthread_mutex_unlock(&cc->mutex);
+
+        ret = read_all(cc->fd, &hdr, sizeof(hdr));
+        if(ret != 0)
+            break;
+        assert(ntohl(hdr) == cc->size);
+        ret = read_all(cc->fd, buf, cc->size);
+        assert(ret == 0);
+        memcpy(&sent, buf, sizeof(sent));
+        bench_hist_record(&cc->hist, bench_now_ns() - sent);
+
+        pthread_mutex_lock(&cc->mutex);
+        cc->msgs++;
+        cc->inflight--;
+        pthread_cond_broadcast(&cc->cond);
+        pthread_mutex_unlock(&cc->mutex);
+    }
+
+    free(buf);
+    return(NULL);
+}
+
+/* echoes frames on the reactor until the client hangs up */
+static void echo_abt(void *_arg)
+{
+    struct server_conn *sc = _arg;
+    void *msg;
+    ssize_t ret;
+
+    while(1)
+    {
+        ret = abt_io_msg_recv(sc->conn, &msg);
+        if(ret < 0 || msg == NULL)
+            break;
+        ret = abt_io_msg_send(sc->conn, msg, ret, 0);
+        abt_io_msg_release(msg);
+        if(ret < 0)
+            break;
+    }
+
+    abt_io_sock_deregister(sc->conn);
+    close(sc->fd);
+    return;
+}
+
+static void *echo_pthread(void *_arg)
+{
+    struct server_conn *sc = _arg;
+    struct iovec iov[2];
+    uint32_t hdr;
+    size_t size = 0, len;
+    char *buf = NULL;
+
+    while(read_all(sc->fd, &hdr, sizeof(hdr)) == 0)
+    {
+        len = ntohl(hdr);
+        if(len > size)
+        {
+            free(buf);
+            buf = malloc(len);
+            assert(buf);
+            size = len;
+        }
+        if(read_all(sc->fd, buf, len) != 0)
+            break;
+        iov[0].iov_base = &hdr;
+        iov[0].iov_len = sizeof(hdr);
+        iov[1].iov_base = buf;
+        iov[1].iov_len = len;
+        if(write_all(sc->fd, iov, 2) != 0)
+            break;
+    }
+
+    free(buf);
+    close(sc->fd);
+    return(NULL);
+}
+
+static int read_all(int fd, void *buf, size_t len)
+{
+    ssize_t ret;
+
+    while(len > 0)
+    {
+        ret = read(fd, buf, len);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret <= 0)
+            return(-1);
+        buf = (char*)buf + ret;
+        len -= ret;
+    }
+    return(0);
+}
+
+static int write_all(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t ret;
+
+    while(iovcnt > 0)
+    {
+        ret = writev(fd, iov, iovcnt);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret < 0)
+            return(-1);
+        while(iovcnt > 0 && (size_t)ret >= iov->iov_len)
+        {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0)
+        {
+            iov->iov_base = (char*)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+    return(0);
+}
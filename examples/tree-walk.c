@@ -0,0 +1,56 @@
+#define  _GNU_SOURCE
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "abt-io-config.h"
+#include <abt.h>
+#include <abt-io.h>
+
+/* Lists (walk) or deletes (remove) a directory tree with
+ * abt_io_tree_walk() or abt_io_tree_remove().  A walk prints one path per
+ * entry, in no particular order.  Exits non-zero with the error on
+ * failure.
+ */
+
+static int print_entries(void *arg, const struct abt_io_tree_entry *entries,
+    int count)
+{
+    int i;
+
+    for(i = 0; i < count; i++)
+        printf("%s\n", entries[i].path);
+    return(0);
+}
+
+int main(int argc, char **argv)
+{
+    abt_io_instance_id aid;
+    int threads;
+    int ret;
+
+    if(argc != 4 || sscanf(argv[2], "%d", &threads) != 1 || threads < 1 ||
+        (strcmp(argv[1], "walk") != 0 && strcmp(argv[1], "remove") != 0))
+    {
+        fprintf(stderr, "Usage: tree-walk <walk|remove> <backing_threads> <dir>\n");
+        return(-1);
+    }
+
+    ABT_init(argc, argv);
+    aid = abt_io_init(threads);
+    assert(aid != NULL);
+
+    if(strcmp(argv[1], "walk") == 0)
+        ret = abt_io_tree_walk(aid, argv[3], 0, 0, print_entries, NULL);
+    else
+        ret = abt_io_tree_remove(aid, argv[3], 0);
+    if(ret < 0)
+        fprintf(stderr, "tree-walk: %s %s: %s\n", argv[1], argv[3], strerror(-ret));
+
+    abt_io_finalize(aid);
+    ABT_finalize();
+    return(ret == 0 ? 0 : 1);
+}
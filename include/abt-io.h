@@ -13,7 +13,10 @@ extern "C" {
 
 #include <abt.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <sys/uio.h>
 
 struct abt_io_instance;
 typedef struct abt_io_instance* abt_io_instance_id;
@@ -42,10 +45,123 @@ abt_io_instance_id abt_io_init(int backing_thread_count);
  */
 abt_io_instance_id abt_io_init_pool(ABT_pool progress_pool);
 
+/* routing flags for operations when backing pools are split by NUMA node */
+#define ABT_IO_NUMA_ROUTE_BUFFER 0x1 /* node holding the caller's buffer */
+#define ABT_IO_NUMA_ROUTE_FD     0x2 /* node attached to the fd's device */
+
+/* ring selection for operations submitted in ring mode */
+#define ABT_IO_RING_SELECT_FD          0 /* hash of the fd, round-robin without one */
+#define ABT_IO_RING_SELECT_ROUND_ROBIN 1
+
+/* how backing xstreams idle */
+#define ABT_IO_IDLE_DEFAULT 0 /* abt-snoozer if available, else power */
+#define ABT_IO_IDLE_LATENCY 1 /* spin for a long budget before sleeping */
+#define ABT_IO_IDLE_POWER   2 /* sleep after a short spin */
+
+/* how issuers pick among per-xstream pools */
+#define ABT_IO_POOL_SHARED       0 /* one pool shared by all backing xstreams */
+#define ABT_IO_POOL_LEAST_LOADED 1 /* shorter of two sampled pools */
+#define ABT_IO_POOL_LOCAL        2 /* pool paired with the caller's xstream */
+
+/**
+ * Options for abt_io_init_ext().  Initialize with abt_io_init_opts_default()
+ * before setting individual fields.
+ */
+struct abt_io_init_opts
+{
+    /* number of backing xstreams, 0 to use the caller's pool */
+    int backing_thread_count;
+    /* if num_cpus > 0, backing xstream i is bound to cpus[i % num_cpus] */
+    const int *cpus;
+    int num_cpus;
+    /* if >= 0, backing xstreams are confined to the CPUs of this node */
+    int numa_node;
+    /* if set, create one pool per NUMA node, each with its own backing
+     * xstreams confined to that node; the thread count is rounded up to a
+     * multiple of the number of nodes */
+    int numa_pools;
+    /* ABT_IO_NUMA_ROUTE_* flags used with numa_pools; operations that
+     * cannot be routed go to the caller's node */
+    int numa_route;
+    /* elastic mode, enabled by a non-zero elastic_max: the instance keeps
+     * between elastic_min (at least 1) and elastic_max backing xstreams in
+     * place of backing_thread_count.  An xstream is added when more than
+     * elastic_grow_depth operations are queued, or when the queue has not
+     * drained for elastic_grow_wait_us, and one is retired after
+     * elastic_idle_ms without work.  Not compatible with numa_pools. */
+    int elastic_min;
+    int elastic_max;
+    int elastic_grow_depth;
+    int elastic_grow_wait_us;
+    int elastic_idle_ms;
+    /* if set, abt_io_pread() and abt_io_pwrite() (and their _nb forms)
+     * first try the I/O inline on the caller's xstream with RWF_NOWAIT and
+     * only offload what could not be completed without blocking.  O_DIRECT
+     * fds are always offloaded, and so are reads or writes on an fd once
+     * its file system has rejected RWF_NOWAIT for that direction.  What is
+     * learned about an fd is kept until abt_io_close() (or its _nb or
+     * chain forms), so fds used with this instance must be closed through
+     * abt-io; after a plain close() a reused fd number could have
+     * RWF_NOWAIT applied to O_DIRECT I/O. */
+    int inline_nowait;
+    /* ring mode: each backing xstream drains its own lock-free ring of
+     * ring_size (a power of two) entries instead of taking tasks from a
+     * shared pool.  ring_select is an ABT_IO_RING_SELECT_* value; with fd
+     * hashing, operations on one fd stay on one xstream unless its ring
+     * overflows or they are stolen.  If ring_steal is set, idle xstreams
+     * take work from other rings.  Not compatible with numa_pools or
+     * elastic mode. */
+    int submit_rings;
+    int ring_size;
+    int ring_select;
+    int ring_steal;
+    /* an ABT_IO_POOL_* value other than ABT_IO_POOL_SHARED gives each
+     * backing xstream its own pool, with idle xstreams stealing from the
+     * pools of busy ones.  In ring mode it also selects whether ring
+     * overflow goes to a pool per xstream.  Not compatible with numa_pools
+     * or elastic mode. */
+    int pool_dispatch;
+    /* if set, a ULT that blocks on an operation is resumed in the first
+     * main pool of the xstream it issued the operation from, rather than
+     * wherever it was last scheduled.  Its own pool association is put
+     * back afterwards. */
+    int resume_home;
+    /* an ABT_IO_IDLE_* value.  Other than with abt-snoozer, idle backing
+     * xstreams spin for idle_spin_us (0 for the mode's default) and then
+     * sleep until an operation is queued for them. */
+    int idle_mode;
+    int idle_spin_us;
+    /* idle descriptors kept open by abt_io_fd_acquire(), 0 to close each
+     * one at its last release */
+    int fd_cache_limit;
+};
+
+/* default fd_cache_limit, also used by abt_io_init() and abt_io_init_pool() */
+#define ABT_IO_FD_CACHE_LIMIT 1024
+
+/**
+ * Fills in default options: no backing xstreams, no placement,
+ * buffer-then-fd routing, elastic mode and ring mode disabled,
+ * 256-entry rings selected by fd with stealing for ring mode, and an fd
+ * cache of ABT_IO_FD_CACHE_LIMIT descriptors.
+ */
+void abt_io_init_opts_default(struct abt_io_init_opts *opts);
+
+/**
+ * Initializes abt_io library with explicit placement of the backing
+ * xstreams.  cpus, numa_node and numa_pools require a non-zero
+ * backing_thread_count, and numa_pools cannot be combined with the other
+ * two.  Pinning relies on Argobots affinity support.
+ * @param [in] opts options, or NULL for defaults
+ * @returns abt_io instance id on success, NULL upon error
+ */
+abt_io_instance_id abt_io_init_ext(const struct abt_io_init_opts *opts);
+
 /**
  * Shuts down abt_io library and its underlying resources. Waits for underlying
- * operations to complete in the case abt_io_init was called, otherwise returns
- * immediately.
+ * operations to complete in the case abt_io_init was called.  Otherwise it
+ * only waits for the tasks abt-io queued on its own (temp file refills,
+ * preallocation, tree walk tasks), so the pool must still be serviced.
  * @param [in] aid abt-io instance
  */
 void abt_io_finalize(abt_io_instance_id aid);
@@ -125,6 +241,55 @@ abt_io_op_t* abt_io_mkostemp_nb(
         int flags,
         int *ret);
 
+/**
+ * Keeps count temporary files created ahead of demand, refilled by
+ * background operations on the backing xstreams, so that the matching
+ * calls return without touching the directory.  path is either a
+ * mkostemp() template ending in XXXXXX, served to abt_io_mkostemp() calls
+ * with the same template and flags, or, if flags include O_TMPFILE, a
+ * directory, served to abt_io_tmpfile() calls with the same directory and
+ * flags.  Calls that find the pool empty create their file as usual.
+ * @param [in] aid abt-io instance
+ * @param [in] path template or directory
+ * @param [in] flags flags for mkostemp(), or for open() with O_TMPFILE
+ * @param [in] count files to keep ready
+ * @returns 0 on success, -EEXIST if path already has a pool, -errno on error
+ */
+int abt_io_tmp_pool_enable(abt_io_instance_id aid, const char *path,
+        int flags, int count);
+
+/**
+ * Removes the pool for path and deletes the files it still holds.
+ * @returns 0 on success, -ENOENT if path has no pool
+ */
+int abt_io_tmp_pool_disable(abt_io_instance_id aid, const char *path);
+
+/**
+ * Opens an unnamed temporary file in dir with open(O_TMPFILE), mode 0600.
+ * The file disappears when closed unless it is given a name with
+ * abt_io_tmpfile_publish().
+ * @param [in] flags open() flags, including O_RDWR or O_WRONLY
+ * @returns fd on success, -ENOSYS without O_TMPFILE support, -errno on
+ *          error
+ */
+int abt_io_tmpfile(abt_io_instance_id aid, const char *dir, int flags);
+
+/**
+ * Links a file from abt_io_tmpfile() into the file system at pathname,
+ * which must be on the same file system and must not exist.
+ * @returns 0 on success, -errno on error
+ */
+int abt_io_tmpfile_publish(abt_io_instance_id aid, int fd, const char *pathname);
+
+/**
+ * non-blocking version of abt_io_tmpfile_publish()
+ */
+abt_io_op_t* abt_io_tmpfile_publish_nb(
+        abt_io_instance_id aid,
+        int fd,
+        const char *pathname,
+        int *ret);
+
 /**
  * wrapper for unlink()
  */
@@ -148,6 +313,411 @@ int abt_io_close(abt_io_instance_id aid, int fd);
  */
 abt_io_op_t* abt_io_close_nb(abt_io_instance_id aid, int fd, int *ret);
 
+/**
+ * wrapper for fallocate()
+ */
+int abt_io_fallocate(
+        abt_io_instance_id aid,
+        int fd,
+        int mode,
+        off_t offset,
+        off_t len);
+
+/**
+ * non-blocking wrapper for fallocate()
+ */
+abt_io_op_t* abt_io_fallocate_nb(
+        abt_io_instance_id aid,
+        int fd,
+        int mode,
+        off_t offset,
+        off_t len,
+        int *ret);
+
+/**
+ * wrapper for ftruncate()
+ */
+int abt_io_ftruncate(abt_io_instance_id aid, int fd, off_t length);
+
+/**
+ * non-blocking wrapper for ftruncate()
+ */
+abt_io_op_t* abt_io_ftruncate_nb(
+        abt_io_instance_id aid,
+        int fd,
+        off_t length,
+        int *ret);
+
+/**
+ * wrapper for openat()
+ */
+int abt_io_openat(
+        abt_io_instance_id aid,
+        int dirfd,
+        const char *pathname,
+        int flags,
+        mode_t mode);
+
+/**
+ * non-blocking wrapper for openat()
+ */
+abt_io_op_t* abt_io_openat_nb(
+        abt_io_instance_id aid,
+        int dirfd,
+        const char *pathname,
+        int flags,
+        mode_t mode,
+        int *ret);
+
+/**
+ * wrapper for mkdirat()
+ */
+int abt_io_mkdirat(
+        abt_io_instance_id aid,
+        int dirfd,
+        const char *pathname,
+        mode_t mode);
+
+/**
+ * non-blocking wrapper for mkdirat()
+ */
+abt_io_op_t* abt_io_mkdirat_nb(
+        abt_io_instance_id aid,
+        int dirfd,
+        const char *pathname,
+        mode_t mode,
+        int *ret);
+
+/**
+ * wrapper for renameat2(); falls back to renameat() when the system has
+ * no renameat2, in which case non-zero flags fail with -ENOSYS
+ */
+int abt_io_renameat2(
+        abt_io_instance_id aid,
+        int olddirfd,
+        const char *oldpath,
+        int newdirfd,
+        const char *newpath,
+        unsigned int flags);
+
+/**
+ * non-blocking wrapper for renameat2()
+ */
+abt_io_op_t* abt_io_renameat2_nb(
+        abt_io_instance_id aid,
+        int olddirfd,
+        const char *oldpath,
+        int newdirfd,
+        const char *newpath,
+        unsigned int flags,
+        int *ret);
+
+/**
+ * wrapper for fstat()
+ */
+int abt_io_fstat(abt_io_instance_id aid, int fd, struct stat *statbuf);
+
+/**
+ * non-blocking wrapper for fstat()
+ */
+abt_io_op_t* abt_io_fstat_nb(
+        abt_io_instance_id aid,
+        int fd,
+        struct stat *statbuf,
+        int *ret);
+
+struct statx;
+
+/**
+ * wrapper for statx(); returns -ENOSYS if the system has no statx
+ */
+int abt_io_statx(
+        abt_io_instance_id aid,
+        int dirfd,
+        const char *pathname,
+        int flags,
+        unsigned int mask,
+        struct statx *statxbuf);
+
+/**
+ * non-blocking wrapper for statx()
+ */
+abt_io_op_t* abt_io_statx_nb(
+        abt_io_instance_id aid,
+        int dirfd,
+        const char *pathname,
+        int flags,
+        unsigned int mask,
+        struct statx *statxbuf,
+        int *ret);
+
+/**
+ * wrapper for fsync().  fd may be a directory opened with O_RDONLY (e.g.
+ * with O_DIRECTORY), which makes entries created, renamed or removed in it
+ * durable.
+ */
+int abt_io_fsync(abt_io_instance_id aid, int fd);
+
+/**
+ * non-blocking wrapper for fsync()
+ */
+abt_io_op_t* abt_io_fsync_nb(abt_io_instance_id aid, int fd, int *ret);
+
+/* layout of the records returned by abt_io_getdents() (linux_dirent64) */
+struct abt_io_dirent
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/**
+ * Reads a batch of entries from the open directory fd with getdents64().
+ * buf is filled with struct abt_io_dirent records, each d_reclen bytes
+ * long.  Call again until it returns 0 to read the whole directory.
+ * @returns bytes placed in buf, 0 at the end of the directory, -errno on
+ *          error
+ */
+ssize_t abt_io_getdents(
+        abt_io_instance_id aid,
+        int fd,
+        void *buf,
+        size_t count);
+
+/**
+ * non-blocking version of abt_io_getdents()
+ */
+abt_io_op_t* abt_io_getdents_nb(
+        abt_io_instance_id aid,
+        int fd,
+        void *buf,
+        size_t count,
+        ssize_t *ret);
+
+/**
+ * Returns a descriptor for pathname opened with flags, shared with other
+ * callers that acquire the same path with the same flags.  The descriptor
+ * is reference counted and must be given back with abt_io_fd_release(),
+ * not closed.  Released descriptors stay open for reuse, and the least
+ * recently used are closed once more than fd_cache_limit are idle;
+ * descriptors in use are never closed.  Since the descriptor is shared its
+ * file offset is too, so use positional I/O on it.
+ * @param [in] aid abt-io instance
+ * @param [in] pathname file to open
+ * @param [in] flags open() flags; O_CREAT, O_EXCL, O_TRUNC and O_TMPFILE
+ *             are not allowed
+ * @returns descriptor on success, -errno on error
+ */
+int abt_io_fd_acquire(abt_io_instance_id aid, const char *pathname, int flags);
+
+/**
+ * Drops a reference taken by abt_io_fd_acquire().
+ * @returns 0 on success, -EBADF if fd was not acquired
+ */
+int abt_io_fd_release(abt_io_instance_id aid, int fd);
+
+/**
+ * Drops pathname from the fd cache, e.g. after it has been renamed or
+ * unlinked, so that the next abt_io_fd_acquire() opens it again.
+ * Descriptors still in use are closed at their last release.
+ * @returns number of cached descriptors dropped
+ */
+int abt_io_fd_invalidate(abt_io_instance_id aid, const char *pathname);
+
+/* flags for abt_io_tree_walk() */
+#define ABT_IO_TREE_STAT 0x1 /* fill in st for every entry */
+
+struct abt_io_tree_entry
+{
+    const char *path;       /* root path, '/', path below the root */
+    unsigned char type;     /* DT_* */
+    struct stat st;         /* lstat() of the entry with ABT_IO_TREE_STAT */
+};
+
+/**
+ * Receives a batch of entries from abt_io_tree_walk().  The entries are only
+ * valid during the call.  A non-zero return value stops the walk.
+ */
+typedef int (*abt_io_tree_cb)(void *arg,
+        const struct abt_io_tree_entry *entries, int count);
+
+/**
+ * Walks the directory tree below path.  Directories are listed with
+ * getdents64 by up to max_parallel tasks on the backing xstreams at a time,
+ * and the entries found are delivered to cb in batches, in no particular
+ * order, from the calling ULT.  Listing pauses while cb is several batches
+ * behind.  Symbolic links are not followed, and a
+ * root that is one is refused with -ELOOP.
+ * @param [in] aid abt-io instance
+ * @param [in] path root directory
+ * @param [in] flags ABT_IO_TREE_* flags
+ * @param [in] max_parallel directories listed at a time, 0 for half the
+ *             backing xstreams (for an elastic instance, of those running
+ *             at the start of the walk; 8 with abt_io_init_pool())
+ * @param [in] cb callback for each batch of entries
+ * @param [in] arg argument to cb
+ * @returns 0 on success, cb's non-zero return value, or the -errno of the
+ *          first failure, which stops the walk
+ */
+int abt_io_tree_walk(
+        abt_io_instance_id aid,
+        const char *path,
+        int flags,
+        int max_parallel,
+        abt_io_tree_cb cb,
+        void *arg);
+
+/**
+ * Removes path and everything below it, like rm -rf.  Directories are
+ * listed and their files unlinked by up to max_parallel tasks at a time;
+ * each directory is removed once its subdirectories are gone.  Symbolic
+ * links in the tree are unlinked, never followed; a root that is one is
+ * refused with -ELOOP.
+ * @returns 0 on success, or the -errno of the first failure, which stops
+ *          the removal
+ */
+int abt_io_tree_remove(
+        abt_io_instance_id aid,
+        const char *path,
+        int max_parallel);
+
+/**
+ * Enables background preallocation for a file descriptor.  Whenever an
+ * abt_io_pwrite() on fd comes within half a chunk of the preallocated
+ * region, the next chunk is fallocate()d (without changing the file size)
+ * by a background operation queued ahead of the write.  Space that is still
+ * unused is released by abt_io_close() or abt_io_prealloc_disable().
+ * @param [in] aid abt-io instance
+ * @param [in] fd open file descriptor
+ * @param [in] chunk_size preallocation granularity in bytes
+ * @returns 0 on success, -EEXIST if fd already has a policy, -errno on error
+ */
+int abt_io_prealloc_enable(abt_io_instance_id aid, int fd, size_t chunk_size);
+
+/**
+ * Disables preallocation for fd and releases space preallocated past EOF.
+ * @returns 0 on success, -ENOENT if fd has no policy, -errno on error
+ */
+int abt_io_prealloc_disable(abt_io_instance_id aid, int fd);
+
+struct abt_io_log;
+typedef struct abt_io_log abt_io_log_t;
+
+/**
+ * Creates an append log handle for a file shared by concurrent appenders.
+ * Space is reserved with an atomic fetch-and-add on the log tail rather than
+ * a lock.  If prealloc_size is non-zero then the file is preallocated in
+ * chunks of that size ahead of the tail.  The log does not take ownership of
+ * fd.
+ * @param [in] fd open file descriptor
+ * @param [in] start_offset offset of the first append (usually the file size)
+ * @param [in] prealloc_size preallocation chunk size in bytes, 0 to disable
+ * @returns log handle on success, NULL upon error
+ */
+abt_io_log_t* abt_io_log_create(int fd, off_t start_offset, size_t prealloc_size);
+
+/**
+ * Releases a log handle.  DO NOT call while appends are in flight.
+ */
+void abt_io_log_free(abt_io_log_t* log);
+
+/**
+ * Returns the offset up to which every reserved append has been written
+ * without a gap.  Data below this offset is durable if fd was opened with
+ * O_SYNC or O_DSYNC, otherwise it has reached the page cache.  The first
+ * failed append leaves a gap that the watermark stops at; the log is then
+ * failed and further appends return that append's error.
+ */
+off_t abt_io_log_durable_offset(abt_io_log_t* log);
+
+/**
+ * appends count bytes to the log; the offset that was reserved for the data
+ * is returned in *offset.  Fails without writing once an earlier append has
+ * failed (see abt_io_log_durable_offset()).
+ */
+ssize_t abt_io_append(
+        abt_io_instance_id aid,
+        abt_io_log_t* log,
+        const void *buf,
+        size_t count,
+        off_t *offset);
+
+/**
+ * non-blocking version of abt_io_append(); *offset is valid as soon as the
+ * call returns
+ */
+abt_io_op_t* abt_io_append_nb(
+        abt_io_instance_id aid,
+        abt_io_log_t* log,
+        const void *buf,
+        size_t count,
+        off_t *offset,
+        ssize_t *ret);
+
+struct abt_io_chain;
+typedef struct abt_io_chain abt_io_chain_t;
+
+/* fd argument of a chain step that refers to the fd returned by the most
+ * recent open step before it in the chain */
+#define ABT_IO_CHAIN_FD (-2)
+
+/**
+ * Creates an empty op chain.  A chain is a list of steps that execute back
+ * to back on one backing xstream and complete once, so that e.g. an
+ * open/pread/close sequence costs a single handoff.  If a step fails then
+ * the steps after it are not run and report -ECANCELED; a close of an fd
+ * opened by the chain still runs.  A chain can be executed more than once.
+ * @param [in] aid abt-io instance
+ * @returns chain on success, NULL upon error
+ */
+abt_io_chain_t* abt_io_chain_create(abt_io_instance_id aid);
+
+/**
+ * Releases a chain.  DO NOT call while it is executing.
+ */
+void abt_io_chain_free(abt_io_chain_t* chain);
+
+/**
+ * Appends an open step; *ret receives the fd or -errno when the chain runs.
+ * pathname must remain valid until the chain completes.
+ * @returns 0 on success, -errno on error
+ */
+int abt_io_chain_open(abt_io_chain_t* chain, const char* pathname, int flags,
+        mode_t mode, int *ret);
+
+/**
+ * Appends a pread step on fd, or on the fd of the preceding open step if fd
+ * is ABT_IO_CHAIN_FD; *ret receives the byte count or -errno.
+ * @returns 0 on success, -EINVAL for ABT_IO_CHAIN_FD without an open step,
+ *          -errno on error
+ */
+int abt_io_chain_pread(abt_io_chain_t* chain, int fd, void *buf, size_t count,
+        off_t offset, ssize_t *ret);
+
+/**
+ * Appends a pwrite step; see abt_io_chain_pread()
+ */
+int abt_io_chain_pwrite(abt_io_chain_t* chain, int fd, const void *buf,
+        size_t count, off_t offset, ssize_t *ret);
+
+/**
+ * Appends a close step; see abt_io_chain_pread()
+ */
+int abt_io_chain_close(abt_io_chain_t* chain, int fd, int *ret);
+
+/**
+ * Runs the chain and waits for it.  Short reads and writes are not errors.
+ * @returns 0 if every step succeeded, else the -errno of the first failure
+ */
+int abt_io_chain_execute(abt_io_chain_t* chain);
+
+/**
+ * non-blocking version of abt_io_chain_execute(); *ret receives its result
+ */
+abt_io_op_t* abt_io_chain_execute_nb(abt_io_chain_t* chain, int *ret);
+
 /**
  * wait on an abt-io operation
  * return: 0 if success, non-zero on failure
@@ -162,6 +732,179 @@ void abt_io_op_free(abt_io_op_t* op);
 
 // =e
 
+/**
+ * Starts the socket reactor: a listener on a dedicated xstream that waits
+ * for readiness on registered sockets.  Calling it again returns the
+ * existing reactor.
+ * @param [in] events maximum events handled per epoll_wait(), 0 for default
+ * @returns the reactor's epoll fd on success, -errno on error
+ */
+int abt_io_socket_initialize(int events);
+
+/**
+ * Stops the socket reactor.  Sockets must be deregistered first; callers
+ * still blocked on one are woken with -ESHUTDOWN before it returns.
+ */
+void abt_io_socket_finalize(void);
+
+/* socket connection handle; a stale handle never refers to a reused fd */
+typedef uint64_t abt_io_conn_t;
+#define ABT_IO_CONN_NULL ((abt_io_conn_t)0)
+
+/* readiness interest for abt_io_sock_register() and abt_io_sock_modify() */
+#define ABT_IO_SOCK_READ  0x1
+#define ABT_IO_SOCK_WRITE 0x2
+
+/**
+ * Registers a socket with the reactor and switches it to non-blocking
+ * mode.  The reactor never closes the fd.
+ * @param [in] fd socket
+ * @param [in] events ABT_IO_SOCK_* interest
+ * @returns connection handle on success, ABT_IO_CONN_NULL upon error
+ */
+abt_io_conn_t abt_io_sock_register(int fd, int events);
+
+/**
+ * Changes the readiness interest of a connection.  Write interest stays on
+ * once the fd has had queued output, since the reactor flushes it on
+ * EPOLLOUT.
+ * @returns 0 on success, -errno on error
+ */
+int abt_io_sock_modify(abt_io_conn_t conn, int events);
+
+/**
+ * Removes a connection from the reactor, after which its handle is stale.
+ * ULTs blocked on the connection return -EBADF.  The fd stays open.
+ * @returns 0 on success, -errno on error
+ */
+int abt_io_sock_deregister(abt_io_conn_t conn);
+
+/**
+ * Reads from a connection, suspending the calling ULT until data, EOF or
+ * an error arrives.  Only one ULT may wait to read on a connection at a
+ * time; others get -EBUSY.
+ * @returns bytes read, 0 at EOF, or -errno (including pending socket
+ * errors)
+ */
+ssize_t abt_io_sock_read(abt_io_conn_t conn, void *buf, size_t count);
+
+/**
+ * Writes count bytes to a connection, suspending the calling ULT while the
+ * send buffer is full.
+ * @returns count, the bytes written before an error, or -errno
+ */
+ssize_t abt_io_sock_write(abt_io_conn_t conn, const void *buf, size_t count);
+
+/**
+ * Returns at least len bytes of received data from the connection's
+ * receive buffer without consuming them, suspending the calling ULT until
+ * enough has arrived.  The buffer is filled with large reads, so small
+ * peeks at a pipelined stream rarely cost a syscall.  The pointer stays
+ * valid until the next peek, consume or read on the connection.
+ * abt_io_sock_read() returns buffered data before reading the socket.
+ * @param [in] len bytes wanted, 0 for whatever is available
+ * @param [out] data start of the buffered data
+ * @returns bytes buffered (fewer than len only at EOF), or -errno
+ */
+ssize_t abt_io_sock_peek(abt_io_conn_t conn, size_t len, const void **data);
+
+/**
+ * Discards len bytes from the front of the receive buffer.
+ * @returns 0 on success, -errno on error
+ */
+int abt_io_sock_consume(abt_io_conn_t conn, size_t len);
+
+/* flag for abt_io_sock_send(): more data follows, hold off flushing */
+#define ABT_IO_SEND_MORE 0x1
+
+/**
+ * Queues count bytes on the connection's output queue.  Data queued by
+ * concurrent senders is flushed together in one gathered write whenever
+ * the socket is writable; with ABT_IO_SEND_MORE it is only flushed by a
+ * later send without the flag or by abt_io_sock_flush().  The calling ULT
+ * is suspended while the queue holds more than the high-water mark.  Do
+ * not mix with abt_io_sock_write() on the same connection.
+ * @returns count on success, or -errno (send errors are sticky)
+ */
+ssize_t abt_io_sock_send(abt_io_conn_t conn, const void *buf, size_t count,
+        int flags);
+
+/**
+ * Like abt_io_sock_send(), but gathers count bytes from an iovec; the
+ * pieces are queued together and never interleave with other senders.
+ * @returns total bytes on success, or -errno
+ */
+ssize_t abt_io_sock_sendv(abt_io_conn_t conn, const struct iovec *iov,
+        int iovcnt, int flags);
+
+/**
+ * Flushes the output queue, suspending the calling ULT until it is empty.
+ * @returns 0 on success, -errno on error
+ */
+int abt_io_sock_flush(abt_io_conn_t conn);
+
+/**
+ * Sets the number of queued bytes above which abt_io_sock_send() waits
+ * (default 256 KiB).
+ * @returns 0 on success, -errno on error
+ */
+int abt_io_sock_set_high_water(abt_io_conn_t conn, size_t bytes);
+
+/**
+ * Configures busy polling in the socket reactor.  For poll_us microseconds
+ * after each event the listener polls epoll without sleeping, trading a
+ * core for lower wakeup latency; 0 always blocks.  If sock_busy_poll_us is
+ * non-zero, sockets registered afterwards get SO_BUSY_POLL with that value
+ * (raising it past net.core.busy_read requires CAP_NET_ADMIN).
+ * @returns 0 on success, -errno on error
+ */
+int abt_io_socket_busy_poll(int poll_us, int sock_busy_poll_us);
+
+/**
+ * Enables or disables home affinity for the socket reactor: a ULT waiting
+ * on a connection is resumed in the main pool of the xstream that last did
+ * I/O on it rather than wherever it happens to be scheduled.
+ * @returns 0 on success, -errno on error
+ */
+int abt_io_socket_home_affinity(int enable);
+
+/* Framed messages: a 4-byte length in network byte order followed by the
+ * payload.  Received payloads land in pooled buffers owned by the caller
+ * until abt_io_msg_release(). */
+#define ABT_IO_MSG_MAX (64 * 1024 * 1024)
+
+/**
+ * Receives one frame, suspending the calling ULT until all of it has
+ * arrived.  The payload is read into a pooled buffer that is handed to the
+ * caller as is.  Only one ULT may receive on a connection at a time.
+ * @param [out] msg payload, or NULL if the peer closed between frames
+ * @returns payload length, 0 at a clean EOF (or for an empty frame), or
+ * -errno (-EMSGSIZE past ABT_IO_MSG_MAX, -EPROTO for a truncated frame)
+ */
+ssize_t abt_io_msg_recv(abt_io_conn_t conn, void **msg);
+
+/**
+ * Sends one frame, gathering the header and payload into a single write
+ * through the connection's output queue (see abt_io_sock_send()).
+ * @returns len on success, or -errno
+ */
+ssize_t abt_io_msg_send(abt_io_conn_t conn, const void *msg, size_t len,
+        int flags);
+
+/**
+ * Returns a pooled buffer of at least len bytes, e.g. to build a payload.
+ * @returns buffer, or NULL on error
+ */
+void* abt_io_msg_alloc(size_t len);
+
+/**
+ * Returns a buffer from abt_io_msg_recv() or abt_io_msg_alloc() to the
+ * pool.
+ */
+void abt_io_msg_release(void *msg);
+
+/* older interface; ta->epfd must be the fd returned by
+ * abt_io_socket_initialize() */
 typedef struct io_instance
 {
     int epfd;
@@ -176,8 +919,6 @@ struct thread_args
     ABT_cond cond;
 };
 
-int abt_io_socket_initialize(int events);
-
 io_instance_t* abt_io_register_thread(struct thread_args* ta);
 
 ssize_t abt_io_epoll_read(io_instance_t* instance, int fd, const void *buf, size_t count);
@@ -12,223 +12,5045 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <time.h>
+#include <sched.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
+#include <arpa/inet.h>
 #include <fcntl.h>
+#include <dirent.h>
 
+#include "abt-io-config.h"
 #include <abt.h>
+#ifdef HAVE_ABT_SNOOZER
 #include <abt-snoozer.h>
+#endif
 // =e
 #include <sys/epoll.h>
 
 #include "abt-io.h"
 
+/* Preallocation state for a file written at a moving frontier.  Everything
+ * below end has been fallocate()d without changing the file size.
+ */
+struct abt_io_prealloc
+{
+    int fd;
+    size_t chunk;   /* reset to 0 if fallocate turns out to be unsupported */
+    off_t end;
+    int busy;
+    int enabled;    /* per-fd policies stay in their table once created */
+};
+
+/* get_mempolicy() flags, from numaif.h */
+#define ABT_IO_MPOL_F_NODE (1<<0)
+#define ABT_IO_MPOL_F_ADDR (1<<1)
+
+/* the domain of each fd's device is cached in lazily allocated chunks of a
+ * table indexed by fd; higher fds are routed by the caller's CPU */
+#define ABT_IO_NUMA_FD_CHUNK  1024
+#define ABT_IO_NUMA_FD_CHUNKS 1024
+#define ABT_IO_NUMA_FD_UNKNOWN 0    /* otherwise domain + 1, or: */
+#define ABT_IO_NUMA_FD_NONE    (-1) /* no domain for the device */
+#define ABT_IO_NUMA_FD_PENDING (-2) /* lookup queued */
+
+#define ABT_IO_NUMA_DEV_BUCKETS 256
+
+/* whether inline RWF_NOWAIT I/O is worth trying on an fd is cached the
+ * same way; higher fds always try it */
+#define ABT_IO_NOWAIT_FD_CHUNK  1024
+#define ABT_IO_NOWAIT_FD_CHUNKS 1024
+#define ABT_IO_NOWAIT_FD_UNKNOWN  0
+#define ABT_IO_NOWAIT_FD_TRY      1   /* flags checked, not O_DIRECT */
+#define ABT_IO_NOWAIT_FD_SKIP     2   /* O_DIRECT */
+#define ABT_IO_NOWAIT_FD_NO_READ  4   /* preadv2 rejected the flag */
+#define ABT_IO_NOWAIT_FD_NO_WRITE 8   /* pwritev2 rejected the flag */
+
+/* per-fd preallocation policies live in a table of the same shape, so that
+ * writes find theirs without a lock */
+#define ABT_IO_PREALLOC_FD_CHUNK  1024
+#define ABT_IO_PREALLOC_FD_CHUNKS 1024
+
+struct abt_io_numa_dev
+{
+    struct abt_io_numa_dev *next;
+    dev_t dev;
+    int domain;
+};
+
+/* NUMA topology, indexed by domain (the position of a node in the list of
+ * online nodes) rather than by OS node number
+ */
+struct abt_io_numa
+{
+    int num_domains;
+    int **domain_cpus;
+    int *domain_ncpus;
+    int *node_domain;   /* OS node number -> domain */
+    int max_node;
+    int *cpu_domain;    /* CPU number -> domain */
+    int num_cpus;
+    int *fd_domain[ABT_IO_NUMA_FD_CHUNKS];
+    ABT_mutex dev_mutex;    /* protects devs */
+    struct abt_io_numa_dev *devs[ABT_IO_NUMA_DEV_BUCKETS];
+};
+
+#define ABT_IO_WORKER_FREE      0
+#define ABT_IO_WORKER_RUNNING   1
+#define ABT_IO_WORKER_RETIRING  2
+
+/* units run between checks for scheduler events, and the longest an idle
+ * worker sleeps before rechecking them */
+#define ABT_IO_SCHED_EVENT_FREQ 64
+#define ABT_IO_SCHED_SLEEP_NS   100000000L
+
+/* default spin budgets of the idle modes */
+#define ABT_IO_IDLE_LATENCY_SPIN_US 1000
+#define ABT_IO_IDLE_POWER_SPIN_US   20
+
+struct abt_io_instance;
+
+#define ABT_IO_CACHELINE 64
+
+/* Bounded lock-free submission ring (Vyukov's MPMC array queue).  Any
+ * number of issuers push; the owning worker and, with stealing enabled,
+ * idle workers pop.  Each cell's sequence number tells whether it is free
+ * for the producer at position pos (seq == pos) or holds the entry for
+ * the consumer at pos (seq == pos + 1).
+ */
+struct abt_io_ring_cell
+{
+    size_t seq;
+    void (*fn)(void*);
+    void *arg;
+};
+
+struct abt_io_ring
+{
+    struct abt_io_ring_cell *cells;
+    size_t mask;
+    char pad0[ABT_IO_CACHELINE];
+    size_t head;    /* next position to push */
+    char pad1[ABT_IO_CACHELINE];
+    size_t tail;    /* next position to pop */
+    char pad2[ABT_IO_CACHELINE];
+};
+
+/* a backing xstream run by the abt-io scheduler */
+struct abt_io_worker
+{
+    struct abt_io_instance *aid;
+    ABT_xstream xstream;
+    int index;
+    int state;
+    struct abt_io_ring *ring;   /* ring mode only */
+    ABT_pool pool;              /* own pool, or the shared one */
+    int domain;                 /* NUMA domain with per-domain pools */
+    int sleeping;               /* blocked on wake_seq */
+    int wake_seq;               /* futex word */
+};
+
+struct abt_io_elastic
+{
+    int min;
+    int max;
+    size_t grow_depth;
+    uint64_t grow_wait_ns;
+    uint64_t idle_ns;
+    int active;
+    int grow_request;       /* posted by submitters, served by a worker */
+    int growing;
+    int stopping;
+    uint64_t last_empty;    /* last time a worker found the pool empty */
+    struct abt_io_worker *workers;
+};
+
+static inline void spin_lock(int *lock)
+{
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED));
+}
+
+static inline void spin_unlock(int *lock)
+{
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+/* Eventuals that callers block on, kept for reuse by their owner (an
+ * instance, or the socket reactor) so that a wait does not create one.
+ */
+#define ABT_IO_WAITER_CACHE_MAX 256
+
+struct abt_io_waiter
+{
+    ABT_eventual ev;
+    struct abt_io_waiter *next;
+};
+
+struct abt_io_waiters
+{
+    int lock;
+    int count;
+    struct abt_io_waiter *free;
+};
+
+static struct abt_io_waiter* waiter_get(struct abt_io_waiters *cache)
+{
+    struct abt_io_waiter *w;
+
+    spin_lock(&cache->lock);
+    w = cache->free;
+    if (w != NULL) {
+        cache->free = w->next;
+        cache->count--;
+    }
+    spin_unlock(&cache->lock);
+    if (w != NULL) return w;
+
+    w = malloc(sizeof(*w));
+    if (w == NULL) return NULL;
+    if (ABT_eventual_create(0, &w->ev) != ABT_SUCCESS) {
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+static void waiter_put(struct abt_io_waiters *cache, struct abt_io_waiter *w)
+{
+    ABT_eventual_reset(w->ev);
+    spin_lock(&cache->lock);
+    if (cache->count < ABT_IO_WAITER_CACHE_MAX) {
+        w->next = cache->free;
+        cache->free = w;
+        cache->count++;
+        w = NULL;
+    }
+    spin_unlock(&cache->lock);
+    if (w != NULL) {
+        ABT_eventual_free(&w->ev);
+        free(w);
+    }
+}
+
+static void waiters_free(struct abt_io_waiters *cache)
+{
+    struct abt_io_waiter *w;
+
+    while ((w = cache->free) != NULL) {
+        cache->free = w->next;
+        ABT_eventual_free(&w->ev);
+        free(w);
+    }
+    cache->count = 0;
+}
+
 struct abt_io_instance
 {
     ABT_pool progress_pool;
     ABT_xstream *progress_xstreams;
     int num_xstreams;
+    ABT_pool *domain_pools;     /* one per NUMA domain, or just progress_pool */
+    int num_domain_pools;
+    int numa_route;
+    struct abt_io_numa *numa;
+    int *bind_cpus;         /* placement of backing xstreams */
+    int bind_ncpus;
+    int bind_each;          /* bind xstream i to bind_cpus[i] only */
+    struct abt_io_elastic *elastic;
+    ABT_mutex prealloc_mutex;   /* serializes enable and disable */
+    struct abt_io_prealloc *prealloc[ABT_IO_PREALLOC_FD_CHUNKS];
+    int prealloc_count;
+    int inline_nowait;
+    char *nowait_fd[ABT_IO_NOWAIT_FD_CHUNKS];
+    ABT_mutex op_cache_mutex;
+    abt_io_op_t *op_cache;
+    int op_cache_count;
+    struct abt_io_waiters waiters;
+    struct abt_io_worker *workers;  /* ring mode and per-xstream pools */
+    int num_workers;
+    int ring_select;
+    int ring_steal;
+    int pool_dispatch;
+    unsigned int dispatch_next;
+    int resume_home;
+    /* native idle scheduling; idle_workers is NULL for abt-snoozer and
+     * caller-provided pools */
+    struct abt_io_worker *idle_workers;
+    int idle_nworkers;
+    uint64_t idle_spin_ns;
+    int idle_sleepers;
+    int idle_stop;
+    ABT_mutex fd_cache_mutex;
+    struct abt_io_fd_cache *fd_cache;   /* created on first use */
+    int fd_cache_limit;
+    ABT_mutex tmp_pool_mutex;
+    ABT_cond tmp_pool_cond;             /* a refill let go of its pool */
+    struct abt_io_tmp_pool *tmp_pools;  /* prefabricated temp files */
+    int tmp_pool_count;
+    ABT_mutex internal_mutex;
+    ABT_cond internal_cond;
+    int internal;       /* tasks queued on the instance's own behalf */
+};
+
+/* Where an operation is dispatched: a worker's submission ring in ring
+ * mode, with the pool as fallback when the ring is full, or just a pool.
+ */
+struct abt_io_target
+{
+    struct abt_io_instance *aid;
+    ABT_pool pool;
+    struct abt_io_ring *ring;
+    struct abt_io_worker *worker;   /* owner of ring, or of pool if not shared */
+    ABT_pool home;      /* where to resume the issuer, if anywhere special */
+};
+
+static struct abt_io_target select_target(struct abt_io_instance *aid, int fd,
+        const void *buf);
+static int submit(struct abt_io_target t, void (*fn)(void*), void *arg);
+static int submit_internal(struct abt_io_instance *aid, struct abt_io_target t,
+        void (*fn)(void*), void *arg);
+static void internal_done(struct abt_io_instance *aid);
+
+/* Completion word shared by an issuing caller and the task that carries
+ * out its operation.  If the operation is done before the caller waits,
+ * nothing else happens.  Otherwise the caller takes an eventual from the
+ * cache, publishes it and blocks on it, and the task sets it.  If a home
+ * pool is set, the waiter is resumed through that pool rather than the
+ * one it last ran from.
+ */
+#define ABT_IO_COMPLETION_PENDING 0
+#define ABT_IO_COMPLETION_WAITING 1
+#define ABT_IO_COMPLETION_DONE    2
+
+struct abt_io_completion
+{
+    int state;
+    struct abt_io_waiter *waiter;
+    struct abt_io_waiters *cache;
+    ABT_pool home;
 };
 
+/* completed ops kept for reuse per instance */
+#define ABT_IO_OP_CACHE_MAX 1024
+
+/* room for the state of an operation inside its op, so that recycled ops
+ * do not allocate; larger states are allocated separately */
+#define ABT_IO_OP_STATE_SIZE 64
+
 struct abt_io_op
 {
-    ABT_eventual e;
+    struct abt_io_completion c;
     void *state;
     void (*free_fn)(void*);
+    struct abt_io_instance *aid;
+    abt_io_op_t *next;          /* op cache link */
+    union {
+        char bytes[ABT_IO_OP_STATE_SIZE];
+        long double align;
+    } inline_state;
 };
 
-abt_io_instance_id abt_io_init(int backing_thread_count)
+static inline void completion_init(struct abt_io_completion *c,
+        struct abt_io_waiters *cache, ABT_pool home)
 {
-    struct abt_io_instance *aid;
+    c->state = ABT_IO_COMPLETION_PENDING;
+    c->waiter = NULL;
+    c->cache = cache;
+    c->home = home;
+}
+
+/* the first main pool of the caller's xstream */
+static ABT_pool home_pool(void)
+{
+#ifdef HAVE_ABT_SELF_SET_ASSOCIATED_POOL
+    ABT_xstream xstream;
     ABT_pool pool;
-    ABT_xstream self_xstream;
-    ABT_xstream *progress_xstreams = NULL;
-    int ret;
 
-    if (backing_thread_count < 0) return NULL;
+    if (ABT_xstream_self(&xstream) != ABT_SUCCESS ||
+            ABT_xstream_get_main_pools(xstream, 1, &pool) != ABT_SUCCESS)
+        return ABT_POOL_NULL;
+    return pool;
+#else
+    return ABT_POOL_NULL;
+#endif
+}
 
-    aid = malloc(sizeof(*aid));
-    if (aid == NULL) return ABT_IO_INSTANCE_NULL;
+/* Makes the calling ULT resume in pool the next time it blocks.  Returns
+ * the pool it was associated with before, for set_home to restore once it
+ * has been resumed, or ABT_POOL_NULL if nothing changed.
+ */
+static ABT_pool set_home(ABT_pool pool)
+{
+#ifdef HAVE_ABT_SELF_SET_ASSOCIATED_POOL
+    ABT_thread self;
+    ABT_pool prev;
+
+    if (pool == ABT_POOL_NULL || ABT_thread_self(&self) != ABT_SUCCESS ||
+            ABT_thread_get_associated_pool(self, &prev) != ABT_SUCCESS ||
+            prev == pool || ABT_self_set_associated_pool(pool) != ABT_SUCCESS)
+        return ABT_POOL_NULL;
+    return prev;
+#else
+    return ABT_POOL_NULL;
+#endif
+}
 
-    if (backing_thread_count == 0) {
-        aid->num_xstreams = 0;
-        ret = ABT_xstream_self(&self_xstream);
-        if (ret != ABT_SUCCESS) { free(aid); return ABT_IO_INSTANCE_NULL; }
-        ret = ABT_xstream_get_main_pools(self_xstream, 1, &pool);
-        if (ret != ABT_SUCCESS) { free(aid); return ABT_IO_INSTANCE_NULL; }
+static void completion_signal(struct abt_io_completion *c)
+{
+    /* the waiter cannot return, and take the word with it, until the
+     * eventual is set, so reading waiter after the exchange is safe; the
+     * eventual itself outlives the wait in the cache */
+    if (__atomic_exchange_n(&c->state, ABT_IO_COMPLETION_DONE, __ATOMIC_ACQ_REL)
+            != ABT_IO_COMPLETION_WAITING)
+        return;
+    ABT_eventual_set(c->waiter->ev, NULL, 0);
+    return;
+}
+
+static void completion_wait(struct abt_io_completion *c)
+{
+    int expected = ABT_IO_COMPLETION_PENDING;
+    struct abt_io_waiter *w;
+    ABT_pool prev;
+
+    if (__atomic_load_n(&c->state, __ATOMIC_ACQUIRE) == ABT_IO_COMPLETION_DONE)
+        return;
+
+    w = waiter_get(c->cache);
+    if (w == NULL) {
+        /* out of memory: all that is left is to poll, yielding to the
+         * other ULTs of this xstream in case the completer is one of them */
+        while (__atomic_load_n(&c->state, __ATOMIC_ACQUIRE) != ABT_IO_COMPLETION_DONE)
+            if (ABT_thread_yield() != ABT_SUCCESS) sched_yield();
+        return;
     }
-    else {
-        aid->num_xstreams = backing_thread_count;
-        progress_xstreams = malloc(
-                backing_thread_count * sizeof(*progress_xstreams));
-        if (progress_xstreams == NULL) {
-            free(aid);
-            return ABT_IO_INSTANCE_NULL;
-        }
-        ret = ABT_snoozer_xstream_create(backing_thread_count, &pool,
-                progress_xstreams);
-        if (ret != ABT_SUCCESS) {
-            free(aid);
-            free(progress_xstreams);
-            return ABT_IO_INSTANCE_NULL;
+
+    c->waiter = w;
+    prev = set_home(c->home);
+    if (__atomic_compare_exchange_n(&c->state, &expected,
+                ABT_IO_COMPLETION_WAITING, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        ABT_eventual_wait(w->ev, NULL);
+    /* only this wakeup goes home; later ones go back to the caller's pool */
+    set_home(prev);
+    waiter_put(c->cache, w);
+    return;
+}
+
+/* storage for the state of the operation carried by op */
+static void* op_state_alloc(abt_io_op_t *op, size_t size)
+{
+    if (size <= sizeof(op->inline_state)) return &op->inline_state;
+    return malloc(size);
+}
+
+/* releases state from op_state_alloc on a path where no op was issued */
+static void op_state_free(abt_io_op_t *op, void *state)
+{
+    if (state != (void*)&op->inline_state) free(state);
+}
+
+/* parses a sysfs cpu/node list such as "0-3,8-11" */
+static int parse_id_list(const char *path, int **ids, int *count)
+{
+    char buf[4096];
+    char *p, *end;
+    int *list = NULL, *tmp;
+    int n = 0, cap = 0;
+    long lo, hi;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (f == NULL) return -errno;
+    p = fgets(buf, sizeof(buf), f);
+    fclose(f);
+    if (p == NULL) return -EINVAL;
+
+    while (*p != '\0' && *p != '\n') {
+        lo = strtol(p, &end, 10);
+        if (end == p) break;
+        hi = lo;
+        p = end;
+        if (*p == '-') {
+            hi = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (; lo <= hi; lo++) {
+            if (n == cap) {
+                cap = cap ? cap * 2 : 16;
+                tmp = realloc(list, cap * sizeof(*list));
+                if (tmp == NULL) { free(list); return -ENOMEM; }
+                list = tmp;
+            }
+            list[n++] = lo;
         }
+        if (*p == ',') p++;
     }
 
-    aid->progress_pool = pool;
-    aid->progress_xstreams = progress_xstreams;
+    *ids = list;
+    *count = n;
+    return 0;
+}
 
-    return aid;
+static void numa_free(struct abt_io_numa *numa)
+{
+    struct abt_io_numa_dev *dev;
+    int d;
+
+    if (numa == NULL) return;
+    for (d = 0; d < ABT_IO_NUMA_FD_CHUNKS; d++)
+        free(numa->fd_domain[d]);
+    for (d = 0; d < ABT_IO_NUMA_DEV_BUCKETS; d++) {
+        while ((dev = numa->devs[d]) != NULL) {
+            numa->devs[d] = dev->next;
+            free(dev);
+        }
+    }
+    for (d = 0; d < numa->num_domains; d++)
+        free(numa->domain_cpus[d]);
+    free(numa->domain_cpus);
+    free(numa->domain_ncpus);
+    free(numa->node_domain);
+    free(numa->cpu_domain);
+    free(numa);
 }
 
-abt_io_instance_id abt_io_init_pool(ABT_pool progress_pool)
+/* discovers the online NUMA nodes and their CPUs from sysfs */
+static struct abt_io_numa* numa_discover(void)
+{
+    struct abt_io_numa *numa;
+    char path[256];
+    int *nodes = NULL;
+    int num_nodes, d, i, ret;
+
+    numa = calloc(1, sizeof(*numa));
+    if (numa == NULL) return NULL;
+
+    ret = parse_id_list("/sys/devices/system/node/online", &nodes, &num_nodes);
+    if (ret != 0 || num_nodes == 0) {
+        /* no NUMA information: treat the machine as a single node 0 */
+        free(nodes);
+        nodes = malloc(sizeof(*nodes));
+        if (nodes == NULL) goto err;
+        nodes[0] = 0;
+        num_nodes = 1;
+    }
+
+    numa->domain_cpus = calloc(num_nodes, sizeof(*numa->domain_cpus));
+    numa->domain_ncpus = calloc(num_nodes, sizeof(*numa->domain_ncpus));
+    numa->max_node = nodes[num_nodes-1] + 1;
+    numa->node_domain = malloc(numa->max_node * sizeof(*numa->node_domain));
+    if (!numa->domain_cpus || !numa->domain_ncpus || !numa->node_domain)
+        goto err;
+    for (i = 0; i < numa->max_node; i++) numa->node_domain[i] = -1;
+
+    for (d = 0; d < num_nodes; d++) {
+        numa->num_domains++;
+        numa->node_domain[nodes[d]] = d;
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+                nodes[d]);
+        ret = parse_id_list(path, &numa->domain_cpus[d], &numa->domain_ncpus[d]);
+        if (ret != 0 && num_nodes > 1) goto err;
+        for (i = 0; i < numa->domain_ncpus[d]; i++)
+            if (numa->domain_cpus[d][i] >= numa->num_cpus)
+                numa->num_cpus = numa->domain_cpus[d][i] + 1;
+    }
+
+    if (numa->num_cpus > 0) {
+        numa->cpu_domain = malloc(numa->num_cpus * sizeof(*numa->cpu_domain));
+        if (numa->cpu_domain == NULL) goto err;
+        for (i = 0; i < numa->num_cpus; i++) numa->cpu_domain[i] = -1;
+        for (d = 0; d < numa->num_domains; d++)
+            for (i = 0; i < numa->domain_ncpus[d]; i++)
+                numa->cpu_domain[numa->domain_cpus[d][i]] = d;
+    }
+
+    free(nodes);
+    return numa;
+
+err:
+    free(nodes);
+    numa_free(numa);
+    return NULL;
+}
+
+/* domain of the page backing addr, or -1 */
+static int numa_domain_of_addr(struct abt_io_numa *numa, const void *addr)
+{
+    int node = -1;
+
+    if (syscall(SYS_get_mempolicy, &node, NULL, 0, addr,
+                ABT_IO_MPOL_F_NODE | ABT_IO_MPOL_F_ADDR) != 0)
+        return -1;
+    if (node < 0 || node >= numa->max_node) return -1;
+    return numa->node_domain[node];
+}
+
+/* domain of the device that holds fd, or -1.  Devices are cached in a hash
+ * table, so sysfs is only read once per device.  Runs on a backing xstream.
+ */
+static int numa_domain_of_dev(struct abt_io_numa *numa, int fd)
+{
+    static const char *suffixes[] = { "device/numa_node",
+        "device/device/numa_node", "../device/numa_node",
+        "../device/device/numa_node", NULL };
+    struct abt_io_numa_dev *e;
+    char path[256];
+    struct stat st;
+    dev_t dev;
+    unsigned int b;
+    int i, node = -1;
+    FILE *f;
+
+    if (fstat(fd, &st) < 0) return -1;
+    dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+    b = (unsigned int)((major(dev) * 31 + minor(dev)) % ABT_IO_NUMA_DEV_BUCKETS);
+
+    ABT_mutex_spinlock(numa->dev_mutex);
+    for (e = numa->devs[b]; e != NULL && e->dev != dev; e = e->next);
+    if (e != NULL) node = e->domain;
+    ABT_mutex_unlock(numa->dev_mutex);
+    if (e != NULL) return node;
+
+    for (i = 0; suffixes[i] != NULL && node < 0; i++) {
+        snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/%s",
+                major(dev), minor(dev), suffixes[i]);
+        f = fopen(path, "r");
+        if (f == NULL) continue;
+        if (fscanf(f, "%d", &node) != 1) node = -1;
+        fclose(f);
+    }
+    node = (node >= 0 && node < numa->max_node) ? numa->node_domain[node] : -1;
+
+    /* a racing lookup of the same device may insert it twice; harmless */
+    e = malloc(sizeof(*e));
+    if (e != NULL) {
+        e->dev = dev;
+        e->domain = node;
+        ABT_mutex_spinlock(numa->dev_mutex);
+        e->next = numa->devs[b];
+        numa->devs[b] = e;
+        ABT_mutex_unlock(numa->dev_mutex);
+    }
+
+    return node;
+}
+
+/* the cache slot for fd, or NULL if fd is out of range or its chunk could
+ * not be allocated */
+static int* numa_fd_slot(struct abt_io_numa *numa, int fd, int alloc)
+{
+    int **chunk;
+    int *c;
+    int *none = NULL;
+
+    if (fd < 0 || fd >= ABT_IO_NUMA_FD_CHUNK * ABT_IO_NUMA_FD_CHUNKS)
+        return NULL;
+    chunk = &numa->fd_domain[fd / ABT_IO_NUMA_FD_CHUNK];
+    c = __atomic_load_n(chunk, __ATOMIC_ACQUIRE);
+    if (c == NULL && alloc) {
+        c = calloc(ABT_IO_NUMA_FD_CHUNK, sizeof(*c));
+        if (c == NULL) return NULL;
+        if (!__atomic_compare_exchange_n(chunk, &none, c, 0,
+                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            free(c);
+            c = __atomic_load_n(chunk, __ATOMIC_ACQUIRE);
+        }
+    }
+    return c != NULL ? &c[fd % ABT_IO_NUMA_FD_CHUNK] : NULL;
+}
+
+struct abt_io_numa_lookup_state
 {
     struct abt_io_instance *aid;
+    struct abt_io_numa *numa;
+    int fd;
+    int *slot;
+};
 
-    aid = malloc(sizeof(*aid));
-    if(!aid) return(ABT_IO_INSTANCE_NULL);
+static void abt_io_numa_lookup_fn(void *foo)
+{
+    struct abt_io_numa_lookup_state *state = foo;
+    struct abt_io_instance *aid;
+    int pending = ABT_IO_NUMA_FD_PENDING;
+    int d;
+
+    d = numa_domain_of_dev(state->numa, state->fd);
+    /* a close while the lookup was queued resets the slot; leave it */
+    __atomic_compare_exchange_n(state->slot, &pending,
+            d < 0 ? ABT_IO_NUMA_FD_NONE : d + 1, 0,
+            __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    aid = state->aid;
+    free(state);
+    internal_done(aid);
+}
 
-    aid->progress_pool = progress_pool;
-    aid->progress_xstreams = NULL;
-    aid->num_xstreams = 0;
+/* cached domain of the device that holds fd, or -1.  On a miss the lookup
+ * is queued on a backing xstream and this operation is routed without it.
+ */
+static int numa_domain_of_fd(struct abt_io_instance *aid, int fd)
+{
+    struct abt_io_numa_lookup_state *state;
+    int unknown = ABT_IO_NUMA_FD_UNKNOWN;
+    int *slot;
+    int v;
+
+    slot = numa_fd_slot(aid->numa, fd, 1);
+    if (slot == NULL) return -1;
+    v = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (v > 0) return v - 1;
+    if (v != ABT_IO_NUMA_FD_UNKNOWN ||
+            !__atomic_compare_exchange_n(slot, &unknown, ABT_IO_NUMA_FD_PENDING,
+                0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        return -1;
+
+    state = malloc(sizeof(*state));
+    if (state != NULL) {
+        state->aid = aid;
+        state->numa = aid->numa;
+        state->fd = fd;
+        state->slot = slot;
+        /* no fd or buffer, so this does not come back here */
+        if (submit_internal(aid, select_target(aid, -1, NULL),
+                    abt_io_numa_lookup_fn, state) == ABT_SUCCESS)
+            return -1;
+        free(state);
+    }
+    __atomic_store_n(slot, ABT_IO_NUMA_FD_UNKNOWN, __ATOMIC_RELEASE);
+    return -1;
+}
 
-    return aid;
+/* forgets the cached domain of a descriptor that is being closed */
+static void numa_fd_forget(struct abt_io_instance *aid, int fd)
+{
+    int *slot;
+
+    if (aid->numa == NULL) return;
+    slot = numa_fd_slot(aid->numa, fd, 0);
+    if (slot != NULL)
+        __atomic_store_n(slot, ABT_IO_NUMA_FD_UNKNOWN, __ATOMIC_RELEASE);
 }
 
-void abt_io_finalize(abt_io_instance_id aid)
+static uint64_t abt_io_now_ns(void)
 {
-    int i;
+    struct timespec ts;
 
-    if (aid->num_xstreams) {
-        for (i = 0; i < aid->num_xstreams; i++) {
-            ABT_xstream_join(aid->progress_xstreams[i]);
-            ABT_xstream_free(&aid->progress_xstreams[i]);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct abt_io_ring* ring_create(size_t size)
+{
+    struct abt_io_ring *r;
+    size_t i;
+
+    r = calloc(1, sizeof(*r));
+    if (r == NULL) return NULL;
+    r->cells = malloc(size * sizeof(*r->cells));
+    if (r->cells == NULL) { free(r); return NULL; }
+    for (i = 0; i < size; i++) r->cells[i].seq = i;
+    r->mask = size - 1;
+    return r;
+}
+
+static void ring_free(struct abt_io_ring *r)
+{
+    if (r == NULL) return;
+    free(r->cells);
+    free(r);
+}
+
+/* returns 0 if the ring is full */
+static int ring_push(struct abt_io_ring *r, void (*fn)(void*), void *arg)
+{
+    struct abt_io_ring_cell *cell;
+    size_t pos;
+    intptr_t diff;
+
+    pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    while (1) {
+        cell = &r->cells[pos & r->mask];
+        diff = (intptr_t)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (intptr_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, 1,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
         }
-        free(aid->progress_xstreams);
-        // pool gets implicitly freed
+        else if (diff < 0)
+            return 0;
+        else
+            pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
     }
+    cell->fn = fn;
+    cell->arg = arg;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return 1;
+}
 
-    free(aid);
+/* returns 0 if the ring is empty */
+static int ring_pop(struct abt_io_ring *r, void (**fn)(void*), void **arg)
+{
+    struct abt_io_ring_cell *cell;
+    size_t pos;
+    intptr_t diff;
+
+    pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    while (1) {
+        cell = &r->cells[pos & r->mask];
+        diff = (intptr_t)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&r->tail, &pos, pos + 1, 1,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+            return 0;
+        else
+            pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    }
+    *fn = cell->fn;
+    *arg = cell->arg;
+    __atomic_store_n(&cell->seq, pos + r->mask + 1, __ATOMIC_RELEASE);
+    return 1;
 }
 
-struct abt_io_open_state
+static int ring_empty(struct abt_io_ring *r)
 {
-    int *ret;
-    const char *pathname;
-    int flags;
-    mode_t mode;
-    ABT_eventual eventual;
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) ==
+        __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
+
+/* runs one entry from a ring; returns 0 if there was nothing to run */
+static int ring_run_one(struct abt_io_ring *r)
+{
+    void (*fn)(void*);
+    void *arg;
+
+    if (ring_empty(r) || !ring_pop(r, &fn, &arg)) return 0;
+    fn(arg);
+    return 1;
+}
+
+/* applies the instance's CPU placement to a backing xstream */
+static int place_xstream(struct abt_io_instance *aid, ABT_xstream xstream,
+        int index)
+{
+    if (aid->bind_ncpus == 0) return ABT_SUCCESS;
+    if (aid->bind_each)
+        return ABT_xstream_set_cpubind(xstream,
+                aid->bind_cpus[index % aid->bind_ncpus]);
+    return ABT_xstream_set_affinity(xstream, aid->bind_ncpus, aid->bind_cpus);
+}
+
+/* Backing xstreams that abt-io manages itself (rather than handing to
+ * abt-snoozer) run this scheduler.  Its per-xstream data is the worker.
+ */
+static ABT_sched_config_var abt_io_sched_cv_worker = {
+    .idx = 0,
+    .type = ABT_SCHED_CONFIG_PTR
 };
 
-static void abt_io_open_fn(void *foo)
+static int abt_io_sched_init(ABT_sched sched, ABT_sched_config config)
 {
-    struct abt_io_open_state *state = foo;
+    struct abt_io_worker *w = NULL;
+    int ret;
+
+    ret = ABT_sched_config_read(config, 1, &w);
+    if (ret != ABT_SUCCESS) return ret;
+    return ABT_sched_set_data(sched, w);
+}
+
+static void elastic_reap_fn(void *foo);
+static void elastic_grow(struct abt_io_instance *aid);
+static void fd_cache_free(struct abt_io_instance *aid);
+static void tmp_pools_stop(struct abt_io_instance *aid);
+static void tmp_pools_free(struct abt_io_instance *aid);
+
+static int abt_io_sched_free(ABT_sched sched)
+{
+    return ABT_SUCCESS;
+}
+
+/* Called by an idle elastic worker.  Returns 1 if the worker should stop;
+ * the reaper task that joins it is queued for one of the remaining workers.
+ */
+static int elastic_try_retire(struct abt_io_worker *w)
+{
+    struct abt_io_elastic *el = w->aid->elastic;
+    struct abt_io_target t = { .aid = w->aid, .pool = w->aid->progress_pool };
+    int n;
+
+    do {
+        n = __atomic_load_n(&el->active, __ATOMIC_RELAXED);
+        if (n <= el->min) return 0;
+    } while (!__atomic_compare_exchange_n(&el->active, &n, n - 1, 0,
+                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    /* finalize sets stopping and then waits for RETIRING workers, so one
+     * of the two always sees the other */
+    __atomic_store_n(&w->state, ABT_IO_WORKER_RETIRING, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&el->stopping, __ATOMIC_SEQ_CST) ||
+            submit(t, elastic_reap_fn, w) != ABT_SUCCESS) {
+        __atomic_store_n(&w->state, ABT_IO_WORKER_RUNNING, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&el->active, 1, __ATOMIC_SEQ_CST);
+        return 0;
+    }
+    return 1;
+}
+
+/* Called by a worker that found its own ring and pool empty.  Runs one
+ * entry taken from another worker's ring or pool, if stealing is enabled
+ * for either, starting with the next worker so that thieves spread out.
+ */
+static int worker_steal_one(struct abt_io_worker *w)
+{
+    struct abt_io_instance *aid = w->aid;
+    struct abt_io_worker *victim;
+    ABT_unit unit;
+    int i;
+
+    for (i = 1; i < aid->num_workers; i++) {
+        victim = &aid->workers[(w->index + i) % aid->num_workers];
+        if (aid->ring_steal && victim->ring != NULL && ring_run_one(victim->ring))
+            return 1;
+        if (aid->pool_dispatch != ABT_IO_POOL_SHARED) {
+            ABT_pool_pop(victim->pool, &unit);
+            if (unit != ABT_UNIT_NULL) {
+                ABT_xstream_run_unit(unit, victim->pool);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* whether w has anything to run, including work it may steal */
+static int worker_has_work(struct abt_io_worker *w)
+{
+    struct abt_io_instance *aid = w->aid;
+    size_t size = 0;
+    int i;
+
+    if (w->ring != NULL && !ring_empty(w->ring)) return 1;
+    ABT_pool_get_size(w->pool, &size);
+    if (size > 0) return 1;
+    for (i = 0; aid->workers != NULL && i < aid->num_workers; i++) {
+        if (aid->ring_steal && aid->workers[i].ring != NULL &&
+                !ring_empty(aid->workers[i].ring))
+            return 1;
+        if (aid->pool_dispatch != ABT_IO_POOL_SHARED) {
+            ABT_pool_get_size(aid->workers[i].pool, &size);
+            if (size > 0) return 1;
+        }
+    }
+    return 0;
+}
+
+/* Blocks an idle worker on its futex word until a submitter wakes it or
+ * the sleep times out.  Submitters check sleeping after queueing work and
+ * the worker checks for work after setting sleeping, so (with sequentially
+ * consistent ordering on both sides) one of them always sees the other.
+ */
+static void worker_sleep(struct abt_io_worker *w)
+{
+    struct abt_io_instance *aid = w->aid;
+    struct timespec timeout = { 0, ABT_IO_SCHED_SLEEP_NS };
+    int seq;
+
+    seq = __atomic_load_n(&w->wake_seq, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&w->sleeping, 1, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&aid->idle_sleepers, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&aid->idle_stop, __ATOMIC_SEQ_CST) && !worker_has_work(w))
+        syscall(SYS_futex, &w->wake_seq, FUTEX_WAIT_PRIVATE, seq, &timeout, NULL, 0);
+    __atomic_fetch_sub(&aid->idle_sleepers, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+    return;
+}
+
+static int worker_wake(struct abt_io_worker *w)
+{
+    if (!__atomic_load_n(&w->sleeping, __ATOMIC_SEQ_CST)) return 0;
+    __atomic_fetch_add(&w->wake_seq, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &w->wake_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    return 1;
+}
+
+/* Wakes a worker for work just queued on t, if one is asleep: the owner
+ * of the ring or pool, or else any sleeper that serves the pool.  Idle
+ * workers that can steal get to it on their own when the owner is busy.
+ */
+static void idle_wake(struct abt_io_target t)
+{
+    struct abt_io_instance *aid = t.aid;
+    int i;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (t.worker != NULL && worker_wake(t.worker)) return;
+    if (t.worker != NULL && !aid->ring_steal &&
+            aid->pool_dispatch == ABT_IO_POOL_SHARED)
+        return;
+    for (i = 0; i < aid->idle_nworkers; i++)
+        if ((t.worker != NULL || aid->idle_workers[i].pool == t.pool) &&
+                worker_wake(&aid->idle_workers[i]))
+            return;
+    return;
+}
+
+static void abt_io_sched_run(ABT_sched sched)
+{
+    struct abt_io_worker *w;
+    struct abt_io_instance *aid;
+    struct abt_io_elastic *el;
+    ABT_pool pool;
+    ABT_unit unit;
+    ABT_bool stop;
+    uint64_t now, idle_since = 0;
+    unsigned int n = 0;
+    int ran;
+
+    ABT_sched_get_data(sched, (void**)&w);
+    aid = w->aid;
+    el = aid->elastic;
+    ABT_sched_get_pools(sched, 1, 0, &pool);
+
+    if (__atomic_load_n(&w->state, __ATOMIC_ACQUIRE) == ABT_IO_WORKER_RETIRING)
+        return;
+
+    while (1) {
+        /* in ring mode the ring comes first; the pool only holds overflow
+         * and internal tasks */
+        if (w->ring != NULL && ring_run_one(w->ring))
+            ran = 1;
+        else {
+            ABT_pool_pop(pool, &unit);
+            ran = unit != ABT_UNIT_NULL;
+            if (ran) ABT_xstream_run_unit(unit, pool);
+            else if (aid->workers != NULL) ran = worker_steal_one(w);
+        }
+        if (ran)
+            idle_since = 0;
+        else {
+            now = abt_io_now_ns();
+            if (el != NULL) __atomic_store_n(&el->last_empty, now, __ATOMIC_RELAXED);
+            if (idle_since == 0)
+                idle_since = now;
+            else if (el != NULL && now - idle_since > el->idle_ns &&
+                    elastic_try_retire(w))
+                return;
+
+            /* spin for the budget, then sleep until woken */
+            if (now - idle_since > aid->idle_spin_ns)
+                worker_sleep(w);
+        }
+
+        if (!ran || ++n % ABT_IO_SCHED_EVENT_FREQ == 0) {
+            if (el != NULL && __atomic_load_n(&el->grow_request, __ATOMIC_ACQUIRE))
+                elastic_grow(aid);
+            ABT_sched_has_to_stop(sched, &stop);
+            /* entries still in the ring are not visible to Argobots */
+            if (stop == ABT_TRUE && (w->ring == NULL || ring_empty(w->ring)))
+                break;
+            ABT_xstream_check_events(sched);
+        }
+    }
+    return;
+}
+
+static ABT_sched_def abt_io_sched_def = {
+    .type = ABT_SCHED_TYPE_ULT,
+    .init = abt_io_sched_init,
+    .run = abt_io_sched_run,
+    .free = abt_io_sched_free,
+    .get_migr_pool = NULL
+};
+
+/* creates an xstream running the abt-io scheduler for worker w */
+static int worker_start(struct abt_io_worker *w, ABT_pool pool)
+{
+    ABT_sched_config config;
+    ABT_sched sched;
+    int ret;
+
+    ret = ABT_sched_config_create(&config, abt_io_sched_cv_worker, w,
+            ABT_sched_config_automatic, ABT_TRUE, ABT_sched_config_var_end);
+    if (ret != ABT_SUCCESS) return ret;
+    ret = ABT_sched_create(&abt_io_sched_def, 1, &pool, config, &sched);
+    ABT_sched_config_free(&config);
+    if (ret != ABT_SUCCESS) return ret;
+    ret = ABT_xstream_create(sched, &w->xstream);
+    if (ret != ABT_SUCCESS) return ret;
+    if (w->aid->num_domain_pools > 1)
+        return ABT_xstream_set_affinity(w->xstream,
+                w->aid->numa->domain_ncpus[w->domain],
+                w->aid->numa->domain_cpus[w->domain]);
+    return place_xstream(w->aid, w->xstream, w->index);
+}
+
+static void elastic_reap_fn(void *foo)
+{
+    struct abt_io_worker *w = foo;
+
+    ABT_xstream_join(w->xstream);
+    ABT_xstream_free(&w->xstream);
+    __atomic_store_n(&w->state, ABT_IO_WORKER_FREE, __ATOMIC_SEQ_CST);
+    return;
+}
+
+/* Asks the running workers for another backing xstream if the queue is
+ * deeper than the threshold or has not drained for longer than the wait
+ * threshold.  Called on the submit path, so it only posts the request;
+ * creating the xstream is left to elastic_grow on a worker.
+ */
+static void elastic_maybe_grow(struct abt_io_instance *aid)
+{
+    struct abt_io_elastic *el = aid->elastic;
+    size_t depth = 0;
+
+    if (__atomic_load_n(&el->active, __ATOMIC_RELAXED) >= el->max) return;
+    if (__atomic_load_n(&el->grow_request, __ATOMIC_RELAXED)) return;
+    /* a sleeping worker is about to be woken for this operation */
+    if (__atomic_load_n(&aid->idle_sleepers, __ATOMIC_RELAXED) > 0) return;
+
+    ABT_pool_get_size(aid->progress_pool, &depth);
+    if (depth == 0) return;
+    if (depth <= el->grow_depth && (el->grow_wait_ns == 0 ||
+            abt_io_now_ns() - __atomic_load_n(&el->last_empty, __ATOMIC_RELAXED)
+            < el->grow_wait_ns))
+        return;
+
+    __atomic_store_n(&el->grow_request, 1, __ATOMIC_RELEASE);
+    return;
+}
+
+/* Called by a worker's scheduler between units when a grow request is
+ * posted.  Only one worker grows the set at a time.
+ */
+static void elastic_grow(struct abt_io_instance *aid)
+{
+    struct abt_io_elastic *el = aid->elastic;
+    struct abt_io_worker *w = NULL;
+    int i;
+
+    if (__atomic_exchange_n(&el->growing, 1, __ATOMIC_SEQ_CST)) return;
+    __atomic_store_n(&el->grow_request, 0, __ATOMIC_RELAXED);
+
+    if (!__atomic_load_n(&el->stopping, __ATOMIC_SEQ_CST) &&
+            __atomic_load_n(&el->active, __ATOMIC_RELAXED) < el->max) {
+        for (i = 0; i < el->max && w == NULL; i++)
+            if (__atomic_load_n(&el->workers[i].state, __ATOMIC_ACQUIRE)
+                    == ABT_IO_WORKER_FREE)
+                w = &el->workers[i];
+        if (w != NULL) {
+            w->state = ABT_IO_WORKER_RUNNING;
+            __atomic_fetch_add(&el->active, 1, __ATOMIC_SEQ_CST);
+            if (worker_start(w, aid->progress_pool) != ABT_SUCCESS) {
+                if (w->xstream != ABT_XSTREAM_NULL) {
+                    ABT_xstream_join(w->xstream);
+                    ABT_xstream_free(&w->xstream);
+                }
+                __atomic_fetch_sub(&el->active, 1, __ATOMIC_SEQ_CST);
+                __atomic_store_n(&w->state, ABT_IO_WORKER_FREE, __ATOMIC_SEQ_CST);
+            }
+        }
+    }
+    /* count this as the queue draining so that one slow burst does not
+     * trigger a new xstream on every submission */
+    __atomic_store_n(&el->last_empty, abt_io_now_ns(), __ATOMIC_RELAXED);
+    __atomic_store_n(&el->growing, 0, __ATOMIC_RELEASE);
+    return;
+}
+
+static void elastic_stop(struct abt_io_instance *aid)
+{
+    struct abt_io_elastic *el = aid->elastic;
+    int i;
+
+    __atomic_store_n(&el->stopping, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&el->growing, __ATOMIC_ACQUIRE)) ABT_thread_yield();
+
+    for (i = 0; i < el->max; i++) {
+        while (__atomic_load_n(&el->workers[i].state, __ATOMIC_SEQ_CST)
+                == ABT_IO_WORKER_RETIRING)
+            ABT_thread_yield();
+        if (el->workers[i].state == ABT_IO_WORKER_RUNNING) {
+            ABT_xstream_join(el->workers[i].xstream);
+            ABT_xstream_free(&el->workers[i].xstream);
+            el->workers[i].state = ABT_IO_WORKER_FREE;
+        }
+    }
+    return;
+}
+
+/* picks the worker whose ring receives an operation in ring mode */
+static struct abt_io_worker* select_ring(struct abt_io_instance *aid, int fd)
+{
+    unsigned int i;
+
+    if (fd >= 0 && aid->ring_select == ABT_IO_RING_SELECT_FD)
+        i = ((uint32_t)fd * 2654435761u) % aid->num_workers;
+    else
+        i = __atomic_fetch_add(&aid->dispatch_next, 1, __ATOMIC_RELAXED) % aid->num_workers;
+    return &aid->workers[i];
+}
+
+/* Picks a worker pool with per-xstream pools: the less loaded of two
+ * pseudo-randomly chosen pools, or the pool paired with the caller's
+ * xstream so that each issuing xstream mostly pushes to a pool of its own.
+ */
+static struct abt_io_worker* select_worker(struct abt_io_instance *aid)
+{
+    unsigned int r, i, j;
+    size_t si = 0, sj = 0;
+    int rank;
+
+    if (aid->pool_dispatch == ABT_IO_POOL_LOCAL &&
+            ABT_xstream_self_rank(&rank) == ABT_SUCCESS)
+        return &aid->workers[rank % aid->num_workers];
+
+    r = __atomic_fetch_add(&aid->dispatch_next, 1, __ATOMIC_RELAXED) * 2654435761u;
+    i = r % aid->num_workers;
+    j = (r >> 16) % aid->num_workers;
+    if (i == j) return &aid->workers[i];
+    ABT_pool_get_size(aid->workers[i].pool, &si);
+    ABT_pool_get_size(aid->workers[j].pool, &sj);
+    return &aid->workers[si <= sj ? i : j];
+}
+
+/* Picks the pool for an operation.  With per-domain pools the operation
+ * goes to the domain of the caller's buffer or of the fd's device,
+ * depending on the routing flags, and otherwise to the caller's domain.
+ */
+static ABT_pool select_pool(struct abt_io_instance *aid, int fd, const void *buf)
+{
+    struct abt_io_numa *numa = aid->numa;
+    int d = -1;
+    int cpu;
+
+    if (aid->num_domain_pools <= 1) return aid->progress_pool;
+
+    if (buf != NULL && (aid->numa_route & ABT_IO_NUMA_ROUTE_BUFFER))
+        d = numa_domain_of_addr(numa, buf);
+    if (d < 0 && fd >= 0 && (aid->numa_route & ABT_IO_NUMA_ROUTE_FD))
+        d = numa_domain_of_fd(aid, fd);
+    if (d < 0) {
+        cpu = sched_getcpu();
+        if (cpu >= 0 && cpu < numa->num_cpus) d = numa->cpu_domain[cpu];
+    }
+
+    return d < 0 ? aid->progress_pool : aid->domain_pools[d];
+}
+
+static struct abt_io_target select_target(struct abt_io_instance *aid, int fd,
+        const void *buf)
+{
+    struct abt_io_target t;
+    struct abt_io_worker *w;
+
+    /* every operation passes through here on its way to a pool */
+    if (aid->elastic != NULL) elastic_maybe_grow(aid);
+
+    t.aid = aid;
+    t.ring = NULL;
+    t.worker = NULL;
+    if (aid->workers != NULL && aid->workers[0].ring != NULL) {
+        /* ring overflow goes to the pool of the ring's worker */
+        w = select_ring(aid, fd);
+        t.ring = w->ring;
+        t.pool = w->pool;
+        t.worker = w;
+    }
+    else if (aid->workers != NULL && aid->pool_dispatch != ABT_IO_POOL_SHARED) {
+        w = select_worker(aid);
+        t.pool = w->pool;
+        t.worker = w;
+    }
+    else
+        t.pool = select_pool(aid, fd, buf);
+    t.home = aid->resume_home ? home_pool() : ABT_POOL_NULL;
+    return t;
+}
+
+/* hands fn(arg) to a backing xstream */
+static int submit(struct abt_io_target t, void (*fn)(void*), void *arg)
+{
+    int ret = ABT_SUCCESS;
+
+    if (t.ring == NULL || !ring_push(t.ring, fn, arg))
+        ret = ABT_task_create(t.pool, fn, arg, NULL);
+    if (ret == ABT_SUCCESS && t.aid->idle_workers != NULL)
+        idle_wake(t);
+    return ret;
+}
+
+/* submits a task that the instance starts on its own rather than for an
+ * operation; nothing joins these in init_pool mode, so finalize waits
+ * until each has called internal_done() */
+static int submit_internal(struct abt_io_instance *aid, struct abt_io_target t,
+        void (*fn)(void*), void *arg)
+{
+    int ret;
+
+    ABT_mutex_spinlock(aid->internal_mutex);
+    aid->internal++;
+    ABT_mutex_unlock(aid->internal_mutex);
+    ret = submit(t, fn, arg);
+    if (ret != ABT_SUCCESS) internal_done(aid);
+    return ret;
+}
+
+/* the last thing an internal task does; it must not touch the instance,
+ * or anything finalize frees, after this */
+static void internal_done(struct abt_io_instance *aid)
+{
+    ABT_mutex_spinlock(aid->internal_mutex);
+    if (--aid->internal == 0) ABT_cond_broadcast(aid->internal_cond);
+    ABT_mutex_unlock(aid->internal_mutex);
+}
+
+/* allocates an instance with the state shared by every init variant */
+static struct abt_io_instance* instance_alloc(void)
+{
+    struct abt_io_instance *aid;
+
+    aid = calloc(1, sizeof(*aid));
+    if (aid == NULL) return NULL;
+    if (ABT_mutex_create(&aid->prealloc_mutex) != ABT_SUCCESS)
+        goto err_free;
+    if (ABT_mutex_create(&aid->op_cache_mutex) != ABT_SUCCESS)
+        goto err_prealloc;
+    if (ABT_mutex_create(&aid->fd_cache_mutex) != ABT_SUCCESS)
+        goto err_op_cache;
+    if (ABT_mutex_create(&aid->tmp_pool_mutex) != ABT_SUCCESS)
+        goto err_fd_cache;
+    if (ABT_cond_create(&aid->tmp_pool_cond) != ABT_SUCCESS)
+        goto err_tmp_pool;
+    if (ABT_mutex_create(&aid->internal_mutex) != ABT_SUCCESS)
+        goto err_tmp_pool_cond;
+    if (ABT_cond_create(&aid->internal_cond) != ABT_SUCCESS)
+        goto err_internal;
+    aid->fd_cache_limit = ABT_IO_FD_CACHE_LIMIT;
+    return aid;
+
+err_internal:
+    ABT_mutex_free(&aid->internal_mutex);
+err_tmp_pool_cond:
+    ABT_cond_free(&aid->tmp_pool_cond);
+err_tmp_pool:
+    ABT_mutex_free(&aid->tmp_pool_mutex);
+err_fd_cache:
+    ABT_mutex_free(&aid->fd_cache_mutex);
+err_op_cache:
+    ABT_mutex_free(&aid->op_cache_mutex);
+err_prealloc:
+    ABT_mutex_free(&aid->prealloc_mutex);
+err_free:
+    free(aid);
+    return NULL;
+}
+
+void abt_io_init_opts_default(struct abt_io_init_opts *opts)
+{
+    memset(opts, 0, sizeof(*opts));
+    opts->numa_node = -1;
+    opts->numa_route = ABT_IO_NUMA_ROUTE_BUFFER | ABT_IO_NUMA_ROUTE_FD;
+    opts->elastic_grow_depth = 16;
+    opts->elastic_grow_wait_us = 100;
+    opts->elastic_idle_ms = 1000;
+    opts->ring_size = 256;
+    opts->ring_select = ABT_IO_RING_SELECT_FD;
+    opts->ring_steal = 1;
+    opts->fd_cache_limit = ABT_IO_FD_CACHE_LIMIT;
+}
+
+/* creates the worker slots and the initial xstreams of an elastic instance */
+static int elastic_init(struct abt_io_instance *aid,
+        const struct abt_io_init_opts *opts)
+{
+    struct abt_io_elastic *el;
+    int i, ret;
+
+    el = calloc(1, sizeof(*el));
+    if (el == NULL) return ABT_ERR_MEM;
+    el->workers = calloc(opts->elastic_max, sizeof(*el->workers));
+    if (el->workers == NULL) { free(el); return ABT_ERR_MEM; }
+
+    el->min = opts->elastic_min;
+    el->max = opts->elastic_max;
+    el->grow_depth = opts->elastic_grow_depth;
+    el->grow_wait_ns = (uint64_t)opts->elastic_grow_wait_us * 1000;
+    el->idle_ns = (uint64_t)opts->elastic_idle_ms * 1000000;
+    el->last_empty = abt_io_now_ns();
+    aid->elastic = el;
+
+    ret = ABT_pool_create_basic(ABT_POOL_FIFO, ABT_POOL_ACCESS_MPMC,
+            ABT_FALSE, &aid->progress_pool);
+    if (ret != ABT_SUCCESS) return ret;
+
+    for (i = 0; i < el->max; i++) {
+        el->workers[i].aid = aid;
+        el->workers[i].index = i;
+        el->workers[i].pool = aid->progress_pool;
+    }
+    aid->idle_workers = el->workers;
+    aid->idle_nworkers = el->max;
+
+    for (i = 0; i < el->min; i++) {
+        el->workers[i].state = ABT_IO_WORKER_RUNNING;
+        el->active++;
+        ret = worker_start(&el->workers[i], aid->progress_pool);
+        if (ret != ABT_SUCCESS) {
+            if (el->workers[i].xstream == ABT_XSTREAM_NULL) {
+                el->workers[i].state = ABT_IO_WORKER_FREE;
+                el->active--;
+            }
+            return ret;
+        }
+    }
+    return ABT_SUCCESS;
+}
+
+/* Creates the backing xstreams of an instance that runs the abt-io
+ * scheduler, per_domain of them for each domain pool.  Each worker has a
+ * ring in ring mode, and its own pool unless pool_dispatch is
+ * ABT_IO_POOL_SHARED, in which case the workers of a domain share a pool.
+ */
+static int workers_init(struct abt_io_instance *aid, int per_domain,
+        const struct abt_io_init_opts *opts)
+{
+    int count = per_domain * aid->num_domain_pools;
+    int d, i, ret;
+
+    aid->ring_select = opts->ring_select;
+    aid->ring_steal = opts->ring_steal;
+    aid->pool_dispatch = opts->pool_dispatch;
+    aid->workers = calloc(count, sizeof(*aid->workers));
+    if (aid->workers == NULL) return ABT_ERR_MEM;
+    aid->num_workers = count;
+    aid->idle_workers = aid->workers;
+    aid->idle_nworkers = count;
+
+    if (aid->pool_dispatch == ABT_IO_POOL_SHARED) {
+        for (d = 0; d < aid->num_domain_pools; d++) {
+            ret = ABT_pool_create_basic(ABT_POOL_FIFO, ABT_POOL_ACCESS_MPMC,
+                    ABT_FALSE, &aid->domain_pools[d]);
+            if (ret != ABT_SUCCESS) return ret;
+        }
+        aid->progress_pool = aid->domain_pools[0];
+    }
+    for (i = 0; i < count; i++) {
+        aid->workers[i].aid = aid;
+        aid->workers[i].index = i;
+        aid->workers[i].domain = i / per_domain;
+        aid->workers[i].state = ABT_IO_WORKER_RUNNING;
+        if (opts->submit_rings) {
+            aid->workers[i].ring = ring_create(opts->ring_size);
+            if (aid->workers[i].ring == NULL) return ABT_ERR_MEM;
+        }
+        if (aid->pool_dispatch == ABT_IO_POOL_SHARED)
+            aid->workers[i].pool = aid->domain_pools[aid->workers[i].domain];
+        else {
+            ret = ABT_pool_create_basic(ABT_POOL_FIFO, ABT_POOL_ACCESS_MPMC,
+                    ABT_FALSE, &aid->workers[i].pool);
+            if (ret != ABT_SUCCESS) return ret;
+        }
+    }
+    if (aid->pool_dispatch != ABT_IO_POOL_SHARED)
+        aid->progress_pool = aid->workers[0].pool;
+
+    /* workers may steal from each other as soon as they start, so all
+     * rings and pools exist before the first one runs */
+    for (i = 0; i < count; i++) {
+        ret = worker_start(&aid->workers[i], aid->workers[i].pool);
+        if (ret != ABT_SUCCESS) return ret;
+    }
+    return ABT_SUCCESS;
+}
+
+/* creates per_domain abt-snoozer xstreams for each domain pool */
+static int snoozer_init(struct abt_io_instance *aid, int per_domain)
+{
+#ifdef HAVE_ABT_SNOOZER
+    int d, i, ret;
+
+    aid->progress_xstreams = calloc(per_domain * aid->num_domain_pools,
+            sizeof(*aid->progress_xstreams));
+    if (aid->progress_xstreams == NULL) return ABT_ERR_MEM;
+
+    for (d = 0; d < aid->num_domain_pools; d++) {
+        ret = ABT_snoozer_xstream_create(per_domain, &aid->domain_pools[d],
+                aid->progress_xstreams + aid->num_xstreams);
+        if (ret != ABT_SUCCESS) return ret;
+        aid->num_xstreams += per_domain;
+
+        for (i = aid->num_xstreams - per_domain; i < aid->num_xstreams; i++) {
+            if (aid->num_domain_pools > 1)
+                ret = ABT_xstream_set_affinity(aid->progress_xstreams[i],
+                        aid->numa->domain_ncpus[d], aid->numa->domain_cpus[d]);
+            else
+                ret = place_xstream(aid, aid->progress_xstreams[i], i);
+            if (ret != ABT_SUCCESS) return ret;
+        }
+    }
+    aid->progress_pool = aid->domain_pools[0];
+    return ABT_SUCCESS;
+#else
+    return ABT_ERR_FEATURE_NA;
+#endif
+}
+
+abt_io_instance_id abt_io_init_ext(const struct abt_io_init_opts *opts)
+{
+    struct abt_io_instance *aid;
+    struct abt_io_init_opts defaults;
+    ABT_pool pool;
+    ABT_xstream self_xstream;
+    int count, per_domain, d;
+    int native, spin_us;
+    int ret;
+
+    if (opts == NULL) {
+        abt_io_init_opts_default(&defaults);
+        opts = &defaults;
+    }
+    count = opts->backing_thread_count;
+    if (opts->elastic_max > 0) {
+        if (opts->elastic_min < 1 || opts->elastic_min > opts->elastic_max ||
+                opts->numa_pools)
+            return NULL;
+        count = opts->elastic_min;
+    }
+    if (opts->submit_rings && (opts->ring_size < 2 ||
+                (opts->ring_size & (opts->ring_size - 1))))
+        return NULL;
+    if ((opts->submit_rings || opts->pool_dispatch != ABT_IO_POOL_SHARED) &&
+            (opts->elastic_max > 0 || opts->numa_pools))
+        return NULL;
+    if (count < 0 || opts->num_cpus < 0 || opts->fd_cache_limit < 0) return NULL;
+    if (opts->num_cpus > 0 && opts->cpus == NULL) return NULL;
+    if (count == 0 && (opts->num_cpus > 0 || opts->numa_node >= 0 ||
+                opts->numa_pools || opts->submit_rings ||
+                opts->pool_dispatch != ABT_IO_POOL_SHARED))
+        return NULL;
+    if (opts->numa_pools && (opts->num_cpus > 0 || opts->numa_node >= 0))
+        return NULL;
+    if (opts->idle_mode < ABT_IO_IDLE_DEFAULT || opts->idle_mode > ABT_IO_IDLE_POWER)
+        return NULL;
+
+    /* abt-snoozer is only used for plain shared pools, and only when the
+     * caller has not asked for a specific idle mode */
+#ifdef HAVE_ABT_SNOOZER
+    native = opts->idle_mode != ABT_IO_IDLE_DEFAULT || opts->submit_rings ||
+        opts->pool_dispatch != ABT_IO_POOL_SHARED;
+#else
+    native = 1;
+#endif
+
+    aid = instance_alloc();
+    if (aid == NULL) return ABT_IO_INSTANCE_NULL;
+
+    aid->inline_nowait = opts->inline_nowait;
+    aid->resume_home = opts->resume_home;
+    aid->fd_cache_limit = opts->fd_cache_limit;
+    spin_us = opts->idle_spin_us > 0 ? opts->idle_spin_us :
+        opts->idle_mode == ABT_IO_IDLE_LATENCY ? ABT_IO_IDLE_LATENCY_SPIN_US :
+        ABT_IO_IDLE_POWER_SPIN_US;
+    aid->idle_spin_ns = (uint64_t)spin_us * 1000;
+
+    if (opts->numa_node >= 0 || opts->numa_pools) {
+        aid->numa = numa_discover();
+        if (aid->numa == NULL) goto err;
+        ret = ABT_mutex_create(&aid->numa->dev_mutex);
+        if (ret != ABT_SUCCESS) goto err;
+    }
+
+    if (count == 0) {
+        aid->num_xstreams = 0;
+        ret = ABT_xstream_self(&self_xstream);
+        if (ret != ABT_SUCCESS) goto err;
+        ret = ABT_xstream_get_main_pools(self_xstream, 1, &pool);
+        if (ret != ABT_SUCCESS) goto err;
+        aid->progress_pool = pool;
+        return aid;
+    }
+
+    /* explicit CPU lists pin each xstream to one CPU, NUMA placement lets
+     * xstreams float within their node */
+    if (opts->num_cpus > 0) {
+        aid->bind_ncpus = opts->num_cpus;
+        aid->bind_each = 1;
+        aid->bind_cpus = malloc(opts->num_cpus * sizeof(*aid->bind_cpus));
+        if (aid->bind_cpus == NULL) goto err;
+        memcpy(aid->bind_cpus, opts->cpus, opts->num_cpus * sizeof(*aid->bind_cpus));
+    }
+    else if (opts->numa_node >= 0) {
+        if (opts->numa_node >= aid->numa->max_node ||
+                aid->numa->node_domain[opts->numa_node] < 0)
+            goto err;
+        d = aid->numa->node_domain[opts->numa_node];
+        aid->bind_ncpus = aid->numa->domain_ncpus[d];
+        aid->bind_cpus = malloc(aid->bind_ncpus * sizeof(*aid->bind_cpus));
+        if (aid->bind_cpus == NULL) goto err;
+        memcpy(aid->bind_cpus, aid->numa->domain_cpus[d],
+                aid->bind_ncpus * sizeof(*aid->bind_cpus));
+    }
+
+    if (opts->elastic_max > 0) {
+        if (elastic_init(aid, opts) != ABT_SUCCESS) goto err;
+        return aid;
+    }
+
+    /* one domain unless pools are split by NUMA node; the thread count is
+     * rounded up so that every domain gets the same number of xstreams */
+    aid->num_domain_pools = opts->numa_pools ? aid->numa->num_domains : 1;
+    per_domain = (count + aid->num_domain_pools - 1) / aid->num_domain_pools;
+    aid->numa_route = opts->numa_route;
+
+    aid->domain_pools = calloc(aid->num_domain_pools, sizeof(*aid->domain_pools));
+    if (aid->domain_pools == NULL) goto err;
+
+    if (native)
+        ret = workers_init(aid, per_domain, opts);
+    else
+        ret = snoozer_init(aid, per_domain);
+    if (ret != ABT_SUCCESS) goto err;
+
+    return aid;
+
+err:
+    /* finalize copes with partially initialized instances */
+    abt_io_finalize(aid);
+    return ABT_IO_INSTANCE_NULL;
+}
+
+abt_io_instance_id abt_io_init(int backing_thread_count)
+{
+    struct abt_io_init_opts opts;
+
+    abt_io_init_opts_default(&opts);
+    opts.backing_thread_count = backing_thread_count;
+
+    return abt_io_init_ext(&opts);
+}
+
+abt_io_instance_id abt_io_init_pool(ABT_pool progress_pool)
+{
+    struct abt_io_instance *aid;
+
+    aid = instance_alloc();
+    if(!aid) return(ABT_IO_INSTANCE_NULL);
+
+    aid->progress_pool = progress_pool;
+    aid->progress_xstreams = NULL;
+    aid->num_xstreams = 0;
+
+    return aid;
+}
+
+void abt_io_finalize(abt_io_instance_id aid)
+{
+    abt_io_op_t *op;
+    int i;
+
+    /* stop the temp file refills, then let the tasks the instance queued
+     * on its own finish while the xstreams that run them are still up */
+    tmp_pools_stop(aid);
+    ABT_mutex_lock(aid->internal_mutex);
+    while (aid->internal > 0)
+        ABT_cond_wait(aid->internal_cond, aid->internal_mutex);
+    ABT_mutex_unlock(aid->internal_mutex);
+
+    /* sleeping workers would only notice the stop request on timeout */
+    if (aid->idle_workers != NULL) {
+        __atomic_store_n(&aid->idle_stop, 1, __ATOMIC_SEQ_CST);
+        for (i = 0; i < aid->idle_nworkers; i++)
+            worker_wake(&aid->idle_workers[i]);
+    }
+
+    if (aid->num_xstreams) {
+        for (i = 0; i < aid->num_xstreams; i++) {
+            ABT_xstream_join(aid->progress_xstreams[i]);
+            ABT_xstream_free(&aid->progress_xstreams[i]);
+        }
+        // pool gets implicitly freed
+    }
+    free(aid->progress_xstreams);
+    if (aid->workers != NULL) {
+        for (i = 0; i < aid->num_workers; i++)
+            if (aid->workers[i].xstream != ABT_XSTREAM_NULL) {
+                ABT_xstream_join(aid->workers[i].xstream);
+                ABT_xstream_free(&aid->workers[i].xstream);
+            }
+        for (i = 0; i < aid->num_workers; i++) {
+            ring_free(aid->workers[i].ring);
+            if (aid->pool_dispatch != ABT_IO_POOL_SHARED &&
+                    aid->workers[i].pool != ABT_POOL_NULL)
+                ABT_pool_free(&aid->workers[i].pool);
+        }
+        free(aid->workers);
+        for (i = 0; aid->pool_dispatch == ABT_IO_POOL_SHARED &&
+                i < aid->num_domain_pools; i++)
+            if (aid->domain_pools[i] != ABT_POOL_NULL)
+                ABT_pool_free(&aid->domain_pools[i]);
+    }
+    if (aid->elastic != NULL) {
+        elastic_stop(aid);
+        if (aid->progress_pool != ABT_POOL_NULL)
+            ABT_pool_free(&aid->progress_pool);
+        free(aid->elastic->workers);
+        free(aid->elastic);
+    }
+    free(aid->bind_cpus);
+    free(aid->domain_pools);
+    if (aid->numa != NULL) {
+        if (aid->numa->dev_mutex != ABT_MUTEX_NULL)
+            ABT_mutex_free(&aid->numa->dev_mutex);
+        numa_free(aid->numa);
+    }
+
+    for (i = 0; i < ABT_IO_PREALLOC_FD_CHUNKS; i++)
+        free(aid->prealloc[i]);
+    while ((op = aid->op_cache) != NULL) {
+        aid->op_cache = op->next;
+        free(op);
+    }
+    for (i = 0; i < ABT_IO_NOWAIT_FD_CHUNKS; i++)
+        free(aid->nowait_fd[i]);
+    fd_cache_free(aid);
+    tmp_pools_free(aid);
+    waiters_free(&aid->waiters);
+    ABT_mutex_free(&aid->prealloc_mutex);
+    ABT_mutex_free(&aid->op_cache_mutex);
+    ABT_mutex_free(&aid->fd_cache_mutex);
+    ABT_mutex_free(&aid->tmp_pool_mutex);
+    ABT_cond_free(&aid->tmp_pool_cond);
+    ABT_mutex_free(&aid->internal_mutex);
+    ABT_cond_free(&aid->internal_cond);
+    free(aid);
+}
+
+static abt_io_op_t* op_alloc(struct abt_io_instance *aid)
+{
+    abt_io_op_t *op = NULL;
+
+    if (__atomic_load_n(&aid->op_cache_count, __ATOMIC_RELAXED) > 0) {
+        ABT_mutex_spinlock(aid->op_cache_mutex);
+        op = aid->op_cache;
+        if (op != NULL) {
+            aid->op_cache = op->next;
+            __atomic_store_n(&aid->op_cache_count, aid->op_cache_count - 1,
+                    __ATOMIC_RELAXED);
+        }
+        ABT_mutex_unlock(aid->op_cache_mutex);
+    }
+    if (op == NULL) {
+        op = malloc(sizeof(*op));
+        if (op == NULL) return NULL;
+        op->aid = aid;
+    }
+    return op;
+}
+
+static void op_release(abt_io_op_t *op)
+{
+    struct abt_io_instance *aid = op->aid;
+
+    if (__atomic_load_n(&aid->op_cache_count, __ATOMIC_RELAXED) < ABT_IO_OP_CACHE_MAX) {
+        ABT_mutex_spinlock(aid->op_cache_mutex);
+        if (aid->op_cache_count < ABT_IO_OP_CACHE_MAX) {
+            op->next = aid->op_cache;
+            aid->op_cache = op;
+            __atomic_store_n(&aid->op_cache_count, aid->op_cache_count + 1,
+                    __ATOMIC_RELAXED);
+            op = NULL;
+        }
+        ABT_mutex_unlock(aid->op_cache_mutex);
+    }
+    free(op);
+    return;
+}
+
+/* Returns 1 if the caller should extend the region because write_end has
+ * come within half a chunk of its end.  At most one caller at a time is
+ * told to do so; everybody else carries on without waiting.
+ */
+static int prealloc_claim(struct abt_io_prealloc *p, off_t write_end)
+{
+    size_t chunk;
+
+    chunk = __atomic_load_n(&p->chunk, __ATOMIC_ACQUIRE);
+    if (chunk == 0) return 0;
+    if (write_end + (off_t)(chunk / 2) <= __atomic_load_n(&p->end, __ATOMIC_ACQUIRE))
+        return 0;
+    if (__atomic_exchange_n(&p->busy, 1, __ATOMIC_ACQUIRE)) return 0;
+    /* the policy may have been disabled since chunk was read */
+    if (__atomic_load_n(&p->chunk, __ATOMIC_ACQUIRE) == 0) {
+        __atomic_store_n(&p->busy, 0, __ATOMIC_RELEASE);
+        return 0;
+    }
+    return 1;
+}
+
+/* extends a claimed region and releases the claim */
+static void prealloc_extend(struct abt_io_prealloc *p, off_t write_end)
+{
+#ifdef HAVE_FALLOCATE
+    off_t chunk = p->chunk;
+    off_t start = p->end;
+    off_t new_end;
+
+    new_end = (write_end / chunk + 1) * chunk;
+    if (new_end - write_end < chunk / 2) new_end += chunk;
+    if (new_end <= start)
+        ;
+    else if (fallocate(p->fd, FALLOC_FL_KEEP_SIZE, start, new_end - start) == 0)
+        __atomic_store_n(&p->end, new_end, __ATOMIC_RELEASE);
+    else if (errno == EOPNOTSUPP || errno == ENOSYS)
+        __atomic_store_n(&p->chunk, 0, __ATOMIC_RELAXED);
+#else
+    __atomic_store_n(&p->chunk, 0, __ATOMIC_RELAXED);
+#endif
+
+    __atomic_store_n(&p->busy, 0, __ATOMIC_RELEASE);
+    return;
+}
+
+/* releases space preallocated past EOF */
+static int prealloc_trim(int fd)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) < 0) return -errno;
+    if (ftruncate(fd, st.st_size) < 0) return -errno;
+    return 0;
+}
+
+struct abt_io_prealloc_state
+{
+    struct abt_io_instance *aid;
+    struct abt_io_prealloc *p;
+    off_t write_end;
+};
+
+static void abt_io_prealloc_fn(void *foo)
+{
+    struct abt_io_prealloc_state *state = foo;
+    struct abt_io_instance *aid = state->aid;
+
+    prealloc_extend(state->p, state->write_end);
+    free(state);
+    internal_done(aid);
+    return;
+}
+
+/* the preallocation policy slot for fd, or NULL if fd is out of range or
+ * its chunk has not been (or could not be) allocated */
+static struct abt_io_prealloc* prealloc_fd_slot(struct abt_io_instance *aid,
+        int fd, int alloc)
+{
+    struct abt_io_prealloc **chunk;
+    struct abt_io_prealloc *c;
+    struct abt_io_prealloc *none = NULL;
+
+    if (fd < 0 || fd >= ABT_IO_PREALLOC_FD_CHUNK * ABT_IO_PREALLOC_FD_CHUNKS)
+        return NULL;
+    chunk = &aid->prealloc[fd / ABT_IO_PREALLOC_FD_CHUNK];
+    c = __atomic_load_n(chunk, __ATOMIC_ACQUIRE);
+    if (c == NULL && alloc) {
+        c = calloc(ABT_IO_PREALLOC_FD_CHUNK, sizeof(*c));
+        if (c == NULL) return NULL;
+        if (!__atomic_compare_exchange_n(chunk, &none, c, 0,
+                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            free(c);
+            c = __atomic_load_n(chunk, __ATOMIC_ACQUIRE);
+        }
+    }
+    return c != NULL ? &c[fd % ABT_IO_PREALLOC_FD_CHUNK] : NULL;
+}
+
+/* called before a write is issued so that the extension, if any, is queued
+ * ahead of the write that needs it */
+static void prealloc_note_write(struct abt_io_instance *aid, int fd, off_t write_end)
+{
+    struct abt_io_prealloc *p;
+    struct abt_io_prealloc_state *state;
+    int rc;
+
+    if (__atomic_load_n(&aid->prealloc_count, __ATOMIC_RELAXED) == 0)
+        return;
+
+    p = prealloc_fd_slot(aid, fd, 0);
+    if (p == NULL || !prealloc_claim(p, write_end)) return;
+
+    state = malloc(sizeof(*state));
+    rc = ABT_ERR_MEM;
+    if (state != NULL) {
+        state->aid = aid;
+        state->p = p;
+        state->write_end = write_end;
+        rc = submit_internal(aid, select_target(aid, fd, NULL),
+                abt_io_prealloc_fn, state);
+    }
+    if (rc != ABT_SUCCESS) {
+        free(state);
+        __atomic_store_n(&p->busy, 0, __ATOMIC_RELEASE);
+    }
+    return;
+}
+
+/* disables the policy for fd, if any, once no extension is in flight.
+ * Returns 1 if there was one. */
+static int prealloc_remove(struct abt_io_instance *aid, int fd)
+{
+    struct abt_io_prealloc *p;
+
+    if (__atomic_load_n(&aid->prealloc_count, __ATOMIC_RELAXED) == 0)
+        return 0;
+    p = prealloc_fd_slot(aid, fd, 0);
+    if (p == NULL) return 0;
+
+    ABT_mutex_lock(aid->prealloc_mutex);
+    if (!p->enabled) {
+        ABT_mutex_unlock(aid->prealloc_mutex);
+        return 0;
+    }
+    /* holding the claim keeps writers from starting another extension
+     * while the policy is cleared */
+    while (__atomic_exchange_n(&p->busy, 1, __ATOMIC_ACQUIRE))
+        ABT_thread_yield();
+    __atomic_store_n(&p->chunk, 0, __ATOMIC_RELEASE);
+    p->enabled = 0;
+    __atomic_store_n(&p->busy, 0, __ATOMIC_RELEASE);
+    __atomic_fetch_sub(&aid->prealloc_count, 1, __ATOMIC_RELAXED);
+    ABT_mutex_unlock(aid->prealloc_mutex);
+
+    return 1;
+}
+
+struct abt_io_open_state
+{
+    int *ret;
+    const char *pathname;
+    int flags;
+    mode_t mode;
+    struct abt_io_completion *completion;
+};
+
+static void abt_io_open_fn(void *foo)
+{
+    struct abt_io_open_state *state = foo;
+
+    *state->ret = open(state->pathname, state->flags, state->mode);
+    if(*state->ret < 0)
+        *state->ret = -errno;
+
+    completion_signal(state->completion);
+    return;
+}
+
+static int issue_open(struct abt_io_target t, abt_io_op_t *op, const char* pathname, int flags, mode_t mode, int *ret)
+{
+    struct abt_io_open_state state;
+    struct abt_io_open_state *pstate = NULL;
+    struct abt_io_completion completion;
+    int rc;
+
+    if (op == NULL) pstate = &state;
+    else
+    {
+        pstate = op_state_alloc(op, sizeof(*pstate));
+        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+    }
+
+    *ret = -ENOSYS;
+    pstate->ret = ret;
+    pstate->pathname = pathname;
+    pstate->flags = flags;
+    pstate->mode = mode;
+    pstate->completion = op != NULL ? &op->c : &completion;
+    completion_init(pstate->completion, &t.aid->waiters, t.home);
+
+    rc = submit(t, abt_io_open_fn, pstate);
+    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+
+    if (op == NULL) {
+        completion_wait(pstate->completion);
+    }
+    else {
+        op->state = pstate;
+        op->free_fn = free;
+    }
+
+    return 0;
+err:
+    if (op != NULL) op_state_free(op, pstate);
+    return -1;
+}
+
+int abt_io_open(abt_io_instance_id aid, const char* pathname, int flags, mode_t mode)
+{
+    int ret;
+    issue_open(select_target(aid, -1, NULL), NULL, pathname, flags, mode, &ret);
+    return ret;
+}
+
+abt_io_op_t* abt_io_open_nb(abt_io_instance_id aid, const char* pathname, int flags, mode_t mode, int *ret)
+{
+    abt_io_op_t *op;
+    int iret;
+
+    op = op_alloc(aid);
+    if (op == NULL) return NULL;
+
+    iret = issue_open(select_target(aid, -1, NULL), op, pathname, flags, mode, ret);
+    if (iret != 0) { op_release(op); return NULL; }
+    else return op;
+}
+
+/* the nowait cache slot for fd, or NULL if fd is out of range or its chunk
+ * could not be allocated */
+static char* nowait_fd_slot(struct abt_io_instance *aid, int fd, int alloc)
+{
+    char **chunk;
+    char *c;
+    char *none = NULL;
+
+    if (fd < 0 || fd >= ABT_IO_NOWAIT_FD_CHUNK * ABT_IO_NOWAIT_FD_CHUNKS)
+        return NULL;
+    chunk = &aid->nowait_fd[fd / ABT_IO_NOWAIT_FD_CHUNK];
+    c = __atomic_load_n(chunk, __ATOMIC_ACQUIRE);
+    if (c == NULL && alloc) {
+        c = calloc(ABT_IO_NOWAIT_FD_CHUNK, sizeof(*c));
+        if (c == NULL) return NULL;
+        if (!__atomic_compare_exchange_n(chunk, &none, c, 0,
+                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            free(c);
+            c = __atomic_load_n(chunk, __ATOMIC_ACQUIRE);
+        }
+    }
+    return c != NULL ? &c[fd % ABT_IO_NOWAIT_FD_CHUNK] : NULL;
+}
+
+/* forgets what was learned about a descriptor that is being closed.  There
+ * is no cheap way to notice a plain close() and reuse of the number, which
+ * is why the inline_nowait docs require fds to be closed through abt-io. */
+static void nowait_fd_forget(struct abt_io_instance *aid, int fd)
+{
+    char *slot;
+
+    slot = nowait_fd_slot(aid, fd, 0);
+    if (slot != NULL)
+        __atomic_store_n(slot, ABT_IO_NOWAIT_FD_UNKNOWN, __ATOMIC_RELAXED);
+}
+
+/* Attempts a read or write inline on the caller's xstream with RWF_NOWAIT,
+ * so that page cache hits do not pay for a round trip through the backing
+ * pool.  Returns the number of bytes transferred, which may be short (0 for
+ * a read at EOF), or -1 if the operation must be offloaded as a whole.
+ * O_DIRECT fds are skipped, since RWF_NOWAIT does not keep direct I/O from
+ * blocking on the device, and so are reads or writes on an fd whose file
+ * system has rejected the flag for that direction.
+ */
+static ssize_t try_nowait(struct abt_io_instance *aid, int write, int fd,
+        void *buf, size_t count, off_t offset)
+{
+#ifdef HAVE_PREADV2
+    struct iovec iov;
+    ssize_t ret;
+    char *slot;
+    char v = ABT_IO_NOWAIT_FD_UNKNOWN;
+    char unknown = ABT_IO_NOWAIT_FD_UNKNOWN;
+    int fl;
+
+    if (!__atomic_load_n(&aid->inline_nowait, __ATOMIC_RELAXED) || count == 0)
+        return -1;
+
+    /* buffered writes are rejected on more file systems than reads, so
+     * each direction is given up on separately */
+    slot = nowait_fd_slot(aid, fd, 1);
+    if (slot != NULL) v = __atomic_load_n(slot, __ATOMIC_RELAXED);
+    if (v & (ABT_IO_NOWAIT_FD_SKIP |
+                (write ? ABT_IO_NOWAIT_FD_NO_WRITE : ABT_IO_NOWAIT_FD_NO_READ)))
+        return -1;
+    if (v == ABT_IO_NOWAIT_FD_UNKNOWN) {
+        fl = fcntl(fd, F_GETFL);
+        if (fl < 0) return -1;
+        v = (fl & O_DIRECT) ? ABT_IO_NOWAIT_FD_SKIP : ABT_IO_NOWAIT_FD_TRY;
+        /* do not overwrite a direction another caller just gave up on */
+        if (slot != NULL)
+            __atomic_compare_exchange_n(slot, &unknown, v, 0,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        if (v == ABT_IO_NOWAIT_FD_SKIP) return -1;
+    }
+
+    iov.iov_base = buf;
+    iov.iov_len = count;
+    if (write)
+        ret = pwritev2(fd, &iov, 1, offset, RWF_NOWAIT);
+    else
+        ret = preadv2(fd, &iov, 1, offset, RWF_NOWAIT);
+
+    if (ret > 0 || (ret == 0 && !write)) return ret;
+    if (ret < 0 && errno == ENOSYS)
+        __atomic_store_n(&aid->inline_nowait, 0, __ATOMIC_RELAXED);
+    else if (ret < 0 && (errno == EOPNOTSUPP || errno == EINVAL) && slot != NULL)
+        __atomic_fetch_or(slot, write ? ABT_IO_NOWAIT_FD_NO_WRITE
+                                      : ABT_IO_NOWAIT_FD_NO_READ, __ATOMIC_RELAXED);
+#endif
+    return -1;
+}
+
+/* sets up an op for a non-blocking call that already completed inline */
+static int complete_inline(abt_io_op_t *op)
+{
+    op->c.state = ABT_IO_COMPLETION_DONE;
+    op->state = NULL;
+    op->free_fn = free;
+    return 0;
+}
+
+struct abt_io_pread_state
+{
+    ssize_t *ret;
+    ssize_t done;   /* bytes already transferred inline */
+    int fd;
+    void *buf;
+    size_t count;
+    off_t offset;
+    struct abt_io_completion *completion;
+};
+
+static void abt_io_pread_fn(void *foo)
+{
+    struct abt_io_pread_state *state = foo;
+
+    *state->ret = pread(state->fd, state->buf, state->count, state->offset);
+    if(*state->ret < 0)
+        *state->ret = state->done ? state->done : -errno;
+    else
+        *state->ret += state->done;
+
+    completion_signal(state->completion);
+    return;
+}
+
+static int issue_pread(struct abt_io_target t, abt_io_op_t *op, int fd, void *buf,
+        size_t count, off_t offset, ssize_t done, ssize_t *ret)
+{
+    struct abt_io_pread_state state;
+    struct abt_io_pread_state *pstate = NULL;
+    struct abt_io_completion completion;
+    int rc;
+
+    if (op == NULL) pstate = &state;
+    else
+    {
+        pstate = op_state_alloc(op, sizeof(*pstate));
+        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+    }
+
+    *ret = -ENOSYS;
+    pstate->ret = ret;
+    pstate->done = done;
+    pstate->fd = fd;
+    pstate->buf = buf;
+    pstate->count = count;
+    pstate->offset = offset;
+    pstate->completion = op != NULL ? &op->c : &completion;
+    completion_init(pstate->completion, &t.aid->waiters, t.home);
+
+    rc = submit(t, abt_io_pread_fn, pstate);
+    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+
+    if (op == NULL) {
+        completion_wait(pstate->completion);
+    }
+    else {
+        op->state = pstate;
+        op->free_fn = free;
+    }
+
+    return 0;
+err:
+    if (op != NULL) op_state_free(op, pstate);
+    return -1;
+}
+
+ssize_t abt_io_pread(abt_io_instance_id aid, int fd, void *buf,
+        size_t count, off_t offset)
+{
+    ssize_t ret = -1;
+    ssize_t done;
+
+    done = try_nowait(aid, 0, fd, buf, count, offset);
+    if (done == (ssize_t)count || done == 0) return done;
+    if (done < 0) done = 0;
+
+    issue_pread(select_target(aid, fd, buf), NULL, fd, (char*)buf + done,
+            count - done, offset + done, done, &ret);
+    return ret;
+}
+
+abt_io_op_t* abt_io_pread_nb(abt_io_instance_id aid, int fd, void *buf,
+        size_t count, off_t offset, ssize_t *ret)
+{
+    abt_io_op_t *op;
+    ssize_t done;
+    int iret;
+
+    op = op_alloc(aid);
+    if (op == NULL) return NULL;
+
+    done = try_nowait(aid, 0, fd, buf, count, offset);
+    if (done == (ssize_t)count || done == 0) {
+        *ret = done;
+        iret = complete_inline(op);
+    }
+    else {
+        if (done < 0) done = 0;
+        iret = issue_pread(select_target(aid, fd, buf), op, fd, (char*)buf + done,
+                count - done, offset + done, done, ret);
+    }
+    if (iret != 0) { op_release(op); return NULL; }
+    else return op;
+}
+
+
+struct abt_io_pwrite_state
+{
+    ssize_t *ret;
+    ssize_t done;   /* bytes already transferred inline */
+    int fd;
+    const void *buf;
+    size_t count;
+    off_t offset;
+    struct abt_io_completion *completion;
+};
+
+static void abt_io_pwrite_fn(void *foo)
+{
+    struct abt_io_pwrite_state *state = foo;
+
+    *state->ret = pwrite(state->fd, state->buf, state->count, state->offset);
+    if(*state->ret < 0)
+        *state->ret = state->done ? state->done : -errno;
+    else
+        *state->ret += state->done;
+
+    completion_signal(state->completion);
+    return;
+}
+
+static int issue_pwrite(struct abt_io_target t, abt_io_op_t *op, int fd, const void *buf,
+        size_t count, off_t offset, ssize_t done, ssize_t *ret)
+{
+    struct abt_io_pwrite_state state;
+    struct abt_io_pwrite_state *pstate = NULL;
+    struct abt_io_completion completion;
+    int rc;
+
+    if (op == NULL) pstate = &state;
+    else
+    {
+        pstate = op_state_alloc(op, sizeof(*pstate));
+        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+    }
+
+    *ret = -ENOSYS;
+    pstate->ret = ret;
+    pstate->done = done;
+    pstate->fd = fd;
+    pstate->buf = buf;
+    pstate->count = count;
+    pstate->offset = offset;
+    pstate->completion = op != NULL ? &op->c : &completion;
+    completion_init(pstate->completion, &t.aid->waiters, t.home);
+
+    rc = submit(t, abt_io_pwrite_fn, pstate);
+    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+
+    if (op == NULL) {
+        completion_wait(pstate->completion);
+    }
+    else {
+        op->state = pstate;
+        op->free_fn = free;
+    }
+
+    return 0;
+err:
+    if (op != NULL) op_state_free(op, pstate);
+    return -1;
+}
+
+ssize_t abt_io_pwrite(abt_io_instance_id aid, int fd, const void *buf,
+        size_t count, off_t offset)
+{
+    ssize_t ret = -1;
+    ssize_t done;
+
+    prealloc_note_write(aid, fd, offset + count);
+
+    done = try_nowait(aid, 1, fd, (void*)buf, count, offset);
+    if (done == (ssize_t)count) return done;
+    if (done < 0) done = 0;
+
+    issue_pwrite(select_target(aid, fd, buf), NULL, fd, (const char*)buf + done,
+            count - done, offset + done, done, &ret);
+    return ret;
+}
+
+abt_io_op_t* abt_io_pwrite_nb(abt_io_instance_id aid, int fd, const void *buf,
+        size_t count, off_t offset, ssize_t *ret)
+{
+    abt_io_op_t *op;
+    ssize_t done;
+    int iret;
+
+    op = op_alloc(aid);
+    if (op == NULL) return NULL;
+
+    prealloc_note_write(aid, fd, offset + count);
+
+    done = try_nowait(aid, 1, fd, (void*)buf, count, offset);
+    if (done == (ssize_t)count) {
+        *ret = done;
+        iret = complete_inline(op);
+    }
+    else {
+        if (done < 0) done = 0;
+        iret = issue_pwrite(select_target(aid, fd, buf), op, fd,
+                (const char*)buf + done, count - done, offset + done, done, ret);
+    }
+    if (iret != 0) { op_release(op); return NULL; }
+    else return op;
+}
+
+/* A file created ahead of demand: named for a mkostemp() template, or an
+ * unnamed O_TMPFILE one for a directory.
+ */
+struct abt_io_tmp_file
+{
+    struct abt_io_tmp_file *next;
+    int fd;
+    char name[];
+};
+
+struct abt_io_tmp_pool
+{
+    struct abt_io_tmp_pool *next;
+    struct abt_io_instance *aid;
+    int flags;
+    int target;     /* files to keep ready */
+    int count;
+    int busy;       /* a refill is queued or running */
+    int disabled;
+    struct abt_io_tmp_file *files;
+    size_t len;
+    char path[];    /* template, or directory with O_TMPFILE */
+};
+
+static void abt_io_tmp_refill_fn(void *foo);
+
+/* drops the refill claim on a pool and wakes a disable waiting for it */
+static void tmp_pool_idle(struct abt_io_instance *aid,
+        struct abt_io_tmp_pool *pool)
+{
+    ABT_mutex_spinlock(aid->tmp_pool_mutex);
+    pool->busy = 0;
+    ABT_cond_broadcast(aid->tmp_pool_cond);
+    ABT_mutex_unlock(aid->tmp_pool_mutex);
+}
+
+static void tmp_file_discard(struct abt_io_tmp_file *f)
+{
+    if (f->name[0] != '\0') unlink(f->name);
+    close(f->fd);
+    free(f);
+}
+
+/* creates one file per task so that refills queue behind other operations
+ * instead of holding a backing xstream for the whole pool */
+static void abt_io_tmp_refill_fn(void *foo)
+{
+    struct abt_io_tmp_pool *pool = foo;
+    struct abt_io_instance *aid = pool->aid;
+    struct abt_io_tmp_file *f;
+    int more = 0;
+
+    f = malloc(sizeof(*f) + pool->len + 1);
+    if (f != NULL) {
+#ifdef O_TMPFILE
+        if ((pool->flags & O_TMPFILE) == O_TMPFILE) {
+            f->name[0] = '\0';
+            f->fd = open(pool->path, pool->flags, 0600);
+        }
+        else
+#endif
+        {
+            memcpy(f->name, pool->path, pool->len + 1);
+#ifdef HAVE_MKOSTEMP
+            f->fd = mkostemp(f->name, pool->flags);
+#else
+            f->fd = mkstemp(f->name);
+#endif
+        }
+        if (f->fd < 0) { free(f); f = NULL; }
+    }
+
+    /* busy is cleared under the lock so that a take cannot see it set
+     * after the last refill has decided to stop; a failure stops the
+     * refill until the next file is taken.  Once busy is clear the pool
+     * may be freed by a disable, so it is not touched again. */
+    ABT_mutex_spinlock(aid->tmp_pool_mutex);
+    if (f != NULL && !pool->disabled) {
+        f->next = pool->files;
+        pool->files = f;
+        pool->count++;
+        f = NULL;
+        more = pool->count < pool->target;
+    }
+    if (!more) {
+        pool->busy = 0;
+        ABT_cond_broadcast(aid->tmp_pool_cond);
+    }
+    ABT_mutex_unlock(aid->tmp_pool_mutex);
+
+    if (f != NULL) tmp_file_discard(f);
+    if (more && submit_internal(aid, select_target(aid, -1, NULL),
+                abt_io_tmp_refill_fn, pool) != ABT_SUCCESS)
+        tmp_pool_idle(aid, pool);
+    internal_done(aid);
+    return;
+}
+
+/* takes a ready file from the pool for path and flags, if there is one,
+ * and queues a refill */
+static struct abt_io_tmp_file* tmp_pool_take(struct abt_io_instance *aid,
+        const char *path, int flags)
+{
+    struct abt_io_tmp_pool *pool;
+    struct abt_io_tmp_file *f = NULL;
+    int refill = 0;
+
+    if (__atomic_load_n(&aid->tmp_pool_count, __ATOMIC_RELAXED) == 0)
+        return NULL;
+
+    ABT_mutex_spinlock(aid->tmp_pool_mutex);
+    for (pool = aid->tmp_pools; pool != NULL; pool = pool->next)
+        if (pool->flags == flags && !strcmp(pool->path, path)) break;
+    if (pool != NULL) {
+        f = pool->files;
+        if (f != NULL) {
+            pool->files = f->next;
+            pool->count--;
+        }
+        if (!pool->busy) refill = pool->busy = 1;
+    }
+    ABT_mutex_unlock(aid->tmp_pool_mutex);
+
+    if (refill && submit_internal(aid, select_target(aid, -1, NULL),
+                abt_io_tmp_refill_fn, pool) != ABT_SUCCESS)
+        tmp_pool_idle(aid, pool);
+    return f;
+}
+
+static void tmp_pool_free(struct abt_io_tmp_pool *pool)
+{
+    struct abt_io_tmp_file *f;
+
+    while ((f = pool->files) != NULL) {
+        pool->files = f->next;
+        tmp_file_discard(f);
+    }
+    free(pool);
+}
+
+/* keeps refills from queueing more work once finalize has started */
+static void tmp_pools_stop(struct abt_io_instance *aid)
+{
+    struct abt_io_tmp_pool *pool;
+
+    ABT_mutex_spinlock(aid->tmp_pool_mutex);
+    for (pool = aid->tmp_pools; pool != NULL; pool = pool->next)
+        pool->disabled = 1;
+    ABT_mutex_unlock(aid->tmp_pool_mutex);
+}
+
+/* discards the pools left at finalize */
+static void tmp_pools_free(struct abt_io_instance *aid)
+{
+    struct abt_io_tmp_pool *pool;
+
+    while ((pool = aid->tmp_pools) != NULL) {
+        aid->tmp_pools = pool->next;
+        tmp_pool_free(pool);
+    }
+}
+
+int abt_io_tmp_pool_enable(abt_io_instance_id aid, const char *path,
+        int flags, int count)
+{
+    struct abt_io_tmp_pool *pool;
+    struct abt_io_tmp_pool *p;
+    size_t len = strlen(path);
+    int tmpfile = 0;
+
+#ifdef O_TMPFILE
+    tmpfile = (flags & O_TMPFILE) == O_TMPFILE;
+#endif
+    if (count <= 0) return -EINVAL;
+    if (!tmpfile && (len < 6 || strcmp(path + len - 6, "XXXXXX")))
+        return -EINVAL;
+
+    pool = calloc(1, sizeof(*pool) + len + 1);
+    if (pool == NULL) return -ENOMEM;
+    pool->aid = aid;
+    pool->flags = flags;
+    pool->target = count;
+    pool->len = len;
+    memcpy(pool->path, path, len + 1);
+
+    ABT_mutex_spinlock(aid->tmp_pool_mutex);
+    for (p = aid->tmp_pools; p != NULL; p = p->next) {
+        if (!strcmp(p->path, path)) {
+            ABT_mutex_unlock(aid->tmp_pool_mutex);
+            free(pool);
+            return -EEXIST;
+        }
+    }
+    pool->next = aid->tmp_pools;
+    aid->tmp_pools = pool;
+    __atomic_fetch_add(&aid->tmp_pool_count, 1, __ATOMIC_RELAXED);
+    pool->busy = 1;
+    ABT_mutex_unlock(aid->tmp_pool_mutex);
+
+    if (submit_internal(aid, select_target(aid, -1, NULL),
+                abt_io_tmp_refill_fn, pool) != ABT_SUCCESS)
+        tmp_pool_idle(aid, pool);
+    return 0;
+}
+
+int abt_io_tmp_pool_disable(abt_io_instance_id aid, const char *path)
+{
+    struct abt_io_tmp_pool **pp;
+    struct abt_io_tmp_pool *pool = NULL;
+
+    ABT_mutex_lock(aid->tmp_pool_mutex);
+    for (pp = &aid->tmp_pools; *pp != NULL; pp = &(*pp)->next) {
+        if (!strcmp((*pp)->path, path)) {
+            pool = *pp;
+            *pp = pool->next;
+            pool->disabled = 1;
+            __atomic_fetch_sub(&aid->tmp_pool_count, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    /* a refill in flight discards its file and lets go of the pool */
+    while (pool != NULL && pool->busy)
+        ABT_cond_wait(aid->tmp_pool_cond, aid->tmp_pool_mutex);
+    ABT_mutex_unlock(aid->tmp_pool_mutex);
+    if (pool == NULL) return -ENOENT;
+
+    tmp_pool_free(pool);
+    return 0;
+}
+
+struct abt_io_mkostemp_state
+{
+    int *ret;
+    char *template;
+    int flags;
+    struct abt_io_completion *completion;
+};
+
+static void abt_io_mkostemp_fn(void *foo)
+{
+    struct abt_io_mkostemp_state *state = foo;
+
+#ifdef HAVE_MKOSTEMP
+    *state->ret = mkostemp(state->template, state->flags);
+#else
+    *state->ret = mkstemp(state->template);
+#endif
+    if(*state->ret < 0)
+        *state->ret = -errno;
+
+    completion_signal(state->completion);
+    return;
+}
+
+static int issue_mkostemp(struct abt_io_target t, abt_io_op_t *op, char* template, int flags, int *ret)
+{
+    struct abt_io_mkostemp_state state;
+    struct abt_io_mkostemp_state *pstate = NULL;
+    struct abt_io_completion completion;
+    int rc;
+
+    if (op == NULL) pstate = &state;
+    else
+    {
+        pstate = op_state_alloc(op, sizeof(*pstate));
+        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+    }
+
+    *ret = -ENOSYS;
+    pstate->ret = ret;
+    pstate->template = template;
+    pstate->flags = flags;
+    pstate->completion = op != NULL ? &op->c : &completion;
+    completion_init(pstate->completion, &t.aid->waiters, t.home);
+
+    rc = submit(t, abt_io_mkostemp_fn, pstate);
+    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+
+    if (op == NULL) {
+        completion_wait(pstate->completion);
+    }
+    else {
+        op->state = pstate;
+        op->free_fn = free;
+    }
+
+    return 0;
+err:
+    if (op != NULL) op_state_free(op, pstate);
+    return -1;
+}
+
+/* hands out a pooled file for template, filling in its name */
+static int mkostemp_pooled(struct abt_io_instance *aid, char *template, int flags)
+{
+    struct abt_io_tmp_file *f;
+    int fd;
+
+    f = tmp_pool_take(aid, template, flags);
+    if (f == NULL) return -1;
+    memcpy(template, f->name, strlen(f->name));
+    fd = f->fd;
+    free(f);
+    return fd;
+}
+
+int abt_io_mkostemp(abt_io_instance_id aid, char *template, int flags)
+{
+    int ret;
+
+    ret = mkostemp_pooled(aid, template, flags);
+    if (ret >= 0) return ret;
+    issue_mkostemp(select_target(aid, -1, NULL), NULL, template, flags, &ret);
+    return ret;
+}
+
+abt_io_op_t* abt_io_mkostemp_nb(abt_io_instance_id aid, char *template, int flags, int *ret)
+{
+    abt_io_op_t *op;
+    int iret;
+
+    op = op_alloc(aid);
+    if (op == NULL) return NULL;
+
+    *ret = mkostemp_pooled(aid, template, flags);
+    if (*ret >= 0) {
+        completion_init(&op->c, &aid->waiters, ABT_POOL_NULL);
+        completion_signal(&op->c);
+        op->state = NULL;
+        op->free_fn = free;
+        return op;
+    }
+
+    iret = issue_mkostemp(select_target(aid, -1, NULL), op, template, flags, ret);
+    if (iret != 0) { op_release(op); return NULL; }
+    else return op;
+}
+
+int abt_io_tmpfile(abt_io_instance_id aid, const char *dir, int flags)
+{
+#ifdef O_TMPFILE
+    struct abt_io_tmp_file *f;
+    int fd;
+
+    f = tmp_pool_take(aid, dir, flags | O_TMPFILE);
+    if (f == NULL) return abt_io_open(aid, dir, flags | O_TMPFILE, 0600);
+    fd = f->fd;
+    free(f);
+    return fd;
+#else
+    return -ENOSYS;
+#endif
+}
+
+struct abt_io_publish_state
+{
+    int *ret;
+    int fd;
+    const char *pathname;
+    struct abt_io_completion *completion;
+};
+
+static void abt_io_publish_fn(void *foo)
+{
+    struct abt_io_publish_state *state = foo;
+    char proc[32];
+
+    /* linkat() with AT_EMPTY_PATH needs CAP_DAC_READ_SEARCH, the /proc
+     * link does not */
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", state->fd);
+    *state->ret = linkat(AT_FDCWD, proc, AT_FDCWD, state->pathname,
+            AT_SYMLINK_FOLLOW);
+    if(*state->ret < 0)
+        *state->ret = -errno;
+
+    completion_signal(state->completion);
+    return;
+}
+
+static int issue_publish(struct abt_io_target t, abt_io_op_t *op, int fd,
+        const char *pathname, int *ret)
+{
+    struct abt_io_publish_state state;
+    struct abt_io_publish_state *pstate = NULL;
+    struct abt_io_completion completion;
+    int rc;
+
+    if (op == NULL) pstate = &state;
+    else
+    {
+        pstate = op_state_alloc(op, sizeof(*pstate));
+        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+    }
+
+    *ret = -ENOSYS;
+    pstate->ret = ret;
+    pstate->fd = fd;
+    pstate->pathname = pathname;
+    pstate->completion = op != NULL ? &op->c : &completion;
+    completion_init(pstate->completion, &t.aid->waiters, t.home);
+
+    rc = submit(t, abt_io_publish_fn, pstate);
+    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+
+    if (op == NULL) {
+        completion_wait(pstate->completion);
+    }
+    else {
+        op->state = pstate;
+        op->free_fn = free;
+    }
+
+    return 0;
+err:
+    if (op != NULL) op_state_free(op, pstate);
+    return -1;
+}
+
+int abt_io_tmpfile_publish(abt_io_instance_id aid, int fd, const char *pathname)
+{
+    int ret = -1;
+    issue_publish(select_target(aid, fd, NULL), NULL, fd, pathname, &ret);
+    return ret;
+}
+
+abt_io_op_t* abt_io_tmpfile_publish_nb(abt_io_instance_id aid, int fd,
+        const char *pathname, int *ret)
+{
+    abt_io_op_t *op;
+    int iret;
+
+    op = op_alloc(aid);
+    if (op == NULL) return NULL;
+
+    iret = issue_publish(select_target(aid, fd, NULL), op, fd, pathname, ret);
+    if (iret != 0) { op_release(op); return NULL; }
+    else return op;
+}
+
+struct abt_io_unlink_state
+{
+    int *ret;
+    const char *pathname;
+    struct abt_io_completion *completion;
+};
+
+static void abt_io_unlink_fn(void *foo)
+{
+    struct abt_io_unlink_state *state = foo;
+
+    *state->ret = unlink(state->pathname);
+    if(*state->ret < 0)
+        *state->ret = -errno;
+
+    completion_signal(state->completion);
+    return;
+}
+
+static int issue_unlink(struct abt_io_target t, abt_io_op_t *op, const char* pathname, int *ret)
+{
+    struct abt_io_unlink_state state;
+    struct abt_io_unlink_state *pstate = NULL;
+    struct abt_io_completion completion;
+    int rc;
+
+    if (op == NULL) pstate = &state;
+    else
+    {
+        pstate = op_state_alloc(op, sizeof(*pstate));
+        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+    }
+
+    *ret = -ENOSYS;
+    pstate->ret = ret;
+    pstate->pathname = pathname;
+    pstate->completion = op != NULL ? &op->c : &completion;
+    completion_init(pstate->completion, &t.aid->waiters, t.home);
+
+    rc = submit(t, abt_io_unlink_fn, pstate);
+    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+
+    if (op == NULL) {
+        completion_wait(pstate->completion);
+    }
+    else {
+        op->state = pstate;
+        op->free_fn = free;
+    }
+
+    return 0;
+err:
+    if (op != NULL) op_state_free(op, pstate);
+    return -1;
+}
+
+
+int abt_io_unlink(abt_io_instance_id aid, const char *pathname)
+{
+    int ret = -1;
+    issue_unlink(select_target(aid, -1, NULL), NULL, pathname, &ret);
+    return ret;
+}
+
+abt_io_op_t* abt_io_unlink_nb(abt_io_instance_id aid, const char *pathname, int *ret)
+{
+    abt_io_op_t *op;
+    int iret;
+
+    op = op_alloc(aid);
+    if (op == NULL) return NULL;
+
+    iret = issue_unlink(select_target(aid, -1, NULL), op, pathname, ret);
+    if (iret != 0) { op_release(op); return NULL; }
+    else return op;
+}
+
+struct abt_io_close_state
+{
+    int *ret;
+    int fd;
+    int trim;
+    struct abt_io_completion *completion;
+};
+
+static void abt_io_close_fn(void *foo)
+{
+    struct abt_io_close_state *state = foo;
+
+    if (state->trim) prealloc_trim(state->fd);
+    *state->ret = close(state->fd);
+    if(*state->ret < 0)
+        *state->ret = -errno;
+
+    completion_signal(state->completion);
+    return;
+}
+
+static int issue_close(struct abt_io_target t, abt_io_op_t *op, int fd, int trim, int *ret)
+{
+    struct abt_io_close_state state;
+    struct abt_io_close_state *pstate = NULL;
+    struct abt_io_completion completion;
+    int rc;
+
+    if (op == NULL) pstate = &state;
+    else {
+        pstate = op_state_alloc(op, sizeof(*pstate));
+        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+    }
+
+    *ret = -ENOSYS;
+    pstate->ret = ret;
+    pstate->fd = fd;
+    pstate->trim = trim;
+    pstate->completion = op != NULL ? &op->c : &completion;
+    completion_init(pstate->completion, &t.aid->waiters, t.home);
+
+    rc = submit(t, abt_io_close_fn, pstate);
+    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+
+    if (op == NULL) {
+        completion_wait(pstate->completion);
+    }
+    else {
+        op->state = pstate;
+        op->free_fn = free;
+    }
+
+    return 0;
+err:
+    if (op != NULL) op_state_free(op, pstate);
+    return -1;
+}
+
+int abt_io_close(abt_io_instance_id aid, int fd)
+{
+    int ret = -1;
+    int trim;
+
+    trim = prealloc_remove(aid, fd);
+    issue_close(select_target(aid, fd, NULL), NULL, fd, trim, &ret);
+    numa_fd_forget(aid, fd);
+    nowait_fd_forget(aid, fd);
+    return ret;
+}
+
+abt_io_op_t* abt_io_close_nb(abt_io_instance_id aid, int fd, int *ret)
+{
+    abt_io_op_t *op;
+    int iret;
+    int trim;
+
+    op = op_alloc(aid);
+    if (op == NULL) return NULL;
+
+    trim = prealloc_remove(aid, fd);
+    iret = issue_close(select_target(aid, fd, NULL), op, fd, trim, ret);
+    if (iret != 0) { op_release(op); return NULL; }
+    numa_fd_forget(aid, fd);
+    nowait_fd_forget(aid, fd);
+    return op;
+}
+
+struct abt_io_fallocate_state
+{
+    int *ret;
+    int fd;
+    int mode;
+    off_t offset;
+    off_t len;
+    struct abt_io_completion *completion;
+};
+
+static void abt_io_fallocate_fn(void *foo)
+{
+    struct abt_io_fallocate_state *state = foo;
+
+#ifdef HAVE_FALLOCATE
+    *state->ret = fallocate(state->fd, state->mode, state->offset, state->len);
+    if(*state->ret < 0)
+        *state->ret = -errno;
+#else
+    *state->ret = -ENOSYS;
+#endif
+
+    completion_signal(state->completion);
+    return;
+}
+
+static int issue_fallocate(struct abt_io_target t, abt_io_op_t *op, int fd, int mode,
+        off_t offset, off_t len, int *ret)
+{
+    struct abt_io_fallocate_state state;
+    struct abt_io_fallocate_state *pstate = NULL;
+    struct abt_io_completion completion;
+    int rc;
+
+    if (op == NULL) pstate = &state;
+    else
+    {
+        pstate = op_state_alloc(op, sizeof(*pstate));
+        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+    }
+
+    *ret = -ENOSYS;
+    pstate->ret = ret;
+    pstate->fd = fd;
+    pstate->mode = mode;
+    pstate->offset = offset;
+    pstate->len = len;
+    pstate->completion = op != NULL ? &op->c : &completion;
+    completion_init(pstate->completion, &t.aid->waiters, t.home);
+
+    rc = submit(t, abt_io_fallocate_fn, pstate);
+    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+
+    if (op == NULL) {
+        completion_wait(pstate->completion);
+    }
+    else {
+        op->state = pstate;
+        op->free_fn = free;
+    }
+
+    return 0;
+err:
+    if (op != NULL) op_state_free(op, pstate);
+    return -1;
+}
+
+int abt_io_fallocate(abt_io_instance_id aid, int fd, int mode, off_t offset,
+        off_t len)
+{
+    int ret = -1;
+    issue_fallocate(select_target(aid, fd, NULL), NULL, fd, mode, offset, len, &ret);
+    return ret;
+}
+
+abt_io_op_t* abt_io_fallocate_nb(abt_io_instance_id aid, int fd, int mode,
+        off_t offset, off_t len, int *ret)
+{
+    abt_io_op_t *op;
+    int iret;
+
+    op = op_alloc(aid);
+    if (op == NULL) return NULL;
+
+    iret = issue_fallocate(select_target(aid, fd, NULL), op, fd, mode, offset, len, ret);
+    if (iret != 0) { op_release(op); return NULL; }
+    else return op;
+}
+
+struct abt_io_ftruncate_state
+{
+    int *ret;
+    int fd;
+    off_t length;   /* -1 releases preallocated space past EOF instead */
+    struct abt_io_completion *completion;
+};
+
+static void abt_io_ftruncate_fn(void *foo)
+{
+    struct abt_io_ftruncate_state *state = foo;
+
+    if (state->length < 0)
+        *state->ret = prealloc_trim(state->fd);
+    else {
+        *state->ret = ftruncate(state->fd, state->length);
+        if(*state->ret < 0)
+            *state->ret = -errno;
+    }
+
+    completion_signal(state->completion);
+    return;
+}
+
+static int issue_ftruncate(struct abt_io_target t, abt_io_op_t *op, int fd,
+        off_t length, int *ret)
+{
+    struct abt_io_ftruncate_state state;
+    struct abt_io_ftruncate_state *pstate = NULL;
+    struct abt_io_completion completion;
+    int rc;
+
+    if (op == NULL) pstate = &state;
+    else
+    {
+        pstate = op_state_alloc(op, sizeof(*pstate));
+        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+    }
+
+    *ret = -ENOSYS;
+    pstate->ret = ret;
+    pstate->fd = fd;
+    pstate->length = length;
+    pstate->completion = op != NULL ? &op->c : &completion;
+    completion_init(pstate->completion, &t.aid->waiters, t.home);
+
+    rc = submit(t, abt_io_ftruncate_fn, pstate);
+    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+
+    if (op == NULL) {
+        completion_wait(pstate->completion);
+    }
+    else {
+        op->state = pstate;
+        op->free_fn = free;
+    }
+
+    return 0;
+err:
+    if (op != NULL) op_state_free(op, pstate);
+    return -1;
+}
+
+int abt_io_ftruncate(abt_io_instance_id aid, int fd, off_t length)
+{
+    int ret = -1;
+    if (length < 0) return -EINVAL;
+    issue_ftruncate(select_target(aid, fd, NULL), NULL, fd, length, &ret);
+    return ret;
+}
+
+abt_io_op_t* abt_io_ftruncate_nb(abt_io_instance_id aid, int fd, off_t length,
+        int *ret)
+{
+    abt_io_op_t *op;
+    int iret;
+
+    if (length < 0) return NULL;
+
+    op = op_alloc(aid);
+    if (op == NULL) return NULL;
+
+    iret = issue_ftruncate(select_target(aid, fd, NULL), op, fd, length, ret);
+    if (iret != 0) { op_release(op); return NULL; }
+    else return op;
+}
+
+struct abt_io_openat_state
+{
+    int *ret;
+    int dirfd;
+    const char *pathname;
+    int flags;
+    mode_t mode;
+    struct abt_io_completion *completion;
+};
+
+static void abt_io_openat_fn(void *foo)
+{
+    struct abt_io_openat_state *state = foo;
+
+    *state->ret = openat(state->dirfd, state->pathname, state->flags,
+            state->mode);
+    if(*state->ret < 0)
+        *state->ret = -errno;
+
+    completion_signal(state->completion);
+    return;
+}
+
+static int issue_openat(struct abt_io_target t, abt_io_op_t *op, int dirfd,
+        const char *pathname, int flags, mode_t mode, int *ret)
+{
+    struct abt_io_openat_state state;
+    struct abt_io_openat_state *pstate = NULL;
+    struct abt_io_completion completion;
+    int rc;
+
+    if (op == NULL) pstate = &state;
+    else
+    {
+        pstate = op_state_alloc(op, sizeof(*pstate));
+        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+    }
+
+    *ret = -ENOSYS;
+    pstate->ret = ret;
+    pstate->dirfd = dirfd;
+    pstate->pathname = pathname;
+    pstate->flags = flags;
+    pstate->mode = mode;
+    pstate->completion = op != NULL ? &op->c : &completion;
+    completion_init(pstate->completion, &t.aid->waiters, t.home);
+
+    rc = submit(t, abt_io_openat_fn, pstate);
+    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+
+    if (op == NULL) {
+        completion_wait(pstate->completion);
+    }
+    else {
+        op->state = pstate;
+        op->free_fn = free;
+    }
+
+    return 0;
+err:
+    if (op != NULL) op_state_free(op, pstate);
+    return -1;
+}
+
+int abt_io_openat(abt_io_instance_id aid, int dirfd, const char *pathname,
+        int flags, mode_t mode)
+{
+    int ret = -1;
+    issue_openat(select_target(aid, -1, NULL), NULL, dirfd, pathname, flags,
+            mode, &ret);
+    return ret;
+}
+
+abt_io_op_t* abt_io_openat_nb(abt_io_instance_id aid, int dirfd,
+        const char *pathname, int flags, mode_t mode, int *ret)
+{
+    abt_io_op_t *op;
+    int iret;
+
+    op = op_alloc(aid);
+    if (op == NULL) return NULL;
+
+    iret = issue_openat(select_target(aid, -1, NULL), op, dirfd, pathname,
+            flags, mode, ret);
+    if (iret != 0) { op_release(op); return NULL; }
+    else return op;
+}
+
+struct abt_io_mkdirat_state
+{
+    int *ret;
+    int dirfd;
+    const char *pathname;
+    mode_t mode;
+    struct abt_io_completion *completion;
+};
+
+static void abt_io_mkdirat_fn(void *foo)
+{
+    struct abt_io_mkdirat_state *state = foo;
+
+    *state->ret = mkdirat(state->dirfd, state->pathname, state->mode);
+    if(*state->ret < 0)
+        *state->ret = -errno;
+
+    completion_signal(state->completion);
+    return;
+}
+
+static int issue_mkdirat(struct abt_io_target t, abt_io_op_t *op, int dirfd,
+        const char *pathname, mode_t mode, int *ret)
+{
+    struct abt_io_mkdirat_state state;
+    struct abt_io_mkdirat_state *pstate = NULL;
+    struct abt_io_completion completion;
+    int rc;
+
+    if (op == NULL) pstate = &state;
+    else
+    {
+        pstate = op_state_alloc(op, sizeof(*pstate));
+        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+    }
+
+    *ret = -ENOSYS;
+    pstate->ret = ret;
+    pstate->dirfd = dirfd;
+    pstate->pathname = pathname;
+    pstate->mode = mode;
+    pstate->completion = op != NULL ? &op->c : &completion;
+    completion_init(pstate->completion, &t.aid->waiters, t.home);
+
+    rc = submit(t, abt_io_mkdirat_fn, pstate);
+    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+
+    if (op == NULL) {
+        completion_wait(pstate->completion);
+    }
+    else {
+        op->state = pstate;
+        op->free_fn = free;
+    }
+
+    return 0;
+err:
+    if (op != NULL) op_state_free(op, pstate);
+    return -1;
+}
+
+int abt_io_mkdirat(abt_io_instance_id aid, int dirfd, const char *pathname,
+        mode_t mode)
+{
+    int ret = -1;
+    issue_mkdirat(select_target(aid, -1, NULL), NULL, dirfd, pathname, mode,
+            &ret);
+    return ret;
+}
+
+abt_io_op_t* abt_io_mkdirat_nb(abt_io_instance_id aid, int dirfd,
+        const char *pathname, mode_t mode, int *ret)
+{
+    abt_io_op_t *op;
+    int iret;
+
+    op = op_alloc(aid);
+    if (op == NULL) return NULL;
+
+    iret = issue_mkdirat(select_target(aid, -1, NULL), op, dirfd, pathname,
+            mode, ret);
+    if (iret != 0) { op_release(op); return NULL; }
+    else return op;
+}
+
+struct abt_io_renameat2_state
+{
+    int *ret;
+    int olddirfd;
+    const char *oldpath;
+    int newdirfd;
+    const char *newpath;
+    unsigned int flags;
+    struct abt_io_completion *completion;
+};
+
+static void abt_io_renameat2_fn(void *foo)
+{
+    struct abt_io_renameat2_state *state = foo;
+
+#if defined(HAVE_RENAMEAT2)
+    *state->ret = renameat2(state->olddirfd, state->oldpath, state->newdirfd,
+            state->newpath, state->flags);
+#elif defined(SYS_renameat2)
+    *state->ret = syscall(SYS_renameat2, state->olddirfd, state->oldpath,
+            state->newdirfd, state->newpath, state->flags);
+#else
+    if (state->flags != 0) {
+        errno = ENOSYS;
+        *state->ret = -1;
+    }
+    else
+        *state->ret = renameat(state->olddirfd, state->oldpath,
+                state->newdirfd, state->newpath);
+#endif
+    if(*state->ret < 0)
+        *state->ret = -errno;
+
+    completion_signal(state->completion);
+    return;
+}
+
+static int issue_renameat2(struct abt_io_target t, abt_io_op_t *op,
+        int olddirfd, const char *oldpath, int newdirfd, const char *newpath,
+        unsigned int flags, int *ret)
+{
+    struct abt_io_renameat2_state state;
+    struct abt_io_renameat2_state *pstate = NULL;
+    struct abt_io_completion completion;
+    int rc;
+
+    if (op == NULL) pstate = &state;
+    else
+    {
+        pstate = op_state_alloc(op, sizeof(*pstate));
+        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+    }
+
+    *ret = -ENOSYS;
+    pstate->ret = ret;
+    pstate->olddirfd = olddirfd;
+    pstate->oldpath = oldpath;
+    pstate->newdirfd = newdirfd;
+    pstate->newpath = newpath;
+    pstate->flags = flags;
+    pstate->completion = op != NULL ? &op->c : &completion;
+    completion_init(pstate->completion, &t.aid->waiters, t.home);
+
+    rc = submit(t, abt_io_renameat2_fn, pstate);
+    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+
+    if (op == NULL) {
+        completion_wait(pstate->completion);
+    }
+    else {
+        op->state = pstate;
+        op->free_fn = free;
+    }
+
+    return 0;
+err:
+    if (op != NULL) op_state_free(op, pstate);
+    return -1;
+}
+
+int abt_io_renameat2(abt_io_instance_id aid, int olddirfd, const char *oldpath,
+        int newdirfd, const char *newpath, unsigned int flags)
+{
+    int ret = -1;
+    issue_renameat2(select_target(aid, -1, NULL), NULL, olddirfd, oldpath,
+            newdirfd, newpath, flags, &ret);
+    return ret;
+}
+
+abt_io_op_t* abt_io_renameat2_nb(abt_io_instance_id aid, int olddirfd,
+        const char *oldpath, int newdirfd, const char *newpath,
+        unsigned int flags, int *ret)
+{
+    abt_io_op_t *op;
+    int iret;
+
+    op = op_alloc(aid);
+    if (op == NULL) return NULL;
+
+    iret = issue_renameat2(select_target(aid, -1, NULL), op, olddirfd, oldpath,
+            newdirfd, newpath, flags, ret);
+    if (iret != 0) { op_release(op); return NULL; }
+    else return op;
+}
+
+struct abt_io_fstat_state
+{
+    int *ret;
+    int fd;
+    struct stat *statbuf;
+    struct abt_io_completion *completion;
+};
+
+static void abt_io_fstat_fn(void *foo)
+{
+    struct abt_io_fstat_state *state = foo;
+
+    *state->ret = fstat(state->fd, state->statbuf);
+    if(*state->ret < 0)
+        *state->ret = -errno;
+
+    completion_signal(state->completion);
+    return;
+}
+
+static int issue_fstat(struct abt_io_target t, abt_io_op_t *op, int fd,
+        struct stat *statbuf, int *ret)
+{
+    struct abt_io_fstat_state state;
+    struct abt_io_fstat_state *pstate = NULL;
+    struct abt_io_completion completion;
+    int rc;
+
+    if (op == NULL) pstate = &state;
+    else
+    {
+        pstate = op_state_alloc(op, sizeof(*pstate));
+        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+    }
+
+    *ret = -ENOSYS;
+    pstate->ret = ret;
+    pstate->fd = fd;
+    pstate->statbuf = statbuf;
+    pstate->completion = op != NULL ? &op->c : &completion;
+    completion_init(pstate->completion, &t.aid->waiters, t.home);
+
+    rc = submit(t, abt_io_fstat_fn, pstate);
+    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+
+    if (op == NULL) {
+        completion_wait(pstate->completion);
+    }
+    else {
+        op->state = pstate;
+        op->free_fn = free;
+    }
+
+    return 0;
+err:
+    if (op != NULL) op_state_free(op, pstate);
+    return -1;
+}
+
+int abt_io_fstat(abt_io_instance_id aid, int fd, struct stat *statbuf)
+{
+    int ret = -1;
+    issue_fstat(select_target(aid, fd, NULL), NULL, fd, statbuf, &ret);
+    return ret;
+}
+
+abt_io_op_t* abt_io_fstat_nb(abt_io_instance_id aid, int fd,
+        struct stat *statbuf, int *ret)
+{
+    abt_io_op_t *op;
+    int iret;
+
+    op = op_alloc(aid);
+    if (op == NULL) return NULL;
+
+    iret = issue_fstat(select_target(aid, fd, NULL), op, fd, statbuf, ret);
+    if (iret != 0) { op_release(op); return NULL; }
+    else return op;
+}
+
+struct abt_io_statx_state
+{
+    int *ret;
+    int dirfd;
+    const char *pathname;
+    int flags;
+    unsigned int mask;
+    struct statx *statxbuf;
+    struct abt_io_completion *completion;
+};
+
+static void abt_io_statx_fn(void *foo)
+{
+    struct abt_io_statx_state *state = foo;
+
+#ifdef HAVE_STATX
+    *state->ret = statx(state->dirfd, state->pathname, state->flags,
+            state->mask, state->statxbuf);
+    if(*state->ret < 0)
+        *state->ret = -errno;
+#else
+    *state->ret = -ENOSYS;
+#endif
+
+    completion_signal(state->completion);
+    return;
+}
+
+static int issue_statx(struct abt_io_target t, abt_io_op_t *op, int dirfd,
+        const char *pathname, int flags, unsigned int mask,
+        struct statx *statxbuf, int *ret)
+{
+    struct abt_io_statx_state state;
+    struct abt_io_statx_state *pstate = NULL;
+    struct abt_io_completion completion;
+    int rc;
+
+    if (op == NULL) pstate = &state;
+    else
+    {
+        pstate = op_state_alloc(op, sizeof(*pstate));
+        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+    }
+
+    *ret = -ENOSYS;
+    pstate->ret = ret;
+    pstate->dirfd = dirfd;
+    pstate->pathname = pathname;
+    pstate->flags = flags;
+    pstate->mask = mask;
+    pstate->statxbuf = statxbuf;
+    pstate->completion = op != NULL ? &op->c : &completion;
+    completion_init(pstate->completion, &t.aid->waiters, t.home);
+
+    rc = submit(t, abt_io_statx_fn, pstate);
+    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+
+    if (op == NULL) {
+        completion_wait(pstate->completion);
+    }
+    else {
+        op->state = pstate;
+        op->free_fn = free;
+    }
+
+    return 0;
+err:
+    if (op != NULL) op_state_free(op, pstate);
+    return -1;
+}
+
+int abt_io_statx(abt_io_instance_id aid, int dirfd, const char *pathname,
+        int flags, unsigned int mask, struct statx *statxbuf)
+{
+    int ret = -1;
+    issue_statx(select_target(aid, -1, NULL), NULL, dirfd, pathname, flags,
+            mask, statxbuf, &ret);
+    return ret;
+}
+
+abt_io_op_t* abt_io_statx_nb(abt_io_instance_id aid, int dirfd,
+        const char *pathname, int flags, unsigned int mask,
+        struct statx *statxbuf, int *ret)
+{
+    abt_io_op_t *op;
+    int iret;
+
+    op = op_alloc(aid);
+    if (op == NULL) return NULL;
+
+    iret = issue_statx(select_target(aid, -1, NULL), op, dirfd, pathname, flags,
+            mask, statxbuf, ret);
+    if (iret != 0) { op_release(op); return NULL; }
+    else return op;
+}
+
+struct abt_io_fsync_state
+{
+    int *ret;
+    int fd;
+    struct abt_io_completion *completion;
+};
+
+static void abt_io_fsync_fn(void *foo)
+{
+    struct abt_io_fsync_state *state = foo;
+
+    *state->ret = fsync(state->fd);
+    if(*state->ret < 0)
+        *state->ret = -errno;
+
+    completion_signal(state->completion);
+    return;
+}
+
+static int issue_fsync(struct abt_io_target t, abt_io_op_t *op, int fd,
+        int *ret)
+{
+    struct abt_io_fsync_state state;
+    struct abt_io_fsync_state *pstate = NULL;
+    struct abt_io_completion completion;
+    int rc;
+
+    if (op == NULL) pstate = &state;
+    else
+    {
+        pstate = op_state_alloc(op, sizeof(*pstate));
+        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+    }
+
+    *ret = -ENOSYS;
+    pstate->ret = ret;
+    pstate->fd = fd;
+    pstate->completion = op != NULL ? &op->c : &completion;
+    completion_init(pstate->completion, &t.aid->waiters, t.home);
+
+    rc = submit(t, abt_io_fsync_fn, pstate);
+    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+
+    if (op == NULL) {
+        completion_wait(pstate->completion);
+    }
+    else {
+        op->state = pstate;
+        op->free_fn = free;
+    }
+
+    return 0;
+err:
+    if (op != NULL) op_state_free(op, pstate);
+    return -1;
+}
+
+int abt_io_fsync(abt_io_instance_id aid, int fd)
+{
+    int ret = -1;
+    issue_fsync(select_target(aid, fd, NULL), NULL, fd, &ret);
+    return ret;
+}
+
+abt_io_op_t* abt_io_fsync_nb(abt_io_instance_id aid, int fd, int *ret)
+{
+    abt_io_op_t *op;
+    int iret;
+
+    op = op_alloc(aid);
+    if (op == NULL) return NULL;
+
+    iret = issue_fsync(select_target(aid, fd, NULL), op, fd, ret);
+    if (iret != 0) { op_release(op); return NULL; }
+    else return op;
+}
+
+struct abt_io_getdents_state
+{
+    ssize_t *ret;
+    int fd;
+    void *buf;
+    size_t count;
+    struct abt_io_completion *completion;
+};
+
+static void abt_io_getdents_fn(void *foo)
+{
+    struct abt_io_getdents_state *state = foo;
+
+    *state->ret = syscall(SYS_getdents64, state->fd, state->buf, state->count);
+    if(*state->ret < 0)
+        *state->ret = -errno;
+
+    completion_signal(state->completion);
+    return;
+}
+
+static int issue_getdents(struct abt_io_target t, abt_io_op_t *op, int fd,
+        void *buf, size_t count, ssize_t *ret)
+{
+    struct abt_io_getdents_state state;
+    struct abt_io_getdents_state *pstate = NULL;
+    struct abt_io_completion completion;
+    int rc;
+
+    if (op == NULL) pstate = &state;
+    else
+    {
+        pstate = op_state_alloc(op, sizeof(*pstate));
+        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+    }
+
+    *ret = -ENOSYS;
+    pstate->ret = ret;
+    pstate->fd = fd;
+    pstate->buf = buf;
+    pstate->count = count;
+    pstate->completion = op != NULL ? &op->c : &completion;
+    completion_init(pstate->completion, &t.aid->waiters, t.home);
+
+    rc = submit(t, abt_io_getdents_fn, pstate);
+    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+
+    if (op == NULL) {
+        completion_wait(pstate->completion);
+    }
+    else {
+        op->state = pstate;
+        op->free_fn = free;
+    }
+
+    return 0;
+err:
+    if (op != NULL) op_state_free(op, pstate);
+    return -1;
+}
+
+ssize_t abt_io_getdents(abt_io_instance_id aid, int fd, void *buf,
+        size_t count)
+{
+    ssize_t ret = -1;
+    issue_getdents(select_target(aid, fd, NULL), NULL, fd, buf, count, &ret);
+    return ret;
+}
+
+abt_io_op_t* abt_io_getdents_nb(abt_io_instance_id aid, int fd, void *buf,
+        size_t count, ssize_t *ret)
+{
+    abt_io_op_t *op;
+    int iret;
+
+    op = op_alloc(aid);
+    if (op == NULL) return NULL;
+
+    iret = issue_getdents(select_target(aid, fd, NULL), op, fd, buf, count,
+            ret);
+    if (iret != 0) { op_release(op); return NULL; }
+    else return op;
+}
+
+#define ABT_IO_TREE_PARALLEL 8      /* default fan-out without own xstreams */
+#define ABT_IO_TREE_BATCH 256       /* entries per callback batch */
+#define ABT_IO_TREE_QUEUED 8        /* batches waiting for the caller */
+#define ABT_IO_TREE_NAMES 65536     /* path bytes per callback batch */
+#define ABT_IO_TREE_DENTS 32768     /* getdents64 buffer */
+
+/* A directory still to be listed, or listed but with subdirectories in
+ * progress.  refs counts the listing itself plus each subdirectory node;
+ * when it drops to zero the directory is finished, which for a remove is
+ * when it is empty and can be rmdir()ed.  A listed directory stays open
+ * until then, and everything below it is opened and removed relative to
+ * it, never by path, so a symlink swapped into the tree is not followed.
+ */
+struct abt_io_tree_node
+{
+    struct abt_io_tree_node *parent;
+    struct abt_io_tree_node *next;  /* on the pending list */
+    int refs;
+    int file;                       /* a remove root that is not a directory */
+    int dfd;                        /* open once listed */
+    size_t name;                    /* offset of the last component in path */
+    char path[];
+};
+
+struct abt_io_tree_batch
+{
+    struct abt_io_tree_batch *next;
+    int count;
+    size_t used;
+    struct abt_io_tree_entry entries[ABT_IO_TREE_BATCH];
+    char names[ABT_IO_TREE_NAMES];
+};
+
+struct abt_io_tree
+{
+    struct abt_io_instance *aid;
+    int flags;
+    int remove;
+    int max_parallel;
+    ABT_mutex mutex;
+    struct abt_io_tree_node *pending;   /* LIFO, so the walk is depth first */
+    int active;                         /* tasks working on the tree */
+    int stop;
+    int error;                          /* first -errno */
+    struct abt_io_tree_batch *batches;  /* FIFO of filled batches */
+    struct abt_io_tree_batch *batches_tail;
+    int queued;                         /* batches on the FIFO */
+    struct abt_io_completion *waiter;   /* the caller, when it is waiting */
+};
+
+static void abt_io_tree_fn(void *foo);
+
+static struct abt_io_tree_node* tree_node(struct abt_io_tree_node *parent,
+        const char *dir, const char *name)
+{
+    struct abt_io_tree_node *node;
+    size_t dlen = dir != NULL ? strlen(dir) : 0;
+    size_t nlen = strlen(name);
+
+    node = malloc(sizeof(*node) + dlen + nlen + 2);
+    if (node == NULL) return NULL;
+    node->parent = parent;
+    node->next = NULL;
+    node->refs = 1;
+    node->file = 0;
+    node->dfd = -1;
+    if (dir != NULL) {
+        memcpy(node->path, dir, dlen);
+        node->path[dlen++] = '/';
+    }
+    node->name = dlen;
+    memcpy(node->path + dlen, name, nlen + 1);
+    return node;
+}
+
+/* detaches the caller if it is waiting; call with tree->mutex held */
+static struct abt_io_completion* tree_take_waiter(struct abt_io_tree *tree)
+{
+    struct abt_io_completion *w = tree->waiter;
+
+    tree->waiter = NULL;
+    return w;
+}
+
+static void tree_fail(struct abt_io_tree *tree, int err)
+{
+    ABT_mutex_spinlock(tree->mutex);
+    if (tree->error == 0) tree->error = err;
+    __atomic_store_n(&tree->stop, 1, __ATOMIC_RELEASE);
+    ABT_mutex_unlock(tree->mutex);
+}
+
+/* drops a reference on node and finishes the ancestors that completes */
+static void tree_node_put(struct abt_io_tree *tree, struct abt_io_tree_node *node)
+{
+    struct abt_io_tree_node *parent;
+
+    int ret;
+
+    while (node != NULL &&
+            __atomic_sub_fetch(&node->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (node->dfd >= 0) close(node->dfd);
+        if (tree->remove && !node->file && node->dfd >= 0 &&
+                !__atomic_load_n(&tree->stop, __ATOMIC_ACQUIRE)) {
+            /* the parent holds a reference, so its dfd is still open */
+            if (node->parent != NULL)
+                ret = unlinkat(node->parent->dfd, node->path + node->name,
+                        AT_REMOVEDIR);
+            else
+                ret = rmdir(node->path);
+            if (ret < 0) tree_fail(tree, -errno);
+        }
+        parent = node->parent;
+        free(node);
+        node = parent;
+    }
+}
+
+static void tree_flush(struct abt_io_tree *tree, struct abt_io_tree_batch *batch)
+{
+    struct abt_io_completion *w;
+
+    ABT_mutex_spinlock(tree->mutex);
+    batch->next = NULL;
+    if (tree->batches_tail != NULL) tree->batches_tail->next = batch;
+    else tree->batches = batch;
+    tree->batches_tail = batch;
+    __atomic_store_n(&tree->queued, tree->queued + 1, __ATOMIC_RELAXED);
+    w = tree_take_waiter(tree);
+    ABT_mutex_unlock(tree->mutex);
+
+    if (w != NULL) completion_signal(w);
+}
+
+/* queues a subdirectory and starts another task for it if the fan-out
+ * allows */
+static void tree_push(struct abt_io_tree *tree, struct abt_io_tree_node *node)
+{
+    int spawn = 0;
+
+    ABT_mutex_spinlock(tree->mutex);
+    node->next = tree->pending;
+    tree->pending = node;
+    if (tree->active < tree->max_parallel) {
+        tree->active++;
+        spawn = 1;
+    }
+    ABT_mutex_unlock(tree->mutex);
+
+    /* if the task cannot be created the running ones pick the node up */
+    if (spawn && submit_internal(tree->aid, select_target(tree->aid, -1, NULL),
+                abt_io_tree_fn, tree) != ABT_SUCCESS) {
+        ABT_mutex_spinlock(tree->mutex);
+        tree->active--;
+        ABT_mutex_unlock(tree->mutex);
+    }
+}
+
+/* adds an entry to the task's batch, handing full batches to the caller */
+static int tree_add(struct abt_io_tree *tree, struct abt_io_tree_batch **bp,
+        const char *dir, const char *name, unsigned char type,
+        const struct stat *st)
+{
+    struct abt_io_tree_batch *batch = *bp;
+    struct abt_io_tree_entry *e;
+    size_t dlen = strlen(dir);
+    size_t nlen = strlen(name);
+
+    if (batch != NULL && (batch->count == ABT_IO_TREE_BATCH ||
+                batch->used + dlen + nlen + 2 > ABT_IO_TREE_NAMES)) {
+        tree_flush(tree, batch);
+        batch = NULL;
+    }
+    if (batch == NULL) {
+        batch = malloc(sizeof(*batch));
+        if (batch == NULL) return -ENOMEM;
+        batch->count = 0;
+        batch->used = 0;
+    }
+    *bp = batch;
+    if (dlen + nlen + 2 > ABT_IO_TREE_NAMES) return -ENAMETOOLONG;
+
+    e = &batch->entries[batch->count++];
+    e->path = batch->names + batch->used;
+    memcpy(batch->names + batch->used, dir, dlen);
+    batch->names[batch->used + dlen] = '/';
+    memcpy(batch->names + batch->used + dlen + 1, name, nlen + 1);
+    batch->used += dlen + nlen + 2;
+    e->type = type;
+    if (st != NULL) e->st = *st;
+    else memset(&e->st, 0, sizeof(e->st));
+    return 0;
+}
+
+/* lists one directory: entries go to the batch, or are unlinked for a
+ * remove, and subdirectories are queued.  Returns 1 if the listing was
+ * paused because too many batches are waiting for the caller. */
+static int tree_list(struct abt_io_tree *tree, struct abt_io_tree_node *node,
+        char *dents, struct abt_io_tree_batch **bp)
+{
+    struct abt_io_dirent *d;
+    struct abt_io_tree_node *child;
+    struct stat st;
+    struct stat *stp;
+    unsigned char type;
+    ssize_t n, off;
+    int dfd;
+    int ret = 0;
+
+    if (node->dfd >= 0) {
+        /* resuming a listing that was paused */
+        dfd = node->dfd;
+        goto list;
+    }
+    if (node->parent == NULL) {
+        /* the root is never followed either: refuse a symlink, and for a
+         * remove just unlink anything else that is not a directory */
+        if (lstat(node->path, &st) < 0) return -errno;
+        if (S_ISLNK(st.st_mode)) return -ELOOP;
+        if (!S_ISDIR(st.st_mode)) {
+            if (!tree->remove) return -ENOTDIR;
+            node->file = 1;
+            return unlink(node->path) < 0 ? -errno : 0;
+        }
+        dfd = open(node->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    }
+    else
+        dfd = openat(node->parent->dfd, node->path + node->name,
+                O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (dfd < 0) {
+        /* raced with a concurrent rmdir */
+        if (errno == ENOENT && node->parent != NULL) return 0;
+        return -errno;
+    }
+    node->dfd = dfd;
+
+list:
+    while (ret == 0 && !__atomic_load_n(&tree->stop, __ATOMIC_ACQUIRE)) {
+        /* the caller is behind: pause here, the directory offset stays in
+         * dfd, and let it catch up */
+        if (__atomic_load_n(&tree->queued, __ATOMIC_RELAXED) >= ABT_IO_TREE_QUEUED)
+            return 1;
+        n = syscall(SYS_getdents64, dfd, dents, ABT_IO_TREE_DENTS);
+        if (n < 0) { ret = -errno; break; }
+        if (n == 0) break;
+
+        for (off = 0; ret == 0 && off < n; off += d->d_reclen) {
+            d = (struct abt_io_dirent*)(dents + off);
+            if (d->d_name[0] == '.' && (d->d_name[1] == '\0' ||
+                        (d->d_name[1] == '.' && d->d_name[2] == '\0')))
+                continue;
+
+            type = d->d_type;
+            stp = NULL;
+            if (type == DT_UNKNOWN ||
+                    (!tree->remove && (tree->flags & ABT_IO_TREE_STAT))) {
+                if (fstatat(dfd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+                    /* raced with a concurrent unlink */
+                    if (errno == ENOENT) continue;
+                    ret = -errno;
+                    break;
+                }
+                stp = &st;
+                type = IFTODT(st.st_mode);
+            }
+
+            if (type == DT_DIR) {
+                child = tree_node(node, node->path, d->d_name);
+                if (child == NULL) { ret = -ENOMEM; break; }
+                __atomic_add_fetch(&node->refs, 1, __ATOMIC_RELAXED);
+                tree_push(tree, child);
+            }
+            else if (tree->remove) {
+                if (unlinkat(dfd, d->d_name, 0) < 0 && errno != ENOENT)
+                    ret = -errno;
+            }
+            if (!tree->remove)
+                ret = tree_add(tree, bp, node->path, d->d_name, type, stp);
+        }
+    }
+
+    /* dfd stays open for the subdirectories until the node is put */
+    return ret;
+}
+
+/* A fan-out task: works through pending directories until none are left,
+ * or until the caller falls too far behind on batches, in which case the
+ * caller starts tasks again as it catches up.
+ */
+static void abt_io_tree_fn(void *foo)
+{
+    struct abt_io_tree *tree = foo;
+    struct abt_io_instance *aid = tree->aid;
+    struct abt_io_tree_node *node;
+    struct abt_io_tree_batch *batch = NULL;
+    struct abt_io_completion *w = NULL;
+    char *dents;
+    int ret;
+
+    dents = malloc(ABT_IO_TREE_DENTS);
+    if (dents == NULL) tree_fail(tree, -ENOMEM);
+
+    for (;;) {
+        ABT_mutex_spinlock(tree->mutex);
+        node = NULL;
+        if (tree->queued < ABT_IO_TREE_QUEUED ||
+                __atomic_load_n(&tree->stop, __ATOMIC_ACQUIRE)) {
+            node = tree->pending;
+            if (node != NULL) tree->pending = node->next;
+        }
+        /* the batch is handed over before the caller can see the walk end */
+        if (node == NULL && batch == NULL && --tree->active == 0)
+            w = tree_take_waiter(tree);
+        ABT_mutex_unlock(tree->mutex);
+
+        if (node == NULL) {
+            if (batch == NULL) break;
+            if (batch->count > 0) tree_flush(tree, batch);
+            else free(batch);
+            batch = NULL;
+            continue;
+        }
+
+        /* once stopped, nodes are only released */
+        ret = 0;
+        if (!__atomic_load_n(&tree->stop, __ATOMIC_ACQUIRE)) {
+            ret = tree_list(tree, node, dents, &batch);
+            if (ret < 0) tree_fail(tree, ret);
+        }
+        if (ret > 0) {
+            /* paused: back on the list for whoever resumes it */
+            ABT_mutex_spinlock(tree->mutex);
+            node->next = tree->pending;
+            tree->pending = node;
+            ABT_mutex_unlock(tree->mutex);
+        }
+        else
+            tree_node_put(tree, node);
+    }
+
+    /* the tree lives on the caller's stack and is gone once signaled */
+    free(dents);
+    if (w != NULL) completion_signal(w);
+    internal_done(aid);
+    return;
+}
+
+/* backing xstreams currently running, 0 if they belong to the caller */
+static int tree_xstreams(struct abt_io_instance *aid)
+{
+    if (aid->elastic != NULL)
+        return __atomic_load_n(&aid->elastic->active, __ATOMIC_RELAXED);
+    if (aid->workers != NULL) return aid->num_workers;
+    return aid->num_xstreams;
+}
+
+static int tree_run(struct abt_io_instance *aid, const char *path, int flags,
+        int remove, int max_parallel, abt_io_tree_cb cb, void *arg)
+{
+    struct abt_io_tree tree;
+    struct abt_io_tree_node *root;
+    struct abt_io_tree_batch *batch;
+    struct abt_io_completion completion;
+    struct abt_io_target t;
+    int ret = 0;
+    int wait, spawn, idle;
+    int xstreams;
+    int rc;
+
+    /* by default leave half of the backing xstreams to other operations */
+    if (max_parallel <= 0) {
+        xstreams = tree_xstreams(aid);
+        max_parallel = xstreams > 0 ? (xstreams + 1) / 2 : ABT_IO_TREE_PARALLEL;
+    }
+
+    memset(&tree, 0, sizeof(tree));
+    tree.aid = aid;
+    tree.flags = flags;
+    tree.remove = remove;
+    tree.max_parallel = max_parallel;
+    if (ABT_mutex_create(&tree.mutex) != ABT_SUCCESS) return -ENOMEM;
+
+    root = tree_node(NULL, NULL, path);
+    if (root == NULL) { ABT_mutex_free(&tree.mutex); return -ENOMEM; }
+    tree.pending = root;
+    tree.active = 1;
+
+    t = select_target(aid, -1, NULL);
+    rc = submit_internal(aid, t, abt_io_tree_fn, &tree);
+    if (rc != ABT_SUCCESS) {
+        free(root);
+        ABT_mutex_free(&tree.mutex);
+        return -EINVAL;
+    }
+
+    for (;;) {
+        wait = 0;
+        spawn = 0;
+        ABT_mutex_spinlock(tree.mutex);
+        batch = tree.batches;
+        if (batch != NULL) {
+            tree.batches = batch->next;
+            if (tree.batches == NULL) tree.batches_tail = NULL;
+            __atomic_store_n(&tree.queued, tree.queued - 1, __ATOMIC_RELAXED);
+        }
+        /* restart the tasks that stopped while we were behind */
+        if (tree.pending != NULL && tree.queued < ABT_IO_TREE_QUEUED) {
+            spawn = tree.max_parallel - tree.active;
+            tree.active += spawn;
+        }
+        if (batch == NULL && tree.active > 0) {
+            completion_init(&completion, &t.aid->waiters, t.home);
+            tree.waiter = &completion;
+            wait = 1;
+        }
+        ABT_mutex_unlock(tree.mutex);
+
+        for (; spawn > 0; spawn--)
+            if (submit_internal(aid, t, abt_io_tree_fn, &tree) != ABT_SUCCESS) {
+                tree_fail(&tree, -EINVAL);
+                ABT_mutex_spinlock(tree.mutex);
+                tree.active -= spawn;
+                idle = tree.active == 0;
+                if (idle) tree.waiter = NULL;
+                ABT_mutex_unlock(tree.mutex);
+                /* no task is left to release the pending directories */
+                if (idle) {
+                    wait = 0;
+                    while ((root = tree.pending) != NULL) {
+                        tree.pending = root->next;
+                        tree_node_put(&tree, root);
+                    }
+                }
+                break;
+            }
+
+        if (batch != NULL) {
+            if (ret == 0 && cb != NULL) {
+                ret = cb(arg, batch->entries, batch->count);
+                if (ret != 0)
+                    __atomic_store_n(&tree.stop, 1, __ATOMIC_RELEASE);
+            }
+            free(batch);
+        }
+        else if (wait)
+            completion_wait(&completion);
+        else
+            break;
+    }
+
+    ABT_mutex_free(&tree.mutex);
+    if (ret == 0) ret = tree.error;
+    return ret;
+}
+
+int abt_io_tree_walk(abt_io_instance_id aid, const char *path, int flags,
+        int max_parallel, abt_io_tree_cb cb, void *arg)
+{
+    return tree_run(aid, path, flags, 0, max_parallel, cb, arg);
+}
+
+int abt_io_tree_remove(abt_io_instance_id aid, const char *path,
+        int max_parallel)
+{
+    return tree_run(aid, path, 0, 1, max_parallel, NULL, NULL);
+}
+
+/* An open file shared through the fd cache.  Entries with references are
+ * only reachable through the hash and by_fd; idle ones are also on the LRU
+ * list, which is the only place eviction takes them from, so an fd that an
+ * operation may still be using is never closed underneath it.
+ */
+struct abt_io_fd_entry
+{
+    struct abt_io_fd_entry *hnext;      /* path hash chain */
+    struct abt_io_fd_entry *prev;       /* LRU list, most recent first */
+    struct abt_io_fd_entry *next;
+    uint32_t hash;
+    int fd;
+    int flags;
+    int refs;
+    int detached;   /* invalidated; closed when the last reference goes */
+    char path[];
+};
+
+struct abt_io_fd_cache
+{
+    struct abt_io_fd_entry **buckets;
+    unsigned int nbuckets;              /* power of two */
+    struct abt_io_fd_entry **by_fd;     /* indexed by fd */
+    int by_fd_size;
+    struct abt_io_fd_entry *lru_head;
+    struct abt_io_fd_entry *lru_tail;
+    int count;                          /* entries in the hash */
+};
+
+static uint32_t fd_cache_hash(const char *path)
+{
+    uint32_t h = 2166136261u;
+
+    while (*path) h = (h ^ (unsigned char)*path++) * 16777619u;
+    return h;
+}
+
+/* call with fd_cache_mutex held */
+static struct abt_io_fd_cache* fd_cache_get(struct abt_io_instance *aid)
+{
+    struct abt_io_fd_cache *c = aid->fd_cache;
+    unsigned int n = 64;
+
+    if (c != NULL) return c;
+
+    while (n < (unsigned int)aid->fd_cache_limit && n < (1u << 20)) n <<= 1;
+    c = calloc(1, sizeof(*c));
+    if (c == NULL) return NULL;
+    c->buckets = calloc(n, sizeof(*c->buckets));
+    if (c->buckets == NULL) { free(c); return NULL; }
+    c->nbuckets = n;
+    aid->fd_cache = c;
+    return c;
+}
+
+static void fd_lru_remove(struct abt_io_fd_cache *c, struct abt_io_fd_entry *e)
+{
+    if (e->prev != NULL) e->prev->next = e->next;
+    else c->lru_head = e->next;
+    if (e->next != NULL) e->next->prev = e->prev;
+    else c->lru_tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void fd_lru_push(struct abt_io_fd_cache *c, struct abt_io_fd_entry *e)
+{
+    e->prev = NULL;
+    e->next = c->lru_head;
+    if (c->lru_head != NULL) c->lru_head->prev = e;
+    else c->lru_tail = e;
+    c->lru_head = e;
+}
+
+static void fd_hash_remove(struct abt_io_fd_cache *c, struct abt_io_fd_entry *e)
+{
+    struct abt_io_fd_entry **pp;
+
+    pp = &c->buckets[e->hash & (c->nbuckets - 1)];
+    while (*pp != e) pp = &(*pp)->hnext;
+    *pp = e->hnext;
+    c->count--;
+}
+
+/* takes a reference on a cached entry; call with fd_cache_mutex held */
+static int fd_cache_ref(struct abt_io_fd_cache *c, uint32_t hash,
+        const char *path, int flags)
+{
+    struct abt_io_fd_entry *e;
+
+    for (e = c->buckets[hash & (c->nbuckets - 1)]; e != NULL; e = e->hnext) {
+        if (e->hash == hash && e->flags == flags && !strcmp(e->path, path)) {
+            if (e->refs++ == 0) fd_lru_remove(c, e);
+            return e->fd;
+        }
+    }
+    return -1;
+}
+
+/* unlinks idle entries beyond the limit, oldest first, onto *closing; call
+ * with fd_cache_mutex held and close them after dropping it */
+static void fd_cache_evict(struct abt_io_instance *aid,
+        struct abt_io_fd_cache *c, struct abt_io_fd_entry **closing)
+{
+    struct abt_io_fd_entry *e;
+
+    while (c->count > aid->fd_cache_limit && c->lru_tail != NULL) {
+        e = c->lru_tail;
+        fd_lru_remove(c, e);
+        fd_hash_remove(c, e);
+        c->by_fd[e->fd] = NULL;
+        e->hnext = *closing;
+        *closing = e;
+    }
+}
+
+static void fd_cache_close(struct abt_io_instance *aid,
+        struct abt_io_fd_entry *closing)
+{
+    struct abt_io_fd_entry *e;
+
+    while ((e = closing) != NULL) {
+        closing = e->hnext;
+        abt_io_close(aid, e->fd);
+        free(e);
+    }
+}
+
+int abt_io_fd_acquire(abt_io_instance_id aid, const char *pathname, int flags)
+{
+    struct abt_io_fd_cache *c;
+    struct abt_io_fd_entry *e;
+    struct abt_io_fd_entry **by_fd;
+    struct abt_io_fd_entry *closing = NULL;
+    uint32_t hash;
+    size_t len;
+    int size;
+    int fd;
+
+    /* only plain opens of existing files can be shared */
+    if (flags & (O_CREAT | O_EXCL | O_TRUNC)) return -EINVAL;
+#ifdef O_TMPFILE
+    if ((flags & O_TMPFILE) == O_TMPFILE) return -EINVAL;
+#endif
+
+    hash = fd_cache_hash(pathname);
+    ABT_mutex_spinlock(aid->fd_cache_mutex);
+    c = fd_cache_get(aid);
+    fd = c != NULL ? fd_cache_ref(c, hash, pathname, flags) : -1;
+    ABT_mutex_unlock(aid->fd_cache_mutex);
+    if (c == NULL) return -ENOMEM;
+    if (fd >= 0) return fd;
+
+    /* racing misses on one path both open it; the loser closes its fd */
+    fd = abt_io_open(aid, pathname, flags, 0);
+    if (fd < 0) return fd;
+    len = strlen(pathname);
+    e = malloc(sizeof(*e) + len + 1);
+    if (e == NULL) { abt_io_close(aid, fd); return -ENOMEM; }
+    e->hash = hash;
+    e->fd = fd;
+    e->flags = flags;
+    e->refs = 1;
+    e->detached = 0;
+    e->prev = e->next = NULL;
+    memcpy(e->path, pathname, len + 1);
+
+    ABT_mutex_spinlock(aid->fd_cache_mutex);
+    fd = fd_cache_ref(c, hash, pathname, flags);
+    if (fd >= 0) {
+        ABT_mutex_unlock(aid->fd_cache_mutex);
+        abt_io_close(aid, e->fd);
+        free(e);
+        return fd;
+    }
+    if (e->fd >= c->by_fd_size) {
+        size = c->by_fd_size ? c->by_fd_size : 256;
+        while (size <= e->fd) size *= 2;
+        by_fd = realloc(c->by_fd, size * sizeof(*by_fd));
+        if (by_fd == NULL) {
+            ABT_mutex_unlock(aid->fd_cache_mutex);
+            abt_io_close(aid, e->fd);
+            free(e);
+            return -ENOMEM;
+        }
+        memset(by_fd + c->by_fd_size, 0,
+                (size - c->by_fd_size) * sizeof(*by_fd));
+        c->by_fd = by_fd;
+        c->by_fd_size = size;
+    }
+    c->by_fd[e->fd] = e;
+    e->hnext = c->buckets[hash & (c->nbuckets - 1)];
+    c->buckets[hash & (c->nbuckets - 1)] = e;
+    c->count++;
+    fd = e->fd;
+    fd_cache_evict(aid, c, &closing);
+    ABT_mutex_unlock(aid->fd_cache_mutex);
+
+    fd_cache_close(aid, closing);
+    return fd;
+}
+
+int abt_io_fd_release(abt_io_instance_id aid, int fd)
+{
+    struct abt_io_fd_cache *c;
+    struct abt_io_fd_entry *e = NULL;
+    struct abt_io_fd_entry *closing = NULL;
+
+    ABT_mutex_spinlock(aid->fd_cache_mutex);
+    c = aid->fd_cache;
+    if (c != NULL && fd >= 0 && fd < c->by_fd_size) e = c->by_fd[fd];
+    if (e == NULL || e->refs == 0) {
+        ABT_mutex_unlock(aid->fd_cache_mutex);
+        return -EBADF;
+    }
+    if (--e->refs == 0) {
+        if (e->detached) {
+            c->by_fd[fd] = NULL;
+            e->hnext = NULL;
+            closing = e;
+        }
+        else {
+            fd_lru_push(c, e);
+            fd_cache_evict(aid, c, &closing);
+        }
+    }
+    ABT_mutex_unlock(aid->fd_cache_mutex);
+
+    fd_cache_close(aid, closing);
+    return 0;
+}
+
+int abt_io_fd_invalidate(abt_io_instance_id aid, const char *pathname)
+{
+    struct abt_io_fd_cache *c;
+    struct abt_io_fd_entry *e;
+    struct abt_io_fd_entry *next;
+    struct abt_io_fd_entry *closing = NULL;
+    uint32_t hash;
+    int n = 0;
+
+    hash = fd_cache_hash(pathname);
+    ABT_mutex_spinlock(aid->fd_cache_mutex);
+    c = aid->fd_cache;
+    e = c != NULL ? c->buckets[hash & (c->nbuckets - 1)] : NULL;
+    for (; e != NULL; e = next) {
+        next = e->hnext;
+        if (e->hash != hash || strcmp(e->path, pathname)) continue;
+        fd_hash_remove(c, e);
+        n++;
+        if (e->refs == 0) {
+            fd_lru_remove(c, e);
+            c->by_fd[e->fd] = NULL;
+            e->hnext = closing;
+            closing = e;
+        }
+        else
+            e->detached = 1;
+    }
+    ABT_mutex_unlock(aid->fd_cache_mutex);
+
+    fd_cache_close(aid, closing);
+    return n;
+}
+
+/* closes what is left in the cache at finalize */
+static void fd_cache_free(struct abt_io_instance *aid)
+{
+    struct abt_io_fd_cache *c = aid->fd_cache;
+    int i;
+
+    if (c == NULL) return;
+    for (i = 0; i < c->by_fd_size; i++) {
+        if (c->by_fd[i] != NULL) {
+            close(i);
+            free(c->by_fd[i]);
+        }
+    }
+    free(c->by_fd);
+    free(c->buckets);
+    free(c);
+    aid->fd_cache = NULL;
+}
+
+int abt_io_prealloc_enable(abt_io_instance_id aid, int fd, size_t chunk_size)
+{
+    struct abt_io_prealloc *p;
+    struct stat st;
+
+    if (chunk_size == 0) return -EINVAL;
+    if (fstat(fd, &st) < 0) return -errno;
+    p = prealloc_fd_slot(aid, fd, 1);
+    if (p == NULL) return fd < 0 ? -EINVAL : -ENOMEM;
+
+    ABT_mutex_lock(aid->prealloc_mutex);
+    if (p->enabled) {
+        ABT_mutex_unlock(aid->prealloc_mutex);
+        return -EEXIST;
+    }
+    /* chunk goes last: writers take a non-zero chunk to mean the rest is
+     * set up */
+    p->fd = fd;
+    __atomic_store_n(&p->end, st.st_size, __ATOMIC_RELEASE);
+    p->enabled = 1;
+    __atomic_store_n(&p->chunk, chunk_size, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&aid->prealloc_count, 1, __ATOMIC_RELAXED);
+    ABT_mutex_unlock(aid->prealloc_mutex);
+
+    return 0;
+}
+
+int abt_io_prealloc_disable(abt_io_instance_id aid, int fd)
+{
+    int ret = -1;
+
+    if (!prealloc_remove(aid, fd)) return -ENOENT;
+
+    issue_ftruncate(select_target(aid, fd, NULL), NULL, fd, -1, &ret);
+    return ret;
+}
+
+struct abt_io_log_range
+{
+    off_t start;
+    off_t end;
+    struct abt_io_log_range *next;
+};
+
+struct abt_io_log
+{
+    int fd;
+    off_t tail;         /* next offset to hand out; atomic fetch-and-add */
+    off_t durable;      /* contiguous completion watermark */
+    struct abt_io_prealloc prealloc;
+    ABT_mutex mutex;    /* protects pending and error */
+    struct abt_io_log_range *pending; /* completed ranges above durable */
+    int error;          /* -errno of the first failed append, if any */
+};
+
+abt_io_log_t* abt_io_log_create(int fd, off_t start_offset, size_t prealloc_size)
+{
+    struct abt_io_log *log;
+    int ret;
+
+    if (fd < 0 || start_offset < 0) return NULL;
+
+    log = calloc(1, sizeof(*log));
+    if (log == NULL) return NULL;
+
+    ret = ABT_mutex_create(&log->mutex);
+    if (ret != ABT_SUCCESS) { free(log); return NULL; }
+
+    log->fd = fd;
+    log->tail = start_offset;
+    log->durable = start_offset;
+    log->prealloc.fd = fd;
+    log->prealloc.chunk = prealloc_size;
+    log->prealloc.end = start_offset;
+
+    return log;
+}
+
+void abt_io_log_free(abt_io_log_t* log)
+{
+    struct abt_io_log_range *range;
+
+    while ((range = log->pending) != NULL) {
+        log->pending = range->next;
+        free(range);
+    }
+    ABT_mutex_free(&log->mutex);
+    free(log);
+}
+
+off_t abt_io_log_durable_offset(abt_io_log_t* log)
+{
+    return __atomic_load_n(&log->durable, __ATOMIC_ACQUIRE);
+}
+
+/* Records a finished append and advances the watermark over any ranges that
+ * are now contiguous with it.  A failed range leaves a gap the watermark can
+ * never cross, so the first failure puts the log into a failed state: the
+ * ranges waiting above the gap are released, later completions are dropped
+ * and new appends are refused.
+ */
+static void abt_io_log_complete(struct abt_io_log *log,
+        struct abt_io_log_range *range, int err)
+{
+    struct abt_io_log_range **pp;
+    struct abt_io_log_range *done = NULL;
+    off_t durable;
+
+    ABT_mutex_spinlock(log->mutex);
+    durable = log->durable;
+    if (err != 0 || log->error != 0) {
+        if (log->error == 0) {
+            __atomic_store_n(&log->error, err, __ATOMIC_RELEASE);
+            done = log->pending;
+            log->pending = NULL;
+        }
+        range->next = done;
+        done = range;
+    }
+    else if (range->start == durable) {
+        durable = range->end;
+        range->next = NULL;
+        done = range;
+        while (log->pending && log->pending->start == durable) {
+            range = log->pending;
+            log->pending = range->next;
+            durable = range->end;
+            range->next = done;
+            done = range;
+        }
+        __atomic_store_n(&log->durable, durable, __ATOMIC_RELEASE);
+    }
+    else {
+        /* only appends still in flight can be below range, so the list is
+         * bounded by the number of concurrent appends */
+        pp = &log->pending;
+        while (*pp && (*pp)->start < range->start) pp = &(*pp)->next;
+        range->next = *pp;
+        *pp = range;
+    }
+    ABT_mutex_unlock(log->mutex);
+
+    while ((range = done) != NULL) {
+        done = range->next;
+        free(range);
+    }
+    return;
+}
+
+struct abt_io_append_state
+{
+    ssize_t *ret;
+    struct abt_io_log *log;
+    const void *buf;
+    size_t count;
+    off_t offset;
+    struct abt_io_log_range *range;
+    struct abt_io_completion *completion;
+};
+
+static void abt_io_append_fn(void *foo)
+{
+    struct abt_io_append_state *state = foo;
+    const char *buf = state->buf;
+    size_t done = 0;
+    ssize_t rc = 0;
+
+    if (prealloc_claim(&state->log->prealloc, state->offset + state->count))
+        prealloc_extend(&state->log->prealloc, state->offset + state->count);
+
+    while (done < state->count) {
+        rc = pwrite(state->log->fd, buf + done, state->count - done,
+                state->offset + done);
+        if (rc < 0 && errno == EINTR) continue;
+        if (rc <= 0) break;
+        done += rc;
+    }
+    if (done == state->count)
+        *state->ret = done;
+    else
+        *state->ret = rc < 0 ? -errno : -ENOSPC;
+
+    abt_io_log_complete(state->log, state->range,
+            done == state->count ? 0 : (int)*state->ret);
+
+    completion_signal(state->completion);
+    return;
+}
+
+static int issue_append(struct abt_io_target t, abt_io_op_t *op, struct abt_io_log *log,
+        const void *buf, size_t count, off_t *offset, ssize_t *ret)
+{
+    struct abt_io_append_state state;
+    struct abt_io_append_state *pstate = NULL;
+    struct abt_io_completion completion;
+    struct abt_io_log_range *range = NULL;
+    int rc;
+
+    if (op == NULL) pstate = &state;
+    else
+    {
+        pstate = op_state_alloc(op, sizeof(*pstate));
+        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+    }
+
+    *ret = __atomic_load_n(&log->error, __ATOMIC_ACQUIRE);
+    if (*ret != 0) goto err;
+    *ret = -ENOSYS;
+    pstate->range = range = malloc(sizeof(*range));
+    if (range == NULL) { *ret = -ENOMEM; goto err; }
+    pstate->completion = op != NULL ? &op->c : &completion;
+    completion_init(pstate->completion, &t.aid->waiters, t.home);
+
+    /* nothing can fail between here and task creation, so the reserved
+     * range is either written or explicitly dropped below */
+    *offset = __atomic_fetch_add(&log->tail, (off_t)count, __ATOMIC_RELAXED);
+    range->start = *offset;
+    range->end = *offset + count;
+
+    pstate->ret = ret;
+    pstate->log = log;
+    pstate->buf = buf;
+    pstate->count = count;
+    pstate->offset = *offset;
+
+    rc = submit(t, abt_io_append_fn, pstate);
+    if(rc != ABT_SUCCESS) {
+        abt_io_log_complete(log, range, -EINVAL);
+        range = NULL;
+        *ret = -EINVAL;
+        goto err;
+    }
+    range = NULL;
+
+    if (op == NULL) {
+        completion_wait(pstate->completion);
+    }
+    else {
+        op->state = pstate;
+        op->free_fn = free;
+    }
+
+    return 0;
+err:
+    if (op != NULL) op_state_free(op, pstate);
+    free(range);
+    return -1;
+}
+
+ssize_t abt_io_append(abt_io_instance_id aid, abt_io_log_t* log,
+        const void *buf, size_t count, off_t *offset)
+{
+    ssize_t ret = -1;
+    issue_append(select_target(aid, log->fd, buf), NULL, log, buf, count, offset, &ret);
+    return ret;
+}
+
+abt_io_op_t* abt_io_append_nb(abt_io_instance_id aid, abt_io_log_t* log,
+        const void *buf, size_t count, off_t *offset, ssize_t *ret)
+{
+    abt_io_op_t *op;
+    int iret;
+
+    op = op_alloc(aid);
+    if (op == NULL) return NULL;
+
+    iret = issue_append(select_target(aid, log->fd, buf), op, log, buf, count, offset, ret);
+    if (iret != 0) { op_release(op); return NULL; }
+    else return op;
+}
+
+#define ABT_IO_CHAIN_OPEN   0
+#define ABT_IO_CHAIN_PREAD  1
+#define ABT_IO_CHAIN_PWRITE 2
+#define ABT_IO_CHAIN_CLOSE  3
+
+struct abt_io_chain_step
+{
+    int type;
+    int fd;
+    const char *pathname;
+    int flags;
+    mode_t mode;
+    void *buf;
+    size_t count;
+    off_t offset;
+    int trim;
+    int *iret;
+    ssize_t *sret;
+};
+
+struct abt_io_chain
+{
+    struct abt_io_instance *aid;
+    struct abt_io_chain_step *steps;
+    int nsteps;
+    int cap;
+    int has_open;
+    int *ret;
+    struct abt_io_completion *completion;
+};
+
+abt_io_chain_t* abt_io_chain_create(abt_io_instance_id aid)
+{
+    abt_io_chain_t *chain;
+
+    chain = calloc(1, sizeof(*chain));
+    if (chain == NULL) return NULL;
+    chain->aid = aid;
+    return chain;
+}
+
+void abt_io_chain_free(abt_io_chain_t* chain)
+{
+    if (chain == NULL) return;
+    free(chain->steps);
+    free(chain);
+}
+
+static int chain_append(abt_io_chain_t *chain, int type, int fd,
+        struct abt_io_chain_step **sp)
+{
+    struct abt_io_chain_step *steps;
+    struct abt_io_chain_step *s;
+    int cap;
+
+    /* ABT_IO_CHAIN_FD needs an earlier open to take the fd from */
+    if (fd < 0 && (fd != ABT_IO_CHAIN_FD || !chain->has_open)) return -EINVAL;
+
+    if (chain->nsteps == chain->cap) {
+        cap = chain->cap ? chain->cap * 2 : 4;
+        steps = realloc(chain->steps, cap * sizeof(*steps));
+        if (steps == NULL) return -ENOMEM;
+        chain->steps = steps;
+        chain->cap = cap;
+    }
+    s = &chain->steps[chain->nsteps++];
+    memset(s, 0, sizeof(*s));
+    s->type = type;
+    s->fd = fd;
+    *sp = s;
+    return 0;
+}
+
+int abt_io_chain_open(abt_io_chain_t* chain, const char* pathname, int flags,
+        mode_t mode, int *ret)
+{
+    struct abt_io_chain_step *s;
+    int rc;
+
+    rc = chain_append(chain, ABT_IO_CHAIN_OPEN, 0, &s);
+    if (rc != 0) return rc;
+    s->pathname = pathname;
+    s->flags = flags;
+    s->mode = mode;
+    s->iret = ret;
+    chain->has_open = 1;
+    return 0;
+}
+
+int abt_io_chain_pread(abt_io_chain_t* chain, int fd, void *buf, size_t count,
+        off_t offset, ssize_t *ret)
+{
+    struct abt_io_chain_step *s;
+    int rc;
+
+    rc = chain_append(chain, ABT_IO_CHAIN_PREAD, fd, &s);
+    if (rc != 0) return rc;
+    s->buf = buf;
+    s->count = count;
+    s->offset = offset;
+    s->sret = ret;
+    return 0;
+}
+
+int abt_io_chain_pwrite(abt_io_chain_t* chain, int fd, const void *buf,
+        size_t count, off_t offset, ssize_t *ret)
+{
+    struct abt_io_chain_step *s;
+    int rc;
+
+    rc = chain_append(chain, ABT_IO_CHAIN_PWRITE, fd, &s);
+    if (rc != 0) return rc;
+    s->buf = (void*)buf;
+    s->count = count;
+    s->offset = offset;
+    s->sret = ret;
+    return 0;
+}
+
+int abt_io_chain_close(abt_io_chain_t* chain, int fd, int *ret)
+{
+    struct abt_io_chain_step *s;
+    int rc;
+
+    rc = chain_append(chain, ABT_IO_CHAIN_CLOSE, fd, &s);
+    if (rc != 0) return rc;
+    s->iret = ret;
+    return 0;
+}
+
+/* runs every step back to back on the backing xstream that picked up the
+ * chain; once a step fails the rest report -ECANCELED, except that a close
+ * of an fd the chain opened still runs so that the fd is not leaked */
+static void abt_io_chain_fn(void *foo)
+{
+    struct abt_io_chain *chain = foo;
+    struct abt_io_chain_step *s;
+    ssize_t r;
+    int fd = -1;
+    int err = 0;
+    int i;
+
+    for (i = 0; i < chain->nsteps; i++) {
+        s = &chain->steps[i];
+        if (err != 0 && !(s->type == ABT_IO_CHAIN_CLOSE &&
+                    s->fd == ABT_IO_CHAIN_FD && fd >= 0))
+            r = -ECANCELED;
+        else {
+            int sfd = s->fd == ABT_IO_CHAIN_FD ? fd : s->fd;
+
+            switch (s->type) {
+            case ABT_IO_CHAIN_OPEN:
+                r = open(s->pathname, s->flags, s->mode);
+                break;
+            case ABT_IO_CHAIN_PREAD:
+                r = pread(sfd, s->buf, s->count, s->offset);
+                break;
+            case ABT_IO_CHAIN_PWRITE:
+                r = pwrite(sfd, s->buf, s->count, s->offset);
+                break;
+            default:
+                if (s->trim) prealloc_trim(sfd);
+                r = close(sfd);
+                if (s->fd == ABT_IO_CHAIN_FD) fd = -1;
+                break;
+            }
+            if (r < 0) r = -errno;
+            else if (s->type == ABT_IO_CHAIN_OPEN) fd = r;
+        }
 
-    *state->ret = open(state->pathname, state->flags, state->mode);
-    if(*state->ret < 0)
-        *state->ret = -errno;
+        if (s->iret != NULL) *s->iret = r;
+        if (s->sret != NULL) *s->sret = r;
+        if (r < 0 && err == 0) err = r;
+    }
 
-    ABT_eventual_set(state->eventual, NULL, 0);
+    *chain->ret = err;
+    completion_signal(chain->completion);
     return;
 }
 
-static int issue_open(ABT_pool pool, abt_io_op_t *op, const char* pathname, int flags, mode_t mode, int *ret)
+static int issue_chain(struct abt_io_target t, abt_io_op_t *op,
+        abt_io_chain_t *chain, int *ret)
 {
-    struct abt_io_open_state state;
-    struct abt_io_open_state *pstate = NULL;
+    struct abt_io_completion completion;
     int rc;
 
-    if (op == NULL) pstate = &state;
-    else
-    {
-        pstate = malloc(sizeof(*pstate));
-        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
-    }
-
     *ret = -ENOSYS;
-    pstate->ret = ret;
-    pstate->pathname = pathname;
-    pstate->flags = flags;
-    pstate->mode = mode;
-    pstate->eventual = NULL;
-    rc = ABT_eventual_create(0, &pstate->eventual);
-    if (rc != ABT_SUCCESS) { *ret = -ENOMEM; goto err; }
+    chain->ret = ret;
+    chain->completion = op != NULL ? &op->c : &completion;
+    completion_init(chain->completion, &t.aid->waiters, t.home);
 
-    if (op != NULL) op->e = pstate->eventual;
-
-    rc = ABT_task_create(pool, abt_io_open_fn, pstate, NULL);
-    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+    rc = submit(t, abt_io_chain_fn, chain);
+    if(rc != ABT_SUCCESS) { *ret = -EINVAL; return -1; }
 
     if (op == NULL) {
-        rc = ABT_eventual_wait(pstate->eventual, NULL);
-        // what error should we use here?
-        if (rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+        completion_wait(chain->completion);
     }
     else {
-        op->e = pstate->eventual;
-        op->state = pstate;
+        /* the chain belongs to the caller */
+        op->state = NULL;
         op->free_fn = free;
     }
 
     return 0;
-err:
-    if (pstate->eventual != NULL) ABT_eventual_free(&pstate->eventual);
-    if (pstate != NULL && op != NULL) free(pstate);
-    return -1;
 }
 
-int abt_io_open(abt_io_instance_id aid, const char* pathname, int flags, mode_t mode)
+/* does the per-fd bookkeeping that the individual wrappers do in the
+ * caller, for steps on fds that were opened outside the chain */
+static struct abt_io_target chain_prepare(abt_io_chain_t *chain)
 {
-    int ret;
-    issue_open(aid->progress_pool, NULL, pathname, flags, mode, &ret);
+    struct abt_io_chain_step *s;
+    int fd = -1;
+    int i;
+
+    for (i = 0; i < chain->nsteps; i++) {
+        s = &chain->steps[i];
+        if (s->type == ABT_IO_CHAIN_OPEN || s->fd < 0) continue;
+        if (fd < 0) fd = s->fd;
+        if (s->type == ABT_IO_CHAIN_PWRITE)
+            prealloc_note_write(chain->aid, s->fd, s->offset + s->count);
+        else if (s->type == ABT_IO_CHAIN_CLOSE) {
+            s->trim = prealloc_remove(chain->aid, s->fd);
+            numa_fd_forget(chain->aid, s->fd);
+            nowait_fd_forget(chain->aid, s->fd);
+        }
+    }
+
+    return select_target(chain->aid, fd, NULL);
+}
+
+int abt_io_chain_execute(abt_io_chain_t* chain)
+{
+    int ret = -1;
+
+    if (chain->nsteps == 0) return 0;
+    issue_chain(chain_prepare(chain), NULL, chain, &ret);
     return ret;
 }
 
-abt_io_op_t* abt_io_open_nb(abt_io_instance_id aid, const char* pathname, int flags, mode_t mode, int *ret)
+abt_io_op_t* abt_io_chain_execute_nb(abt_io_chain_t* chain, int *ret)
 {
     abt_io_op_t *op;
     int iret;
 
-    op = malloc(sizeof(*op));
+    op = op_alloc(chain->aid);
     if (op == NULL) return NULL;
 
-    iret = issue_open(aid->progress_pool, op, pathname, flags, mode, ret);
-    if (iret != 0) { free(op); return NULL; }
+    iret = issue_chain(chain_prepare(chain), op, chain, ret);
+    if (iret != 0) { op_release(op); return NULL; }
     else return op;
 }
 
-struct abt_io_pread_state
+int abt_io_op_wait(abt_io_op_t* op)
+{
+    completion_wait(&op->c);
+    return 0;
+}
+
+void abt_io_op_free(abt_io_op_t* op)
+{
+    if (op->state != (void*)&op->inline_state) op->free_fn(op->state);
+    op_release(op);
+}
+
+
+// =e
+// READ syscall
+struct abt_io_read_state
 {
     ssize_t *ret;
     int fd;
     void *buf;
     size_t count;
-    off_t offset;
-    ABT_eventual eventual;
+    struct abt_io_completion *completion;
 };
 
-static void abt_io_pread_fn(void *foo)
+static void abt_io_read_fn(void *foo)
 {
-    struct abt_io_pread_state *state = foo;
+    struct abt_io_read_state *state = foo;
 
-    *state->ret = pread(state->fd, state->buf, state->count, state->offset);
+    *state->ret = read(state->fd, state->buf, state->count);
     if(*state->ret < 0)
         *state->ret = -errno;
 
-    ABT_eventual_set(state->eventual, NULL, 0);
+    completion_signal(state->completion);
     return;
 }
 
-static int issue_pread(ABT_pool pool, abt_io_op_t *op, int fd, void *buf,
-        size_t count, off_t offset, ssize_t *ret)
+static int issue_read(struct abt_io_target t, abt_io_op_t *op, int fd, void *buf,
+        size_t count, ssize_t *ret)
 {
-    struct abt_io_pread_state state;
-    struct abt_io_pread_state *pstate = NULL;
+    struct abt_io_read_state state;
+    struct abt_io_read_state *pstate = NULL;
+    struct abt_io_completion completion;
     int rc;
 
     if (op == NULL) pstate = &state;
     else
     {
-        pstate = malloc(sizeof(*pstate));
+        pstate = op_state_alloc(op, sizeof(*pstate));
         if (pstate == NULL) { *ret = -ENOMEM; goto err; }
     }
 
@@ -237,90 +5059,69 @@ static int issue_pread(ABT_pool pool, abt_io_op_t *op, int fd, void *buf,
     pstate->fd = fd;
     pstate->buf = buf;
     pstate->count = count;
-    pstate->offset = offset;
-    pstate->eventual = NULL;
-    rc = ABT_eventual_create(0, &pstate->eventual);
-    if (rc != ABT_SUCCESS) { *ret = -ENOMEM; goto err; }
+    pstate->completion = op != NULL ? &op->c : &completion;
+    completion_init(pstate->completion, &t.aid->waiters, t.home);
 
-    if (op != NULL) op->e = pstate->eventual;
-
-    rc = ABT_task_create(pool, abt_io_pread_fn, pstate, NULL);
+    rc = submit(t, abt_io_read_fn, pstate);
     if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
 
     if (op == NULL) {
-        rc = ABT_eventual_wait(pstate->eventual, NULL);
-        // what error should we use here?
-        if (rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+        completion_wait(pstate->completion);
     }
     else {
-        op->e = pstate->eventual;
         op->state = pstate;
         op->free_fn = free;
     }
 
     return 0;
 err:
-    if (pstate->eventual != NULL) ABT_eventual_free(&pstate->eventual);
-    if (pstate != NULL && op != NULL) free(pstate);
+    if (op != NULL) op_state_free(op, pstate);
     return -1;
 }
 
-ssize_t abt_io_pread(abt_io_instance_id aid, int fd, void *buf,
-        size_t count, off_t offset)
+ssize_t abt_io_read(abt_io_instance_id aid, int fd, void *buf, size_t count)
 {
     ssize_t ret = -1;
-    issue_pread(aid->progress_pool, NULL, fd, buf, count, offset, &ret);
+    issue_read(select_target(aid, fd, buf), NULL, fd, buf, count, &ret);
     return ret;
 }
 
-abt_io_op_t* abt_io_pread_nb(abt_io_instance_id aid, int fd, void *buf,
-        size_t count, off_t offset, ssize_t *ret)
-{
-    abt_io_op_t *op;
-    int iret;
-
-    op = malloc(sizeof(*op));
-    if (op == NULL) return NULL;
-
-    iret = issue_pread(aid->progress_pool, op, fd, buf, count, offset, ret);
-    if (iret != 0) { free(op); return NULL; }
-    else return op;
-}
 
+// WRITE system call
 
-struct abt_io_pwrite_state
+struct abt_io_write_state
 {
     ssize_t *ret;
     int fd;
     const void *buf;
     size_t count;
-    off_t offset;
-    ABT_eventual eventual;
+    struct abt_io_completion *completion;
 };
 
-static void abt_io_pwrite_fn(void *foo)
+static void abt_io_write_fn(void *foo)
 {
-    struct abt_io_pwrite_state *state = foo;
+    struct abt_io_write_state *state = foo;
 
-    *state->ret = pwrite(state->fd, state->buf, state->count, state->offset);
+    *state->ret = write(state->fd, state->buf, state->count);
     if(*state->ret < 0)
         *state->ret = -errno;
 
-    ABT_eventual_set(state->eventual, NULL, 0);
+    completion_signal(state->completion);
     return;
-}
+};
 
-static int issue_pwrite(ABT_pool pool, abt_io_op_t *op, int fd, const void *buf,
-        size_t count, off_t offset, ssize_t *ret)
+static int issue_write(struct abt_io_target t, abt_io_op_t *op, int fd, const void *buf,
+        size_t count, ssize_t *ret)
 {
-    struct abt_io_pwrite_state state;
-    struct abt_io_pwrite_state *pstate = NULL;
+    struct abt_io_write_state state;
+    struct abt_io_write_state *pstate = NULL;
+    struct abt_io_completion completion;
     int rc;
 
     if (op == NULL) pstate = &state;
     else
     {
-        pstate = malloc(sizeof(*pstate));
+        pstate = op_state_alloc(op, sizeof(*pstate));
         if (pstate == NULL) { *ret = -ENOMEM; goto err; }
     }
 
@@ -329,586 +5130,1264 @@ static int issue_pwrite(ABT_pool pool, abt_io_op_t *op, int fd, const void *buf,
     pstate->fd = fd;
     pstate->buf = buf;
     pstate->count = count;
-    pstate->offset = offset;
-    pstate->eventual = NULL;
-    rc = ABT_eventual_create(0, &pstate->eventual);
-    if (rc != ABT_SUCCESS) { *ret = -ENOMEM; goto err; }
-
-    if (op != NULL) op->e = pstate->eventual;
+    pstate->completion = op != NULL ? &op->c : &completion;
+    completion_init(pstate->completion, &t.aid->waiters, t.home);
 
-    rc = ABT_task_create(pool, abt_io_pwrite_fn, pstate, NULL);
+    rc = submit(t, abt_io_write_fn, pstate);
     if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
 
     if (op == NULL) {
-        rc = ABT_eventual_wait(pstate->eventual, NULL);
-        // what error should we use here?
-        if (rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+        completion_wait(pstate->completion);
     }
     else {
-        op->e = pstate->eventual;
         op->state = pstate;
         op->free_fn = free;
     }
 
     return 0;
 err:
-    if (pstate->eventual != NULL) ABT_eventual_free(&pstate->eventual);
-    if (pstate != NULL && op != NULL) free(pstate);
+    if (op != NULL) op_state_free(op, pstate);
     return -1;
 }
 
-ssize_t abt_io_pwrite(abt_io_instance_id aid, int fd, const void *buf,
-        size_t count, off_t offset)
+ssize_t abt_io_write(abt_io_instance_id aid, int fd, const void *buf,
+        size_t count)
 {
     ssize_t ret = -1;
-    issue_pwrite(aid->progress_pool, NULL, fd, buf, count, offset, &ret);
+    issue_write(select_target(aid, fd, buf), NULL, fd, buf, count, &ret);
     return ret;
 }
 
-abt_io_op_t* abt_io_pwrite_nb(abt_io_instance_id aid, int fd, const void *buf,
-        size_t count, off_t offset, ssize_t *ret)
+////////////////////////////////////////////
+
+/* Socket reactor.  One listener ULT on a dedicated xstream waits on an
+ * edge-triggered epoll set and hands readiness to the ULTs blocked on each
+ * connection.  Per-fd state lives in a table indexed by fd and allocated in
+ * chunks on first use, so memory grows with the highest registered fd and
+ * a connection costs one compact slot.  Handles carry the slot's
+ * generation, which is odd while the fd is registered, so that a handle
+ * kept past deregistration cannot reach whatever reuses the fd.
+ */
+#define ABT_IO_CONN_CHUNK_SHIFT 12
+#define ABT_IO_CONN_CHUNK (1 << ABT_IO_CONN_CHUNK_SHIFT)
+#define ABT_IO_CONN_MAX_FDS (1 << 24)
+#define ABT_IO_REACTOR_EVENTS 1024
+#define ABT_IO_REACTOR_WAKE UINT64_MAX    /* epoll data of the wakeup fd */
+
+#define CONN_FD(_h) ((int)((_h) & 0xffffffff))
+#define CONN_GEN(_h) ((uint32_t)((_h) >> 32))
+
+#define ABT_IO_CONN_RD 0
+#define ABT_IO_CONN_WR 1
+
+struct abt_io_conn
 {
-    abt_io_op_t *op;
-    int iret;
+    uint32_t gen;
+    int lock;
+    uint32_t events;        /* ABT_IO_SOCK_* interest */
+    uint32_t ready;         /* readiness edges no waiter has consumed yet */
+    int error;              /* socket error delivered to waiters, or 0 */
+    ABT_pool home;          /* pool of the xstream that last did I/O */
+    struct abt_io_completion *waiter[2];
+    struct abt_io_outq *outq;   /* output queue, allocated on first send */
+    struct abt_io_inbuf *inbuf; /* receive buffer, allocated on first peek */
+};
 
-    op = malloc(sizeof(*op));
-    if (op == NULL) return NULL;
+/* Receive buffer.  abt_io_sock_peek fills it with reads as large as the
+ * free space allows, so a parser pulling headers and bodies out of a
+ * pipelined stream costs one read per readiness event rather than one per
+ * field.  Data is kept contiguous: consumed space at the front is reclaimed
+ * by sliding the remainder down when the tail runs out of room.
+ */
+#define ABT_IO_INBUF_SIZE 65536
 
-    iret = issue_pwrite(aid->progress_pool, op, fd, buf, count, offset, ret);
-    if (iret != 0) { free(op); return NULL; }
-    else return op;
-}
+struct abt_io_inbuf
+{
+    size_t size;
+    size_t start;           /* first unconsumed byte */
+    size_t end;             /* end of buffered data */
+    int eof;
+    char *data;
+};
 
-struct abt_io_mkostemp_state
+/* Output queue.  abt_io_sock_send copies data into a chain of buffers and
+ * whoever finds the queue idle becomes its flusher, gathering everything
+ * queued so far into one sendmsg; data appended meanwhile rides along with
+ * the next one.  When the socket fills, the listener resumes flushing on
+ * EPOLLOUT and senders park while more than high_water bytes are queued.
+ */
+#define ABT_IO_OUTQ_CHUNK 16384
+#define ABT_IO_OUTQ_HIGH_WATER (256 * 1024)
+#define ABT_IO_OUTQ_IOV 64
+
+struct abt_io_outbuf
 {
-    int *ret;
-    char *template;
-    int flags;
-    ABT_eventual eventual;
+    struct abt_io_outbuf *next;
+    size_t size;
+    size_t len;             /* bytes appended */
+    size_t off;             /* bytes already sent */
+    char data[];
 };
 
-static void abt_io_mkostemp_fn(void *foo)
+struct abt_io_outwait
 {
-    struct abt_io_mkostemp_state *state = foo;
+    struct abt_io_completion done;
+    int flush;              /* wait for an empty queue, not the high-water mark */
+    struct abt_io_outwait *next;
+};
 
-#ifdef HAVE_MKOSTEMP
-    *state->ret = mkostemp(state->template, state->flags);
-#else
-    *state->ret = mkstemp(state->template);
-#endif
-    if(*state->ret < 0)
-        *state->ret = -errno;
+struct abt_io_outq
+{
+    int lock;
+    int flushing;           /* a flusher is running */
+    int again;              /* writability was reported during a flush */
+    int error;              /* sticky send error, or 0 */
+    size_t queued;
+    size_t high_water;
+    struct abt_io_outbuf *head, *tail;
+    struct abt_io_outwait *waiters;
+};
 
-    ABT_eventual_set(state->eventual, NULL, 0);
-    return;
+struct abt_io_reactor
+{
+    int epfd;
+    int wakefd;
+    int max_events;
+    int stop;
+    int home_affinity;
+    int parked;             /* callers blocked in conn_wait or outq_wait */
+    uint64_t poll_ns;       /* busy-poll window after the last event */
+    int sock_busy_poll_us;  /* SO_BUSY_POLL for newly registered sockets */
+    ABT_xstream xstream;
+    ABT_thread listener;
+    struct abt_io_waiters waiters;
+    struct abt_io_conn **chunks;
+    int num_chunks;
+};
+
+static struct abt_io_reactor *reactor;
+
+/* Message buffer pool.  Buffers come in power-of-two size classes, each
+ * with a short free list, so that the buffers a server receives into are
+ * recycled rather than going back to malloc; payloads past the largest
+ * class are allocated and freed directly.
+ */
+#define ABT_IO_MSG_MIN_SHIFT 8
+#define ABT_IO_MSG_CLASSES 13      /* 256 B .. 1 MiB */
+#define ABT_IO_MSG_POOL_MAX 64     /* free buffers kept per class */
+#define ABT_IO_MSG_HDR 4
+
+struct abt_io_msgbuf
+{
+    struct abt_io_msgbuf *next;
+    size_t cls;                     /* size class, or ABT_IO_MSG_CLASSES */
+    char data[];
+};
+
+static struct
+{
+    int lock;
+    int count;
+    struct abt_io_msgbuf *free;
+} msg_pool[ABT_IO_MSG_CLASSES];
+
+static inline void conn_lock(struct abt_io_conn *c)
+{
+    spin_lock(&c->lock);
 }
 
-static int issue_mkostemp(ABT_pool pool, abt_io_op_t *op, char* template, int flags, int *ret)
+static inline void conn_unlock(struct abt_io_conn *c)
 {
-    struct abt_io_mkostemp_state state;
-    struct abt_io_mkostemp_state *pstate = NULL;
-    int rc;
+    spin_unlock(&c->lock);
+}
 
-    if (op == NULL) pstate = &state;
-    else
-    {
-        pstate = malloc(sizeof(*pstate));
-        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+static void outq_flush(abt_io_conn_t conn, struct abt_io_outq *q);
+
+/* returns the slot for fd, allocating its chunk if alloc is set */
+static struct abt_io_conn* conn_slot(int fd, int alloc)
+{
+    struct abt_io_conn *chunk, *expected = NULL;
+    int i = fd >> ABT_IO_CONN_CHUNK_SHIFT;
+
+    if (reactor == NULL || fd < 0 || i >= reactor->num_chunks) return NULL;
+    chunk = __atomic_load_n(&reactor->chunks[i], __ATOMIC_ACQUIRE);
+    if (chunk == NULL && alloc) {
+        chunk = calloc(ABT_IO_CONN_CHUNK, sizeof(*chunk));
+        if (chunk == NULL) return NULL;
+        if (!__atomic_compare_exchange_n(&reactor->chunks[i], &expected, chunk,
+                    0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            free(chunk);
+            chunk = expected;
+        }
     }
+    return chunk == NULL ? NULL : &chunk[fd & (ABT_IO_CONN_CHUNK - 1)];
+}
 
-    *ret = -ENOSYS;
-    pstate->ret = ret;
-    pstate->template = template;
-    pstate->flags = flags;
-    pstate->eventual = NULL;
-    rc = ABT_eventual_create(0, &pstate->eventual);
-    if (rc != ABT_SUCCESS) { *ret = -ENOMEM; goto err; }
+/* returns the slot of a live handle, or NULL */
+static struct abt_io_conn* conn_get(abt_io_conn_t conn)
+{
+    struct abt_io_conn *c = conn_slot(CONN_FD(conn), 0);
 
-    if (op != NULL) op->e = pstate->eventual;
+    if (c == NULL || __atomic_load_n(&c->gen, __ATOMIC_ACQUIRE) != CONN_GEN(conn))
+        return NULL;
+    return c;
+}
 
-    rc = ABT_task_create(pool, abt_io_mkostemp_fn, pstate, NULL);
-    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+static uint32_t conn_epoll_events(uint32_t events)
+{
+    uint32_t ev = EPOLLET | EPOLLRDHUP;
 
-    if (op == NULL) {
-        rc = ABT_eventual_wait(pstate->eventual, NULL);
-        // what error should we use here?
-        if (rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
-    }
+    if (events & ABT_IO_SOCK_READ) ev |= EPOLLIN;
+    if (events & ABT_IO_SOCK_WRITE) ev |= EPOLLOUT;
+    return ev;
+}
+
+/* Waits until the connection is ready in one direction, consuming a
+ * readiness edge that arrived before the caller got there.  Returns 0, or
+ * -errno if the socket has an error or the handle went stale.
+ */
+static int conn_wait(abt_io_conn_t conn, int dir)
+{
+    struct abt_io_conn *c;
+    struct abt_io_completion done;
+    uint32_t bit = dir == ABT_IO_CONN_RD ? EPOLLIN : EPOLLOUT;
+    int ret = 0;
+
+    c = conn_slot(CONN_FD(conn), 0);
+    if (c == NULL) return -EBADF;
+
+    conn_lock(c);
+    if (c->gen != CONN_GEN(conn)) ret = -EBADF;
+    else if (c->error) ret = c->error;
+    else if (c->ready & bit) c->ready &= ~bit;
+    else if (c->waiter[dir] != NULL) ret = -EBUSY;
+    else if (__atomic_load_n(&reactor->stop, __ATOMIC_ACQUIRE)) ret = -ESHUTDOWN;
     else {
-        op->e = pstate->eventual;
-        op->state = pstate;
-        op->free_fn = free;
+        completion_init(&done, &reactor->waiters,
+                reactor->home_affinity ? c->home : ABT_POOL_NULL);
+        c->waiter[dir] = &done;
+        __atomic_fetch_add(&reactor->parked, 1, __ATOMIC_RELAXED);
+        conn_unlock(c);
+
+        completion_wait(&done);
+
+        conn_lock(c);
+        if (c->gen != CONN_GEN(conn)) ret = -EBADF;
+        else if (c->error) ret = c->error;
+        conn_unlock(c);
+        /* finalize waits for this before it frees the connection */
+        __atomic_fetch_sub(&reactor->parked, 1, __ATOMIC_RELEASE);
+        return ret;
     }
-
-    return 0;
-err:
-    if (pstate->eventual != NULL) ABT_eventual_free(&pstate->eventual);
-    if (pstate != NULL && op != NULL) free(pstate);
-    return -1;
+    conn_unlock(c);
+    return ret;
 }
 
-int abt_io_mkostemp(abt_io_instance_id aid, char *template, int flags)
+/* notes the xstream that handled I/O on a connection */
+static void conn_note_home(abt_io_conn_t conn)
 {
-    int ret = -1;
-    issue_mkostemp(aid->progress_pool, NULL, template, flags, &ret);
-    return ret;
+    struct abt_io_conn *c;
+
+    if (!__atomic_load_n(&reactor->home_affinity, __ATOMIC_RELAXED)) return;
+    c = conn_get(conn);
+    if (c != NULL) __atomic_store_n(&c->home, home_pool(), __ATOMIC_RELAXED);
 }
 
-abt_io_op_t* abt_io_mkostemp_nb(abt_io_instance_id aid, char *template, int flags, int *ret)
+/* hands readiness reported by epoll to the connection's waiters */
+static void conn_deliver(uint64_t conn, uint32_t events)
 {
-    abt_io_op_t *op;
-    int iret;
+    struct abt_io_conn *c;
+    struct abt_io_completion *wake[2] = { NULL, NULL };
+    struct abt_io_outq *q;
+    uint32_t bits = 0;
+    socklen_t len;
+    int err = 0, dir;
+
+    c = conn_slot(CONN_FD(conn), 0);
+    if (c == NULL) return;
+
+    if (events & EPOLLERR) {
+        len = sizeof(err);
+        if (getsockopt(CONN_FD(conn), SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err == 0)
+            err = EIO;
+    }
+    /* a hangup or error makes both directions "ready" so that waiters find
+     * out from their next read or write, or from the error itself */
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) bits |= EPOLLIN;
+    if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) bits |= EPOLLOUT;
+
+    conn_lock(c);
+    if (c->gen != CONN_GEN(conn)) {
+        /* stale event for an fd that has since been deregistered */
+        conn_unlock(c);
+        return;
+    }
+    if (err) c->error = -err;
+    for (dir = ABT_IO_CONN_RD; dir <= ABT_IO_CONN_WR; dir++) {
+        uint32_t bit = dir == ABT_IO_CONN_RD ? EPOLLIN : EPOLLOUT;
+        if (!(bits & bit)) continue;
+        if (c->waiter[dir] != NULL) {
+            wake[dir] = c->waiter[dir];
+            c->waiter[dir] = NULL;
+        }
+        else
+            c->ready |= bit;
+    }
+    q = c->outq;
+    conn_unlock(c);
 
-    op = malloc(sizeof(*op));
-    if (op == NULL) return NULL;
+    for (dir = ABT_IO_CONN_RD; dir <= ABT_IO_CONN_WR; dir++)
+        if (wake[dir] != NULL) completion_signal(wake[dir]);
+    if (q != NULL && (bits & EPOLLOUT)) outq_flush(conn, q);
+    return;
+}
 
-    iret = issue_mkostemp(aid->progress_pool, op, template, flags, ret);
-    if (iret != 0) { free(op); return NULL; }
-    else return op;
+static void outq_free(struct abt_io_outq *q)
+{
+    struct abt_io_outbuf *b;
+
+    if (q == NULL) return;
+    while ((b = q->head) != NULL) {
+        q->head = b->next;
+        free(b);
+    }
+    free(q);
 }
 
-struct abt_io_unlink_state
+/* drops queued data; called with the queue locked and no flusher running */
+static void outq_drop(struct abt_io_outq *q)
 {
-    int *ret;
-    const char *pathname;
-    ABT_eventual eventual;
-};
+    struct abt_io_outbuf *b;
 
-static void abt_io_unlink_fn(void *foo)
+    while ((b = q->head) != NULL) {
+        q->head = b->next;
+        free(b);
+    }
+    q->tail = NULL;
+    q->queued = 0;
+}
+
+/* Appends the iovec minus its first skip bytes, topping up the last buffer
+ * first.  With at_head the data goes in front of everything queued
+ * instead.  Nothing is appended if memory runs out.  Called locked.
+ */
+static int outq_append(struct abt_io_outq *q, const struct iovec *iov,
+        int iovcnt, size_t skip, int at_head)
 {
-    struct abt_io_unlink_state *state = foo;
+    struct abt_io_outbuf *b = NULL, *t = at_head ? NULL : q->tail;
+    size_t count = 0, room, n, k;
+    const char *p;
+    int i;
 
-    *state->ret = unlink(state->pathname);
-    if(*state->ret < 0)
-        *state->ret = -errno;
+    for (i = 0; i < iovcnt; i++) count += iov[i].iov_len;
+    count -= skip;
+    if (count == 0) return 0;
+
+    room = t != NULL ? t->size - t->len : 0;
+    if (room < count) {
+        n = count - room > ABT_IO_OUTQ_CHUNK ? count - room : ABT_IO_OUTQ_CHUNK;
+        b = malloc(sizeof(*b) + n);
+        if (b == NULL) return -ENOMEM;
+        b->size = n;
+        b->len = b->off = 0;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        p = iov[i].iov_base;
+        n = iov[i].iov_len;
+        if (skip >= n) {
+            skip -= n;
+            continue;
+        }
+        p += skip;
+        n -= skip;
+        skip = 0;
+        if (room > 0) {
+            k = room < n ? room : n;
+            memcpy(t->data + t->len, p, k);
+            t->len += k;
+            room -= k;
+            p += k;
+            n -= k;
+        }
+        if (n > 0) {
+            memcpy(b->data + b->len, p, n);
+            b->len += n;
+        }
+    }
+    if (b != NULL && at_head) {
+        b->next = q->head;
+        q->head = b;
+        if (q->tail == NULL) q->tail = b;
+    }
+    else if (b != NULL) {
+        b->next = NULL;
+        if (q->tail != NULL) q->tail->next = b;
+        else q->head = b;
+        q->tail = b;
+    }
+    q->queued += count;
+    return 0;
+}
 
-    ABT_eventual_set(state->eventual, NULL, 0);
-    return;
+/* retires n sent bytes from the front of the queue; called locked */
+static void outq_consume(struct abt_io_outq *q, size_t n)
+{
+    struct abt_io_outbuf *b;
+    size_t k;
+
+    q->queued -= n;
+    while (n > 0) {
+        b = q->head;
+        k = b->len - b->off;
+        if (k > n) k = n;
+        b->off += k;
+        n -= k;
+        if (b->off == b->len && b != q->tail) {
+            q->head = b->next;
+            free(b);
+        }
+    }
+    /* keep the last buffer for further appends, but rewind it */
+    if (q->tail != NULL && q->tail->off == q->tail->len && q->tail == q->head)
+        q->tail->len = q->tail->off = 0;
 }
 
-static int issue_unlink(ABT_pool pool, abt_io_op_t *op, const char* pathname, int *ret)
+/* detaches the parked senders whose target has been reached; called locked */
+static struct abt_io_outwait* outq_take_waiters(struct abt_io_outq *q)
 {
-    struct abt_io_unlink_state state;
-    struct abt_io_unlink_state *pstate = NULL;
-    int rc;
+    struct abt_io_outwait *w, **pw = &q->waiters, *wake = NULL;
 
-    if (op == NULL) pstate = &state;
-    else
-    {
-        pstate = malloc(sizeof(*pstate));
-        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+    while ((w = *pw) != NULL) {
+        if (q->error || q->queued <= (w->flush ? 0 : q->high_water)) {
+            *pw = w->next;
+            w->next = wake;
+            wake = w;
+        }
+        else
+            pw = &w->next;
     }
+    return wake;
+}
 
-    *ret = -ENOSYS;
-    pstate->ret = ret;
-    pstate->pathname = pathname;
-    pstate->eventual = NULL;
-    rc = ABT_eventual_create(0, &pstate->eventual);
-    if (rc != ABT_SUCCESS) { *ret = -ENOMEM; goto err; }
-
-    if (op != NULL) op->e = pstate->eventual;
+static void outq_signal(struct abt_io_outwait *wake)
+{
+    struct abt_io_outwait *next;
 
-    rc = ABT_task_create(pool, abt_io_unlink_fn, pstate, NULL);
-    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+    for (; wake != NULL; wake = next) {
+        next = wake->next;
+        completion_signal(&wake->done);
+    }
+}
 
-    if (op == NULL) {
-        rc = ABT_eventual_wait(pstate->eventual, NULL);
-        if (rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+/* Sends as much of the queue as the socket takes, unless another flusher
+ * is already at it, in which case that one is asked to go around again.
+ */
+static void outq_flush(abt_io_conn_t conn, struct abt_io_outq *q)
+{
+    struct iovec iov[ABT_IO_OUTQ_IOV];
+    struct msghdr msg;
+    struct abt_io_outbuf *b;
+    struct abt_io_outwait *wake;
+    ssize_t n;
+    int cnt;
+
+    spin_lock(&q->lock);
+    /* a stale handle must not fail the queue of a new registration */
+    if (conn_get(conn) == NULL) {
+        spin_unlock(&q->lock);
+        return;
     }
-    else {
-        op->e = pstate->eventual;
-        op->state = pstate;
-        op->free_fn = free;
+    if (q->flushing) {
+        q->again = 1;
+        spin_unlock(&q->lock);
+        return;
+    }
+    q->flushing = 1;
+    while (q->queued > 0 && !q->error) {
+        for (cnt = 0, b = q->head; b != NULL && cnt < ABT_IO_OUTQ_IOV; b = b->next) {
+            if (b->len == b->off) continue;
+            iov[cnt].iov_base = b->data + b->off;
+            iov[cnt].iov_len = b->len - b->off;
+            cnt++;
+        }
+        q->again = 0;
+        spin_unlock(&q->lock);
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = cnt;
+        if (conn_get(conn) == NULL) {
+            n = -1;
+            errno = EBADF;
+        }
+        else
+            n = sendmsg(CONN_FD(conn), &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+        spin_lock(&q->lock);
+        if (n >= 0) {
+            outq_consume(q, n);
+            /* let parked senders go as soon as the queue drains enough */
+            wake = outq_take_waiters(q);
+            if (wake != NULL) {
+                spin_unlock(&q->lock);
+                outq_signal(wake);
+                spin_lock(&q->lock);
+            }
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            /* the next EPOLLOUT resumes the flush, unless it already came */
+            if (!q->again) break;
+        }
+        else if (errno != EINTR)
+            q->error = -errno;
     }
-
-    return 0;
-err:
-    if (pstate->eventual != NULL) ABT_eventual_free(&pstate->eventual);
-    if (pstate != NULL && op != NULL) free(pstate);
-    return -1;
+    if (q->error) outq_drop(q);
+    q->flushing = 0;
+    wake = outq_take_waiters(q);
+    spin_unlock(&q->lock);
+    outq_signal(wake);
 }
 
-
-int abt_io_unlink(abt_io_instance_id aid, const char *pathname)
+/* parks the caller until the queue is below the high-water mark, or empty */
+static int outq_wait(struct abt_io_outq *q, int flush)
 {
-    int ret = -1;
-    issue_unlink(aid->progress_pool, NULL, pathname, &ret);
+    struct abt_io_outwait w;
+    int ret;
+
+    spin_lock(&q->lock);
+    while (!q->error && q->queued > (flush ? 0 : q->high_water)) {
+        completion_init(&w.done, &reactor->waiters, ABT_POOL_NULL);
+        w.flush = flush;
+        w.next = q->waiters;
+        q->waiters = &w;
+        __atomic_fetch_add(&reactor->parked, 1, __ATOMIC_RELAXED);
+        spin_unlock(&q->lock);
+        completion_wait(&w.done);
+        spin_lock(&q->lock);
+        __atomic_fetch_sub(&reactor->parked, 1, __ATOMIC_RELEASE);
+    }
+    ret = q->error;
+    spin_unlock(&q->lock);
     return ret;
 }
 
-abt_io_op_t* abt_io_unlink_nb(abt_io_instance_id aid, const char *pathname, int *ret)
+/* fails the queue with err and waits out a flusher still using it */
+static void outq_shutdown(struct abt_io_outq *q, int err)
 {
-    abt_io_op_t *op;
-    int iret;
-
-    op = malloc(sizeof(*op));
-    if (op == NULL) return NULL;
-
-    iret = issue_unlink(aid->progress_pool, op, pathname, ret);
-    if (iret != 0) { free(op); return NULL; }
-    else return op;
+    struct abt_io_outwait *wake;
+
+    spin_lock(&q->lock);
+    while (q->flushing) {
+        q->error = err;
+        spin_unlock(&q->lock);
+        /* the flusher may be a ULT queued on this xstream */
+        if (ABT_thread_yield() != ABT_SUCCESS) sched_yield();
+        spin_lock(&q->lock);
+    }
+    q->error = err;
+    outq_drop(q);
+    wake = outq_take_waiters(q);
+    spin_unlock(&q->lock);
+    outq_signal(wake);
 }
 
-struct abt_io_close_state
+static void outq_reset(struct abt_io_outq *q)
 {
-    int *ret;
-    int fd;
-    ABT_eventual eventual;
-};
+    spin_lock(&q->lock);
+    q->error = 0;
+    q->high_water = ABT_IO_OUTQ_HIGH_WATER;
+    spin_unlock(&q->lock);
+}
 
-static void abt_io_close_fn(void *foo)
+/* returns the output queue of a live connection, creating it on first use */
+static struct abt_io_outq* conn_outq(abt_io_conn_t conn)
 {
-    struct abt_io_close_state *state = foo;
-
-    *state->ret = close(state->fd);
-    if(*state->ret < 0)
-        *state->ret = -errno;
+    struct abt_io_conn *c;
+    struct abt_io_outq *q, *expected = NULL;
+    uint32_t events;
+
+    c = conn_get(conn);
+    if (c == NULL) return NULL;
+    q = __atomic_load_n(&c->outq, __ATOMIC_ACQUIRE);
+    if (q != NULL) return q;
+
+    q = calloc(1, sizeof(*q));
+    if (q == NULL) return NULL;
+    q->high_water = ABT_IO_OUTQ_HIGH_WATER;
+    if (!__atomic_compare_exchange_n(&c->outq, &expected, q, 0,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(q);
+        return expected;
+    }
+    /* the listener flushes on EPOLLOUT, so make sure it is asked for */
+    events = __atomic_load_n(&c->events, __ATOMIC_RELAXED);
+    if (!(events & ABT_IO_SOCK_WRITE))
+        abt_io_sock_modify(conn, events | ABT_IO_SOCK_WRITE);
+    return q;
+}
 
-    ABT_eventual_set(state->eventual, NULL, 0);
+static void reactor_listener(void *foo)
+{
+    struct abt_io_reactor *r = foo;
+    struct epoll_event *evlist;
+    uint64_t poll_ns, last_event = 0, now = 0, count;
+    int ready, j;
+
+    evlist = malloc(r->max_events * sizeof(*evlist));
+    if (evlist == NULL) return;
+
+    while (!__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE)) {
+        /* poll without sleeping for a while after each event, so that a
+         * follow-up event is picked up without a wakeup */
+        poll_ns = __atomic_load_n(&r->poll_ns, __ATOMIC_RELAXED);
+        if (poll_ns) now = abt_io_now_ns();
+        ready = epoll_wait(r->epfd, evlist, r->max_events,
+                poll_ns && now - last_event < poll_ns ? 0 : -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        if (ready > 0 && poll_ns) last_event = abt_io_now_ns();
+        for (j = 0; j < ready; j++) {
+            if (evlist[j].data.u64 == ABT_IO_REACTOR_WAKE) {
+                if (read(r->wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                    perror("read");
+            }
+            else
+                conn_deliver(evlist[j].data.u64, evlist[j].events);
+        }
+    }
+    free(evlist);
     return;
 }
 
-static int issue_close(ABT_pool pool, abt_io_op_t *op, int fd, int *ret)
+int abt_io_socket_initialize(int events)
 {
-    struct abt_io_close_state state;
-    struct abt_io_close_state *pstate = NULL;
-    int rc;
+    struct abt_io_reactor *r;
+    struct epoll_event ev;
+    struct rlimit rl;
+    ABT_pool pool;
+    int max_fds, ret;
 
-    if (op == NULL) pstate = &state;
-    else {
-        pstate = malloc(sizeof(*pstate));
-        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
-    }
+    if (reactor != NULL) return reactor->epfd;
 
-    *ret = -ENOSYS;
-    pstate->ret = ret;
-    pstate->fd = fd;
-    pstate->eventual = NULL;
-    rc = ABT_eventual_create(0, &pstate->eventual);
-    if (rc != ABT_SUCCESS) { *ret = -ENOMEM; goto err; }
+    r = calloc(1, sizeof(*r));
+    if (r == NULL) return -ENOMEM;
+    r->epfd = r->wakefd = -1;
+    r->max_events = events > 0 ? events : ABT_IO_REACTOR_EVENTS;
 
-    if (op != NULL) op->e = pstate->eventual;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_max == RLIM_INFINITY ||
+            rl.rlim_max > ABT_IO_CONN_MAX_FDS)
+        max_fds = ABT_IO_CONN_MAX_FDS;
+    else
+        max_fds = rl.rlim_max;
+    r->num_chunks = (max_fds + ABT_IO_CONN_CHUNK - 1) / ABT_IO_CONN_CHUNK;
+    r->chunks = calloc(r->num_chunks, sizeof(*r->chunks));
+    if (r->chunks == NULL) { ret = -ENOMEM; goto err; }
+
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    r->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (r->epfd < 0 || r->wakefd < 0) { ret = -errno; goto err; }
+    ev.events = EPOLLIN;
+    ev.data.u64 = ABT_IO_REACTOR_WAKE;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->wakefd, &ev) < 0) { ret = -errno; goto err; }
+
+    ret = ABT_pool_create_basic(ABT_POOL_FIFO, ABT_POOL_ACCESS_MPMC, ABT_TRUE, &pool);
+    if (ret != ABT_SUCCESS) { ret = -ENOMEM; goto err; }
+    ret = ABT_xstream_create_basic(ABT_SCHED_DEFAULT, 1, &pool,
+            ABT_SCHED_CONFIG_NULL, &r->xstream);
+    if (ret != ABT_SUCCESS) { ABT_pool_free(&pool); ret = -ENOMEM; goto err; }
+
+    reactor = r;
+    ret = ABT_thread_create(pool, reactor_listener, r, ABT_THREAD_ATTR_NULL,
+            &r->listener);
+    if (ret != ABT_SUCCESS) {
+        reactor = NULL;
+        ABT_xstream_join(r->xstream);
+        ABT_xstream_free(&r->xstream);
+        ret = -ENOMEM;
+        goto err;
+    }
+    return r->epfd;
 
-    rc = ABT_task_create(pool, abt_io_close_fn, pstate, NULL);
-    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+err:
+    if (r->wakefd >= 0) close(r->wakefd);
+    if (r->epfd >= 0) close(r->epfd);
+    free(r->chunks);
+    free(r);
+    return ret;
+}
 
-    if (op == NULL) {
-        rc = ABT_eventual_wait(pstate->eventual, NULL);
-        // what error should we use here?
-        if (rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
-    }
-    else {
-        op->e = pstate->eventual;
-        op->state = pstate;
-        op->free_fn = free;
+/* fails the waiters of a connection and its queued output at finalize */
+static void conn_shutdown(struct abt_io_conn *c)
+{
+    struct abt_io_completion *wake[2];
+    struct abt_io_outq *q;
+    int dir;
+
+    conn_lock(c);
+    c->error = -ESHUTDOWN;
+    for (dir = ABT_IO_CONN_RD; dir <= ABT_IO_CONN_WR; dir++) {
+        wake[dir] = c->waiter[dir];
+        c->waiter[dir] = NULL;
     }
+    q = c->outq;
+    conn_unlock(c);
 
-    return 0;
-err:
-    if (pstate->eventual != NULL) ABT_eventual_free(&pstate->eventual);
-    if (pstate != NULL && op != NULL) free(pstate);
-    return -1;
+    if (q != NULL) outq_shutdown(q, -ESHUTDOWN);
+    for (dir = ABT_IO_CONN_RD; dir <= ABT_IO_CONN_WR; dir++)
+        if (wake[dir] != NULL) completion_signal(wake[dir]);
 }
 
-int abt_io_close(abt_io_instance_id aid, int fd)
+void abt_io_socket_finalize(void)
 {
-    int ret = -1;
-    issue_close(aid->progress_pool, NULL, fd, &ret);
-    return ret;
+    struct abt_io_reactor *r = reactor;
+    struct abt_io_msgbuf *b;
+    uint64_t one = 1;
+    int i, j;
+
+    if (r == NULL) return;
+
+    __atomic_store_n(&r->stop, 1, __ATOMIC_RELEASE);
+    if (write(r->wakefd, &one, sizeof(one)) < 0)
+        perror("write");
+    ABT_thread_join(r->listener);
+    ABT_thread_free(&r->listener);
+    ABT_xstream_join(r->xstream);
+    ABT_xstream_free(&r->xstream);
+
+    /* fail whoever is still parked on a connection, and let them leave
+     * before the connections go away; stop keeps new ones from parking */
+    for (i = 0; i < r->num_chunks; i++) {
+        if (r->chunks[i] == NULL) continue;
+        for (j = 0; j < ABT_IO_CONN_CHUNK; j++)
+            conn_shutdown(&r->chunks[i][j]);
+    }
+    while (__atomic_load_n(&r->parked, __ATOMIC_ACQUIRE) > 0)
+        if (ABT_thread_yield() != ABT_SUCCESS) sched_yield();
+
+    reactor = NULL;
+    for (i = 0; i < r->num_chunks; i++) {
+        if (r->chunks[i] == NULL) continue;
+        for (j = 0; j < ABT_IO_CONN_CHUNK; j++) {
+            outq_free(r->chunks[i][j].outq);
+            if (r->chunks[i][j].inbuf != NULL) {
+                free(r->chunks[i][j].inbuf->data);
+                free(r->chunks[i][j].inbuf);
+            }
+        }
+        free(r->chunks[i]);
+    }
+    free(r->chunks);
+    close(r->wakefd);
+    close(r->epfd);
+    waiters_free(&r->waiters);
+    free(r);
+
+    for (i = 0; i < ABT_IO_MSG_CLASSES; i++) {
+        while ((b = msg_pool[i].free) != NULL) {
+            msg_pool[i].free = b->next;
+            free(b);
+        }
+        msg_pool[i].count = 0;
+    }
 }
 
-abt_io_op_t* abt_io_close_nb(abt_io_instance_id aid, int fd, int *ret)
+abt_io_conn_t abt_io_sock_register(int fd, int events)
 {
-    abt_io_op_t *op;
-    int iret;
+    struct abt_io_conn *c;
+    struct epoll_event ev;
+    abt_io_conn_t conn;
+    int flags;
 
-    op = malloc(sizeof(*op));
-    if (op == NULL) return NULL;
+    c = conn_slot(fd, 1);
+    if (c == NULL) return ABT_IO_CONN_NULL;
+
+    flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || (!(flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0))
+        return ABT_IO_CONN_NULL;
+#ifdef SO_BUSY_POLL
+    /* best effort: raising it above net.core.busy_read needs CAP_NET_ADMIN */
+    flags = __atomic_load_n(&reactor->sock_busy_poll_us, __ATOMIC_RELAXED);
+    if (flags > 0)
+        setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &flags, sizeof(flags));
+#endif
 
-    iret = issue_close(aid->progress_pool, op, fd, ret);
-    if (iret != 0) { free(op); return NULL; }
-    else return op;
+    conn_lock(c);
+    if (c->gen & 1) {
+        /* already registered */
+        conn_unlock(c);
+        return ABT_IO_CONN_NULL;
+    }
+    /* a slot keeps its output queue across registrations, and the
+     * listener only flushes it on EPOLLOUT */
+    if (c->outq != NULL) {
+        outq_reset(c->outq);
+        events |= ABT_IO_SOCK_WRITE;
+    }
+    c->gen++;
+    c->events = events;
+    c->ready = 0;
+    c->error = 0;
+    c->home = ABT_POOL_NULL;
+    if (c->inbuf != NULL) {
+        c->inbuf->start = c->inbuf->end = 0;
+        c->inbuf->eof = 0;
+    }
+    conn = ((uint64_t)c->gen << 32) | (uint32_t)fd;
+    conn_unlock(c);
+
+    ev.events = conn_epoll_events(events);
+    ev.data.u64 = conn;
+    if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        conn_lock(c);
+        c->gen++;
+        conn_unlock(c);
+        return ABT_IO_CONN_NULL;
+    }
+    return conn;
 }
 
-int abt_io_op_wait(abt_io_op_t* op)
+int abt_io_sock_modify(abt_io_conn_t conn, int events)
 {
-    int ret;
+    struct abt_io_conn *c;
+    struct epoll_event ev;
 
-    ret = ABT_eventual_wait(op->e, NULL);
-    return ret == ABT_SUCCESS ? 0 : -1;
+    c = conn_get(conn);
+    if (c == NULL) return -EBADF;
+
+    /* queued output still needs EPOLLOUT to be flushed */
+    if (__atomic_load_n(&c->outq, __ATOMIC_ACQUIRE) != NULL)
+        events |= ABT_IO_SOCK_WRITE;
+    __atomic_store_n(&c->events, events, __ATOMIC_RELAXED);
+    ev.events = conn_epoll_events(events);
+    ev.data.u64 = conn;
+    if (epoll_ctl(reactor->epfd, EPOLL_CTL_MOD, CONN_FD(conn), &ev) < 0)
+        return -errno;
+    return 0;
 }
 
-void abt_io_op_free(abt_io_op_t* op)
+int abt_io_sock_deregister(abt_io_conn_t conn)
 {
-    ABT_eventual_free(&op->e);
-    op->free_fn(op->state);
-    free(op);
-}
+    struct abt_io_conn *c;
+    struct abt_io_completion *wake[2];
+    struct abt_io_outq *q;
+    int ret = 0, dir;
+
+    c = conn_slot(CONN_FD(conn), 0);
+    if (c == NULL) return -EBADF;
+
+    conn_lock(c);
+    if (c->gen != CONN_GEN(conn)) {
+        conn_unlock(c);
+        return -EBADF;
+    }
+    c->gen++;
+    for (dir = ABT_IO_CONN_RD; dir <= ABT_IO_CONN_WR; dir++) {
+        wake[dir] = c->waiter[dir];
+        c->waiter[dir] = NULL;
+    }
+    q = c->outq;
+    conn_unlock(c);
 
+    /* unsent output is dropped; its senders get -EBADF */
+    if (q != NULL) outq_shutdown(q, -EBADF);
 
-// =e
-// READ syscall
-struct abt_io_read_state
-{
-    ssize_t *ret;
-    int fd;
-    void *buf;
-    size_t count;
-    ABT_eventual eventual;
-};
+    if (epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, CONN_FD(conn), NULL) < 0)
+        ret = -errno;
 
-static void abt_io_read_fn(void *foo)
+    /* waiters see the new generation and return -EBADF */
+    for (dir = ABT_IO_CONN_RD; dir <= ABT_IO_CONN_WR; dir++)
+        if (wake[dir] != NULL) completion_signal(wake[dir]);
+    return ret;
+}
+
+ssize_t abt_io_sock_read(abt_io_conn_t conn, void *buf, size_t count)
 {
-    struct abt_io_read_state *state = foo;
+    struct abt_io_conn *c;
+    struct abt_io_inbuf *ib;
+    ssize_t ret;
+
+    /* data already pulled in by abt_io_sock_peek() comes first */
+    c = conn_get(conn);
+    if (c != NULL && (ib = c->inbuf) != NULL && ib->end > ib->start) {
+        ret = ib->end - ib->start;
+        if ((size_t)ret > count) ret = count;
+        memcpy(buf, ib->data + ib->start, ret);
+        ib->start += ret;
+        return ret;
+    }
 
-    *state->ret = read(state->fd, state->buf, state->count);
-    if(*state->ret < 0)
-        *state->ret = -errno;
+    while (1) {
+        if (conn_get(conn) == NULL) return -EBADF;
+        ret = read(CONN_FD(conn), buf, count);
+        if (ret >= 0) break;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return -errno;
+        ret = conn_wait(conn, ABT_IO_CONN_RD);
+        if (ret < 0) return ret;
+    }
+    conn_note_home(conn);
+    return ret;
+}
 
-    ABT_eventual_set(state->eventual, NULL, 0);
-    return;
+ssize_t abt_io_sock_write(abt_io_conn_t conn, const void *buf, size_t count)
+{
+    size_t done = 0;
+    ssize_t ret;
+
+    while (done < count) {
+        if (conn_get(conn) == NULL) return done ? (ssize_t)done : -EBADF;
+        ret = send(CONN_FD(conn), (const char*)buf + done, count - done, MSG_NOSIGNAL);
+        if (ret >= 0) {
+            done += ret;
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return done ? (ssize_t)done : -errno;
+        ret = conn_wait(conn, ABT_IO_CONN_WR);
+        if (ret < 0) return done ? (ssize_t)done : ret;
+    }
+    conn_note_home(conn);
+    return done;
 }
 
-static int issue_read(ABT_pool pool, abt_io_op_t *op, int fd, void *buf,
-        size_t count, ssize_t *ret)
+ssize_t abt_io_sock_peek(abt_io_conn_t conn, size_t len, const void **data)
 {
-    struct abt_io_read_state state;
-    struct abt_io_read_state *pstate = NULL;
-    int rc;
+    struct abt_io_conn *c;
+    struct abt_io_inbuf *ib;
+    size_t size;
+    char *p;
+    ssize_t n;
+    int ret;
 
-    if (op == NULL) pstate = &state;
-    else
-    {
-        pstate = malloc(sizeof(*pstate));
-        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+    c = conn_get(conn);
+    if (c == NULL) return -EBADF;
+    ib = c->inbuf;
+    if (ib == NULL) {
+        ib = calloc(1, sizeof(*ib));
+        if (ib == NULL) return -ENOMEM;
+        c->inbuf = ib;
     }
 
-    *ret = -ENOSYS;
-    pstate->ret = ret;
-    pstate->fd = fd;
-    pstate->buf = buf;
-    pstate->count = count;
-    pstate->eventual = NULL;
-    rc = ABT_eventual_create(0, &pstate->eventual);
-    if (rc != ABT_SUCCESS) { *ret = -ENOMEM; goto err; }
+    if (len == 0) len = 1;
+    while (ib->end - ib->start < len && !ib->eof) {
+        if (ib->size - ib->start < len || ib->end == ib->size) {
+            /* make room: slide the data down, growing if len won't fit */
+            if (ib->size < len) {
+                size = ib->size ? ib->size : ABT_IO_INBUF_SIZE;
+                while (size < len) size *= 2;
+                p = malloc(size);
+                if (p == NULL) return -ENOMEM;
+                memcpy(p, ib->data + ib->start, ib->end - ib->start);
+                free(ib->data);
+                ib->data = p;
+                ib->size = size;
+            }
+            else
+                memmove(ib->data, ib->data + ib->start, ib->end - ib->start);
+            ib->end -= ib->start;
+            ib->start = 0;
+        }
 
-    if (op != NULL) op->e = pstate->eventual;
+        if (conn_get(conn) == NULL) return -EBADF;
+        n = read(CONN_FD(conn), ib->data + ib->end, ib->size - ib->end);
+        if (n > 0)
+            ib->end += n;
+        else if (n == 0)
+            ib->eof = 1;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            ret = conn_wait(conn, ABT_IO_CONN_RD);
+            if (ret < 0) return ret;
+        }
+        else if (errno != EINTR)
+            return -errno;
+    }
+    conn_note_home(conn);
+    *data = ib->data + ib->start;
+    return ib->end - ib->start;
+}
 
-    rc = ABT_task_create(pool, abt_io_read_fn, pstate, NULL);
-    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+int abt_io_sock_consume(abt_io_conn_t conn, size_t len)
+{
+    struct abt_io_conn *c;
+    struct abt_io_inbuf *ib;
+
+    c = conn_get(conn);
+    if (c == NULL) return -EBADF;
+    ib = c->inbuf;
+    if (ib == NULL || ib->end - ib->start < len) return -EINVAL;
+    ib->start += len;
+    if (ib->start == ib->end) ib->start = ib->end = 0;
+    return 0;
+}
 
-    if (op == NULL) {
-        rc = ABT_eventual_wait(pstate->eventual, NULL);
-        // what error should we use here?
-        if (rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
+ssize_t abt_io_sock_sendv(abt_io_conn_t conn, const struct iovec *iov,
+        int iovcnt, int flags)
+{
+    struct abt_io_outq *q;
+    struct abt_io_outwait *wake;
+    struct msghdr msg;
+    ssize_t n;
+    size_t count = 0, done;
+    int ret, again, i;
+
+    if (iovcnt < 0 || iovcnt > IOV_MAX) return -EINVAL;
+    for (i = 0; i < iovcnt; i++) count += iov[i].iov_len;
+
+    q = conn_outq(conn);
+    if (q == NULL) return conn_get(conn) == NULL ? -EBADF : -ENOMEM;
+
+    spin_lock(&q->lock);
+    /* the connection may have been deregistered, and its queue reset by a
+     * new registration of the fd, since conn_outq; deregistration bumps
+     * the generation before it takes the lock to fail the queue */
+    if (conn_get(conn) == NULL || q->error) {
+        ret = q->error ? q->error : -EBADF;
+        spin_unlock(&q->lock);
+        return ret;
+    }
+    if (!(flags & ABT_IO_SEND_MORE) && q->queued == 0 && !q->flushing) {
+        /* nothing queued: send straight from the caller's buffers and queue
+         * only what the socket did not take.  Senders that come along in
+         * the meantime queue behind us, so the rest goes in front. */
+        q->flushing = 1;
+        q->again = 0;
+        spin_unlock(&q->lock);
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = (struct iovec*)iov;
+        msg.msg_iovlen = iovcnt;
+        n = sendmsg(CONN_FD(conn), &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        spin_lock(&q->lock);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            q->error = -errno;
+        done = n > 0 ? n : 0;
+        ret = q->error;
+        if (!ret && done < count)
+            ret = outq_append(q, iov, iovcnt, done, 1);
+        q->flushing = 0;
+        again = q->again || (n >= 0 && q->queued > 0);
+        wake = q->error ? outq_take_waiters(q) : NULL;
+        spin_unlock(&q->lock);
+        outq_signal(wake);
+        if (ret) return ret;
+        if (again) outq_flush(conn, q);
     }
     else {
-        op->e = pstate->eventual;
-        op->state = pstate;
-        op->free_fn = free;
+        ret = outq_append(q, iov, iovcnt, 0, 0);
+        spin_unlock(&q->lock);
+        if (ret) return ret;
+        if (!(flags & ABT_IO_SEND_MORE)) outq_flush(conn, q);
     }
 
-    return 0;
-err:
-    if (pstate->eventual != NULL) ABT_eventual_free(&pstate->eventual);
-    if (pstate != NULL && op != NULL) free(pstate);
-    return -1;
+    ret = outq_wait(q, 0);
+    if (ret) return ret;
+    conn_note_home(conn);
+    return count;
 }
 
-ssize_t abt_io_read(abt_io_instance_id aid, int fd, void *buf, size_t count)
+ssize_t abt_io_sock_send(abt_io_conn_t conn, const void *buf, size_t count,
+        int flags)
 {
-    ssize_t ret = -1;
-    issue_read(aid->progress_pool, NULL, fd, buf, count, &ret);
-    return ret;
+    struct iovec iov;
+
+    iov.iov_base = (void*)buf;
+    iov.iov_len = count;
+    return abt_io_sock_sendv(conn, &iov, 1, flags);
 }
 
+int abt_io_sock_flush(abt_io_conn_t conn)
+{
+    struct abt_io_outq *q;
 
-// WRITE system call
+    q = conn_outq(conn);
+    if (q == NULL) return conn_get(conn) == NULL ? -EBADF : -ENOMEM;
+    outq_flush(conn, q);
+    return outq_wait(q, 1);
+}
 
-struct abt_io_write_state
+int abt_io_sock_set_high_water(abt_io_conn_t conn, size_t bytes)
 {
-    ssize_t *ret;
-    int fd;
-    const void *buf;
-    size_t count;
-    ABT_eventual eventual;
-};
+    struct abt_io_outq *q;
+    struct abt_io_outwait *wake;
+
+    q = conn_outq(conn);
+    if (q == NULL) return conn_get(conn) == NULL ? -EBADF : -ENOMEM;
+    spin_lock(&q->lock);
+    q->high_water = bytes;
+    wake = outq_take_waiters(q);
+    spin_unlock(&q->lock);
+    outq_signal(wake);
+    return 0;
+}
 
-static void abt_io_write_fn(void *foo)
+void* abt_io_msg_alloc(size_t len)
 {
-    struct abt_io_write_state *state = foo;
-
-    *state->ret = write(state->fd, state->buf, state->count);
-    if(*state->ret < 0)
-        *state->ret = -errno;
-
-    ABT_eventual_set(state->eventual, NULL, 0);
-    return;
-};
+    struct abt_io_msgbuf *b = NULL;
+    size_t cls = 0;
+
+    while (cls < ABT_IO_MSG_CLASSES && ((size_t)1 << (cls + ABT_IO_MSG_MIN_SHIFT)) < len)
+        cls++;
+    if (cls < ABT_IO_MSG_CLASSES) {
+        spin_lock(&msg_pool[cls].lock);
+        b = msg_pool[cls].free;
+        if (b != NULL) {
+            msg_pool[cls].free = b->next;
+            msg_pool[cls].count--;
+        }
+        spin_unlock(&msg_pool[cls].lock);
+        if (b == NULL)
+            b = malloc(sizeof(*b) + ((size_t)1 << (cls + ABT_IO_MSG_MIN_SHIFT)));
+    }
+    else
+        b = malloc(sizeof(*b) + len);
+    if (b == NULL) return NULL;
+    b->cls = cls;
+    return b->data;
+}
 
-static int issue_write(ABT_pool pool, abt_io_op_t *op, int fd, const void *buf,
-        size_t count, ssize_t *ret)
+void abt_io_msg_release(void *msg)
 {
-    struct abt_io_write_state state;
-    struct abt_io_write_state *pstate = NULL;
-    int rc;
-
-    if (op == NULL) pstate = &state;
-    else
-    {
-        pstate = malloc(sizeof(*pstate));
-        if (pstate == NULL) { *ret = -ENOMEM; goto err; }
+    struct abt_io_msgbuf *b;
+    size_t cls;
+
+    if (msg == NULL) return;
+    b = (struct abt_io_msgbuf*)((char*)msg - offsetof(struct abt_io_msgbuf, data));
+    cls = b->cls;
+    if (cls < ABT_IO_MSG_CLASSES) {
+        spin_lock(&msg_pool[cls].lock);
+        if (msg_pool[cls].count < ABT_IO_MSG_POOL_MAX) {
+            b->next = msg_pool[cls].free;
+            msg_pool[cls].free = b;
+            msg_pool[cls].count++;
+            b = NULL;
+        }
+        spin_unlock(&msg_pool[cls].lock);
     }
+    free(b);
+}
 
-    *ret = -ENOSYS;
-    pstate->ret = ret;
-    pstate->fd = fd;
-    pstate->buf = buf;
-    pstate->count = count;
-    pstate->eventual = NULL;
-    rc = ABT_eventual_create(0, &pstate->eventual);
-    if (rc != ABT_SUCCESS) { *ret = -ENOMEM; goto err; }
-
-    if (op != NULL) op->e = pstate->eventual;
-
-    rc = ABT_task_create(pool, abt_io_write_fn, pstate, NULL);
-    if(rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
-
-    if (op == NULL) {
-        rc = ABT_eventual_wait(pstate->eventual, NULL);
-        // what error should we use here?
-        if (rc != ABT_SUCCESS) { *ret = -EINVAL; goto err; }
-    }
-    else {
-        op->e = pstate->eventual;
-        op->state = pstate;
-        op->free_fn = free;
+ssize_t abt_io_msg_recv(abt_io_conn_t conn, void **msg)
+{
+    const void *hdr;
+    uint32_t len;
+    size_t got = 0;
+    ssize_t ret;
+    char *buf;
+
+    *msg = NULL;
+    /* the header (and usually the payload) comes out of the receive
+     * buffer; whatever has not arrived yet is read straight into the
+     * message buffer */
+    ret = abt_io_sock_peek(conn, ABT_IO_MSG_HDR, &hdr);
+    if (ret < 0) return ret;
+    if (ret == 0) return 0;
+    if (ret < ABT_IO_MSG_HDR) return -EPROTO;
+    memcpy(&len, hdr, sizeof(len));
+    len = ntohl(len);
+    if (len > ABT_IO_MSG_MAX) return -EMSGSIZE;
+    abt_io_sock_consume(conn, ABT_IO_MSG_HDR);
+
+    buf = abt_io_msg_alloc(len);
+    if (buf == NULL) return -ENOMEM;
+    while (got < len) {
+        ret = abt_io_sock_read(conn, buf + got, len - got);
+        if (ret <= 0) {
+            abt_io_msg_release(buf);
+            return ret < 0 ? ret : -EPROTO;
+        }
+        got += ret;
     }
-
-    return 0;
-err:
-    if (pstate->eventual != NULL) ABT_eventual_free(&pstate->eventual);
-    if (pstate != NULL && op != NULL) free(pstate);
-    return -1;
+    *msg = buf;
+    return len;
 }
 
-ssize_t abt_io_write(abt_io_instance_id aid, int fd, const void *buf,
-        size_t count)
+ssize_t abt_io_msg_send(abt_io_conn_t conn, const void *msg, size_t len,
+        int flags)
 {
-    ssize_t ret = -1;
-    issue_write(aid->progress_pool, NULL, fd, buf, count, &ret);
-    return ret;
+    struct iovec iov[2];
+    uint32_t hdr;
+    ssize_t ret;
+
+    if (len > ABT_IO_MSG_MAX) return -EMSGSIZE;
+    hdr = htonl(len);
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = (void*)msg;
+    iov[1].iov_len = len;
+    ret = abt_io_sock_sendv(conn, iov, 2, flags);
+    return ret < 0 ? ret : (ssize_t)len;
 }
 
-////////////////////////////////////////////
+int abt_io_socket_busy_poll(int poll_us, int sock_busy_poll_us)
+{
+    uint64_t one = 1;
 
+    if (reactor == NULL || poll_us < 0 || sock_busy_poll_us < 0) return -EINVAL;
+#ifndef SO_BUSY_POLL
+    if (sock_busy_poll_us > 0) return -ENOSYS;
+#endif
+    __atomic_store_n(&reactor->sock_busy_poll_us, sock_busy_poll_us, __ATOMIC_RELAXED);
+    __atomic_store_n(&reactor->poll_ns, (uint64_t)poll_us * 1000, __ATOMIC_RELAXED);
+    /* kick the listener out of a blocking wait so it starts polling */
+    if (poll_us > 0 && write(reactor->wakefd, &one, sizeof(one)) < 0)
+        return -errno;
+    return 0;
+}
 
-void event_listener(void* foo)
+int abt_io_socket_home_affinity(int enable)
 {
-    int epfd = *(int*) foo;
-    int numOpenFDs = 1, ready, j;
-    int max_events = 1000;
-    struct epoll_event evlist[max_events];  // TODO: efficient memory allocation
-    //printf(" event listener: epfd %d \n", epfd);
-    while(numOpenFDs > 0) {
-        //printf("%s\n", "about to epoll_wait");
-        ready = epoll_wait(epfd, evlist, max_events, -1);
-        if(ready == -1) {
-            if(errno == EINTR)
-                continue;
-            else if(errno == EINVAL)
-            {
-                printf("epoll_wait invalid fd");
-                exit(-1);
-            }
-            else if (errno == EBADF){
-                printf("epoll_wait bad fd");
-                exit(-1);
-            }
-            else
-            {
-                perror("epoll_wait");
-                exit(-1);
-            }
-        }
-        //printf("ready: %d\n", ready);
-        struct thread_args *ta;
-        for(j=0; j< ready;j++){
-            ta = (struct thread_args*) evlist[j].data.ptr;
-            /*printf(" fd=%d; events: %s%s%s\n", ta->fd,
-                (evlist[j].events & EPOLLIN) ? "EPOLLIN " : "",
-                (evlist[j].events & EPOLLHUP) ? "EPOLLHUP " : "",
-                (evlist[j].events & EPOLLERR) ? "EPOLLERR " : "");
-                */
-            if(evlist[j].events & EPOLLIN){
-                ABT_cond_signal(ta->cond);
-            }
-            else if(evlist[j].events & (EPOLLHUP | EPOLLERR)){
-                printf("    closing fd %d \n", ta->fd);
-                if(close(ta->fd) == -1)
-                    printf("close error");
-                numOpenFDs--;
-            }
-        }
-    }
+    if (reactor == NULL) return -EINVAL;
+    __atomic_store_n(&reactor->home_affinity, enable, __ATOMIC_RELAXED);
+    return 0;
 }
 
-int abt_io_socket_initialize(int events)
+/* returns the live handle of a registered fd */
+static abt_io_conn_t conn_of_fd(int fd)
 {
-    ABT_pool g_pool;
-    ABT_xstream xstream;
-    ABT_thread listener;
-    ABT_pool_create_basic(ABT_POOL_FIFO, ABT_POOL_ACCESS_MPMC, ABT_TRUE, &g_pool);
-    ABT_xstream_create_basic(ABT_SCHED_DEFAULT, 1, &g_pool, ABT_SCHED_CONFIG_NULL, &xstream);
-    ABT_xstream_start(xstream);
-    int* epfd = (int*) malloc(sizeof(int));
-    *epfd = epoll_create(1);
-    //printf(" epoll created fd %d \n", epfd);
-    ABT_thread_create(g_pool, event_listener, epfd, ABT_THREAD_ATTR_NULL, listener);
-    return *epfd;
+    struct abt_io_conn *c = conn_slot(fd, 0);
+    uint32_t gen;
+
+    if (c == NULL) return ABT_IO_CONN_NULL;
+    gen = __atomic_load_n(&c->gen, __ATOMIC_ACQUIRE);
+    if (!(gen & 1)) return ABT_IO_CONN_NULL;
+    return ((uint64_t)gen << 32) | (uint32_t)fd;
 }
 
 io_instance_t* abt_io_register_thread(struct thread_args* ta)
 {
-    // register to epoll handler
-    io_instance_t* instance = (io_instance_t*) malloc(sizeof(instance));
-    struct epoll_event ev;
-    ABT_mutex mutex;
-    ABT_cond cond;
-    mutex = (ABT_mutex) malloc(sizeof(mutex));
-    cond = (ABT_cond) malloc(sizeof(cond));
-    ABT_cond_create(&cond);
-    //printf("Lib: register: client fd = %d\n", ta->fd);
-    ev.events = EPOLLIN;
-    ev.data.ptr = (void *)ta;
-    //printf("Lib: register: epoll fd = %d\n", ta->epfd);
-    //printf("Lib: register: client 2fd = %d\n", ta->fd);
-    ta->cond = cond;
-    if(epoll_ctl(ta->epfd, EPOLL_CTL_ADD, ta->fd, &ev) == -1){
+    io_instance_t* instance;
+
+    if (reactor == NULL || ta->epfd != reactor->epfd) return NULL;
+
+    instance = malloc(sizeof(*instance));
+    if (instance == NULL) return NULL;
+    if (ABT_mutex_create(&instance->mutex) != ABT_SUCCESS) {
+        free(instance);
+        return NULL;
+    }
+    if (ABT_cond_create(&instance->cond) != ABT_SUCCESS) {
+        ABT_mutex_free(&instance->mutex);
+        free(instance);
+        return NULL;
+    }
+    if (abt_io_sock_register(ta->fd, ABT_IO_SOCK_READ) == ABT_IO_CONN_NULL) {
+        ABT_cond_free(&instance->cond);
+        ABT_mutex_free(&instance->mutex);
+        free(instance);
         return NULL;
     }
     instance->epfd = ta->epfd;
-    instance->mutex = mutex;
-    instance->cond = cond;
+    ta->cond = instance->cond;
     return instance;
 }
 
 ssize_t abt_io_epoll_read(io_instance_t* instance, int fd, const void *buf, size_t count)
 {
-    // ABT_eventual_wait()
-    // read()
-    // return
-    ssize_t ret = -1;
-    // how to attain mutex and cond??
-    //printf("about to cond_wait %d", fd);
-    ABT_cond_wait(instance->cond, instance->mutex);
-    int r = read(fd, (char *)buf, count);
-    if(r < 0)
-        ret = -errno;
-    else
-        ret = r;
-    return ret;
-}
+    abt_io_conn_t conn = conn_of_fd(fd);
 
-//
-//
+    if (conn == ABT_IO_CONN_NULL) return -EBADF;
+    return abt_io_sock_read(conn, (void*)buf, count);
+}
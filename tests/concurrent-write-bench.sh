@@ -3,10 +3,23 @@
 set -x
 
 dat1=/tmp/concurrent-write-bench-$$.dat
+csv1=/tmp/concurrent-write-bench-$$.csv
 
 examples/concurrent-write-bench 4096 16 5 $dat1 0
 if [ $? -ne 0 ]; then
     exit 1
 fi
 
+# sweep: 2 sizes x 2 concurrency levels x 3 variants, plus a header line
+examples/concurrent-write-bench sweep 4096,65536 1,16 1 $dat1 0 $csv1
+if [ $? -ne 0 ]; then
+    rm -f $csv1
+    exit 1
+fi
+lines=$(wc -l < $csv1)
+rm -f $csv1
+if [ "$lines" -ne 13 ]; then
+    exit 1
+fi
+
 exit 0
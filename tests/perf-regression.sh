@@ -0,0 +1,191 @@
+#!/bin/bash
+
+# Performance regression check.  Runs a fixed matrix of the example
+# benchmarks on tmpfs and writes the results as JSON (throughput, latency
+# and child CPU time from getrusage, via the "times" builtin).  Timings are
+# only compared when a baseline recorded on the same machine is named in
+# PERF_BASELINE; otherwise the run just checks that the benchmarks work, so
+# that make check does not depend on a baseline nobody stored.
+#
+# Environment:
+#   PERF_SKIP=1              skip the check
+#   PERF_DIR                 scratch directory (default /dev/shm)
+#   PERF_RESULTS             results file (default perf-results.json)
+#   PERF_BASELINE            baseline file to compare with; unset to only
+#                            run the benchmarks
+#   PERF_UPDATE_BASELINE=1   write this run's results to PERF_BASELINE
+#   PERF_TOL_THROUGHPUT      allowed throughput drop (default 0.25 = 25%)
+#   PERF_TOL_LATENCY         allowed latency increase (default 0.50)
+#   PERF_TOL_CPU             allowed CPU time increase (default 0.30)
+
+set -o pipefail
+
+if [ "$PERF_SKIP" = "1" ]; then
+    exit 77
+fi
+
+bin=$PWD/examples
+dir=${PERF_DIR:-/dev/shm}
+results=${PERF_RESULTS:-$PWD/perf-results.json}
+baseline=$PERF_BASELINE
+tol_tput=${PERF_TOL_THROUGHPUT:-0.25}
+tol_lat=${PERF_TOL_LATENCY:-0.50}
+tol_cpu=${PERF_TOL_CPU:-0.30}
+
+if [ ! -d "$dir" ] || [ ! -w "$dir" ]; then
+    echo "perf-regression: $dir is not a writable directory, skipping"
+    exit 77
+fi
+work=$(mktemp -d "$dir/perf-regression-XXXXXX") || exit 1
+trap 'rm -rf "$work"' EXIT
+
+# CPU seconds (user + system) used by waited-for children so far.  "times"
+# must run in this shell: a subshell starts with fresh child usage.
+child_cpu() {
+    times > $work/times
+    awk 'NR == 2 {
+        n = split($0, t, " ")
+        s = 0
+        for (i = 1; i <= n; i++) {
+            split(t[i], p, "m")
+            sub("s", "", p[2])
+            s += p[1] * 60 + p[2]
+        }
+        print s
+    }' $work/times
+}
+
+# elapsed <before> <after>
+elapsed() {
+    awk -v a=$1 -v b=$2 'BEGIN { printf("%.3f", b - a) }'
+}
+
+entries=()
+
+# add_entry <name> <key> <value> [<key> <value> ...]
+add_entry() {
+    local e="{\"name\": \"$1\""
+    shift
+    while [ $# -gt 1 ]; do
+        e="$e, \"$1\": $2"
+        shift 2
+    done
+    entries+=("$e}")
+}
+
+# concurrent-write-bench: throughput and latency per variant and point
+csv=$work/cwb.csv
+child_cpu > $work/cpu0
+$bin/concurrent-write-bench sweep 4096,65536 1,8 1 $work/cwb.dat 0 $csv > /dev/null
+if [ $? -ne 0 ]; then
+    echo "perf-regression: concurrent-write-bench failed"
+    exit 1
+fi
+child_cpu > $work/cpu1
+while IFS=, read type conc size ops secs mibs p50 p99 p999 max; do
+    add_entry "cwb-$type-$size-$conc" mib_s $mibs p50_us $p50 p99_us $p99
+done < <(tail -n +2 $csv)
+add_entry "cwb" cpu_s $(elapsed $(cat $work/cpu0) $(cat $work/cpu1))
+
+# abt-io-overlap vs pthread-overlap: both write their data files to the
+# current directory
+cd $work
+child_cpu > $work/cpu0
+line=$($bin/abt-io-overlap 1 1 1 0 4194304 64 2 2 4 | tail -n 1)
+if [ $? -ne 0 ] || [ -z "$line" ]; then
+    echo "perf-regression: abt-io-overlap failed"
+    exit 1
+fi
+child_cpu > $work/cpu1
+add_entry "overlap-abt-io" ops_s $(echo "$line" | cut -f 11) cpu_s $(elapsed $(cat $work/cpu0) $(cat $work/cpu1))
+
+child_cpu > $work/cpu0
+line=$($bin/pthread-overlap 1 1 4194304 64 4 | tail -n 1)
+if [ $? -ne 0 ] || [ -z "$line" ]; then
+    echo "perf-regression: pthread-overlap failed"
+    exit 1
+fi
+child_cpu > $work/cpu1
+add_entry "overlap-pthread" ops_s $(echo "$line" | cut -f 7) cpu_s $(elapsed $(cat $work/cpu0) $(cat $work/cpu1))
+cd - > /dev/null
+
+# one entry per line, so that the comparison below can stay in awk
+{
+    echo "{"
+    echo "  \"results\": ["
+    n=${#entries[@]}
+    for ((i = 0; i < n; i++)); do
+        if [ $i -lt $((n - 1)) ]; then
+            echo "    ${entries[$i]},"
+        else
+            echo "    ${entries[$i]}"
+        fi
+    done
+    echo "  ]"
+    echo "}"
+} > $results
+cat $results
+
+if [ -z "$baseline" ]; then
+    echo "perf-regression: PERF_BASELINE not set, not comparing"
+    exit 0
+fi
+if [ "$PERF_UPDATE_BASELINE" = "1" ]; then
+    cp $results "$baseline" || exit 1
+    echo "perf-regression: recorded baseline $baseline"
+    exit 0
+fi
+if [ ! -f "$baseline" ]; then
+    echo "perf-regression: no baseline $baseline; record one with PERF_UPDATE_BASELINE=1"
+    exit 1
+fi
+
+# throughput (mib_s, ops_s) may not drop, latency (*_us) and CPU time
+# (cpu_s) may not rise by more than the tolerances; small absolute changes
+# in latency and CPU time are ignored as noise
+awk -v tput=$tol_tput -v lat=$tol_lat -v cpu=$tol_cpu '
+function parse(line, vals,    name, rest, kv, n, i, p) {
+    if (!match(line, /"name": "[^"]*"/))
+        return ""
+    name = substr(line, RSTART + 9, RLENGTH - 10)
+    rest = substr(line, RSTART + RLENGTH)
+    n = split(rest, kv, ",")
+    for (i = 1; i <= n; i++) {
+        if (match(kv[i], /"[^"]+": *[-0-9.eE+]+/)) {
+            split(substr(kv[i], RSTART, RLENGTH), p, ":")
+            gsub(/[" ]/, "", p[1])
+            vals[name "/" p[1]] = p[2] + 0
+        }
+    }
+    return name
+}
+FNR == NR { parse($0, base); next }
+{ parse($0, cur) }
+END {
+    fail = 0
+    for (k in cur) {
+        if (!(k in base))
+            continue
+        b = base[k]
+        c = cur[k]
+        if (k ~ /\/(mib_s|ops_s)$/)
+            bad = c < b * (1 - tput)
+        else if (k ~ /_us$/)
+            bad = c > b * (1 + lat) && c - b > 50
+        else if (k ~ /\/cpu_s$/)
+            bad = c > b * (1 + cpu) && c - b > 0.2
+        else
+            bad = 0
+        if (bad) {
+            printf("perf-regression: %s: %g (baseline %g)\n", k, c, b)
+            fail = 1
+        }
+    }
+    exit fail
+}' "$baseline" $results
+if [ $? -ne 0 ]; then
+    echo "perf-regression: regression against $baseline"
+    exit 1
+fi
+
+exit 0
@@ -0,0 +1,34 @@
+#!/bin/bash
+
+# Directory tree walks and removes must not follow symbolic links: a
+# symlinked root is refused, and a link inside the tree is removed without
+# touching what it points to.
+
+set -x
+
+work=$(mktemp -d /tmp/tree-symlink-XXXXXX) || exit 1
+trap 'rm -rf "$work"' EXIT
+
+mkdir -p $work/outside/keep $work/tree/a/b
+touch $work/outside/keep/file $work/tree/a/file $work/tree/a/b/file
+ln -s $work/outside $work/tree/a/link
+ln -s $work/outside $work/root-link
+
+# a symlinked root is refused by both
+examples/tree-walk walk 2 $work/root-link && exit 1
+examples/tree-walk remove 2 $work/root-link && exit 1
+if [ ! -L $work/root-link ] || [ ! -e $work/outside/keep/file ]; then
+    exit 1
+fi
+
+# the walk reports the link but does not descend into it
+entries=$(examples/tree-walk walk 2 $work/tree) || exit 1
+echo "$entries" | grep -q "^$work/tree/a/link\$" || exit 1
+echo "$entries" | grep -q "keep" && exit 1
+
+examples/tree-walk remove 2 $work/tree || exit 1
+if [ -e $work/tree ] || [ ! -e $work/outside/keep/file ]; then
+    exit 1
+fi
+
+exit 0